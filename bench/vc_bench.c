@@ -0,0 +1,1075 @@
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    VC_BENCH: TEMPOS E VERIFICAO BIT A BIT DOS OPERADORES
+//
+//    Uso: vc_bench [opes]
+//      --images DIR          Pasta com cells.pgm, coins.pgm, flir-01.pgm e flir-04.pgm (.)
+//      --max-size N          Largura da maior imagem sinttica (7680 = 8K)
+//      --min-time S          Tempo mnimo de medio por operador, em segundos (0.2)
+//      --threads N           Threads usadas nos tempos (0 = automtico)
+//      --baseline FILE       Compara com os tempos guardados (ns/pixel)
+//      --max-regression P    Falha se um operador ficar mais de P % mais lento (10)
+//      --save-baseline FILE  Guarda os tempos medidos
+//      --golden FILE         Verifica as sadas contra as assinaturas guardadas
+//      --update-golden FILE  Guarda as assinaturas das sadas
+//      --check-only          S faz as verificaes (sem tempos)
+//
+//    Devolve 1 se alguma sada for diferente ou algum operador regredir.
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../vc.c"
+
+
+#define BENCH_MAX_IMAGES 16
+#define BENCH_MAX_RESULTS 1024
+// Imagens at esta largura so tambm verificadas com todos os nveis de SIMD e de threads
+#define BENCH_CHECK_MAX_WIDTH 640
+
+typedef struct {
+    char *name;
+    int inchannels;
+    int outchannels;
+    int outpacked;
+    int outwidth;               // Largura fixa da sada (0 = a da entrada)
+    int (*run)(IVC *src, IVC *dst);
+    int untimed;                // S entra na verificao (E/S e equivalncias), sem tempos
+} BENCH_OP;
+
+typedef struct {
+    char name[64];
+    int bundled;                // Imagem includa no repositrio (entra nas assinaturas)
+    IVC *gray;
+    IVC *rgb;
+} BENCH_IMAGE;
+
+typedef struct {
+    char key[128];              // "operador imagem"
+    double value;
+    unsigned long long hash;
+} BENCH_RESULT;
+
+// Imagens do repositrio (PGM em --images)
+static char *bench_bundled[] = { "cells", "coins", "flir-01", "flir-04" };
+static char *bench_imagedir = ".";
+
+#define BENCH_NUM_BUNDLED ((int) (sizeof(bench_bundled) / sizeof(bench_bundled[0])))
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    OPERADORES MEDIDOS
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+static int bench_hsv_segmentation(IVC *src, IVC *dst) {
+    return vc_rgb_to_hsv_segmentation(src, dst, 30, 90, 20, 100, 20, 100);
+}
+
+static int bench_colormap_ironbow(IVC *src, IVC *dst) {
+    return vc_gray_to_colormap(src, dst, VC_COLORMAP_IRONBOW);
+}
+
+static int bench_gray_to_binary(IVC *src, IVC *dst) {
+    return vc_gray_to_binary(src, dst, 128);
+}
+
+static int bench_percentile_threshold(IVC *src, IVC *dst) {
+    return vc_gray_to_binary_percentile_threshold(src, dst, 30.0f);
+}
+
+static int bench_midpoint_threshold(IVC *src, IVC *dst) {
+    return vc_gray_midpoint_threshold(src, dst, 25);
+}
+
+// Threshold s numa regio de interesse (a metade central), atravs de vistas de src e de dst
+static int bench_roi_midpoint_threshold(IVC *src, IVC *dst) {
+    IVC *roisrc = vc_image_view(src, src->width / 4, src->height / 4, src->width / 2, src->height / 2);
+    IVC *roidst = vc_image_view(dst, dst->width / 4, dst->height / 4, dst->width / 2, dst->height / 2);
+    int y, ok;
+
+    for (y = 0; y < dst->height; y++) memset(dst->data + y * dst->bytesperline, 0, dst->width);
+    ok = (roisrc != NULL) && (roidst != NULL) && vc_gray_midpoint_threshold(roisrc, roidst, 25);
+
+    vc_image_free(roisrc);
+    vc_image_free(roidst);
+    return ok;
+}
+
+static int bench_window_min(IVC *src, IVC *dst) {
+    IVC *max = vc_image_new(src->width, src->height, 1, 255);
+    int ok = (max != NULL) && vc_gray_window_minmax(src, dst, max, 25);
+
+    vc_image_free(max);
+    return ok;
+}
+
+// O mesmo mnimo, calculado no lugar (src == dstmin) com tiles pequenos: o halo de cada tile
+//  lido de pixels que os tiles vizinhos j escreveram (o resultado tem de ser igual a window_min)
+static int bench_window_min_inplace(IVC *src, IVC *dst) {
+    int y, ok;
+
+    for (y = 0; y < dst->height; y++) memcpy(dst->data + y * dst->bytesperline, src->data + y * src->bytesperline, src->width);
+    vc_set_tile_size(64, 32);
+    ok = vc_gray_window_minmax(dst, dst, NULL, 25);
+    vc_set_tile_size(0, 0);
+    return ok;
+}
+
+static int bench_bradley_threshold(IVC *src, IVC *dst) {
+    return vc_gray_bradley_threshold(src, dst, 25, 0.15f);
+}
+
+static int bench_niblack_threshold(IVC *src, IVC *dst) {
+    return vc_gray_niblack_threshold(src, dst, 25, -0.2f);
+}
+
+static int bench_sauvola_threshold(IVC *src, IVC *dst) {
+    return vc_gray_sauvola_threshold(src, dst, 25, 0.5f);
+}
+
+// O histograma (256 contadores de 32 bits)  guardado numa "imagem" de 1024 x 1
+static int bench_histogram(IVC *src, IVC *dst) {
+    unsigned int hist[256];
+
+    if (!vc_gray_histogram(src, hist)) return 0;
+    memcpy(dst->data, hist, sizeof(hist));
+    return 1;
+}
+
+static int bench_pipeline(IVC *src, IVC *dst) {
+    VC_PIPELINE *p = vc_pipeline_new();
+    int ok;
+
+    if (p == NULL) return 0;
+    ok = vc_pipeline_add_rgb_to_gray(p) && vc_pipeline_add_midpoint_threshold(p, 25) && vc_pipeline_add_invert(p);
+    ok = ok && vc_pipeline_run(p, src, dst);
+    vc_pipeline_free(p);
+    return ok;
+}
+
+static int bench_box_filter_rgb(IVC *src, IVC *dst) {
+    return vc_box_filter(src, dst, 9);
+}
+
+static int bench_gaussian_filter(IVC *src, IVC *dst) {
+    return vc_gaussian_filter(src, dst, 0, 1.5f);
+}
+
+static int bench_sobel(IVC *src, IVC *dst) {
+    return vc_gray_gradient(src, dst, VC_GRADIENT_SOBEL, VC_NORM_L1, 0);
+}
+
+// Magnitude L2 com supresso de no-mximos e direo no segundo canal
+static int bench_prewitt_nms(IVC *src, IVC *dst) {
+    return vc_gray_gradient(src, dst, VC_GRADIENT_PREWITT, VC_NORM_L2, 1);
+}
+
+// Suavizao gaussiana fundida antes do threshold (a imagem filtrada no  escrita)
+static int bench_pipeline_gaussian(IVC *src, IVC *dst) {
+    VC_PIPELINE *p = vc_pipeline_new();
+    int ok;
+
+    if (p == NULL) return 0;
+    ok = vc_pipeline_add_rgb_to_gray(p) && vc_pipeline_add_gaussian_filter(p, 0, 1.5f) && vc_pipeline_add_midpoint_threshold(p, 25);
+    ok = ok && vc_pipeline_run(p, src, dst);
+    vc_pipeline_free(p);
+    return ok;
+}
+
+// Etiquetagem da mscara de vc_gray_to_binary (a etiqueta de 16 bits  a sada)
+static int bench_blob_labelling(IVC *src, IVC *dst) {
+    IVC *mask = vc_image_new(src->width, src->height, 1, 255);
+    OVC *blobs;
+    int nlabels = -1;
+
+    if ((mask != NULL) && vc_gray_to_binary(src, mask, 128)) {
+        blobs = vc_binary_blob_labelling(mask, dst, &nlabels, VC_CONNECTIVITY_8);
+        free(blobs);
+    }
+    vc_image_free(mask);
+    return nlabels >= 0;
+}
+
+// Abertura 15x15 da mscara empacotada de vc_gray_to_binary
+static int bench_binary_open_packed(IVC *src, IVC *dst) {
+    IVC *mask = vc_image_new_packed(src->width, src->height);
+    int ok = (mask != NULL) && vc_gray_to_binary(src, mask, 128) && vc_binary_open(mask, dst, 15, 15, VC_SE_RECT);
+
+    vc_image_free(mask);
+    return ok;
+}
+
+// A mesma abertura, sobre os segmentos da mscara (o resultado tem de ser igual)
+static int bench_rle_open(IVC *src, IVC *dst) {
+    IVC *mask = vc_image_new_packed(src->width, src->height);
+    VC_RLE *rle = NULL;
+    int ok = (mask != NULL) && vc_gray_to_binary(src, mask, 128) && ((rle = vc_rle_encode(mask)) != NULL) &&
+             vc_rle_erode(rle, rle, 15, 15, VC_SE_RECT) && vc_rle_dilate(rle, rle, 15, 15, VC_SE_RECT) && vc_rle_decode(rle, dst);
+
+    vc_rle_free(rle);
+    vc_image_free(mask);
+    return ok;
+}
+
+// Etiquetagem sobre os segmentos da mscara (o resultado tem de ser igual ao de threshold_blob_labelling)
+static int bench_rle_labelling(IVC *src, IVC *dst) {
+    IVC *mask = vc_image_new(src->width, src->height, 1, 255);
+    VC_RLE *rle = NULL;
+    OVC *blobs;
+    int nlabels = -1;
+
+    if ((mask != NULL) && vc_gray_to_binary(src, mask, 128) && ((rle = vc_rle_encode(mask)) != NULL)) {
+        blobs = vc_rle_blob_labelling(rle, dst, &nlabels, VC_CONNECTIVITY_8);
+        free(blobs);
+    }
+    vc_rle_free(rle);
+    vc_image_free(mask);
+    return nlabels >= 0;
+}
+
+static int bench_gray_erode(IVC *src, IVC *dst) {
+    return vc_gray_erode(src, dst, 15, 15, VC_SE_RECT);
+}
+
+static int bench_gray_dilate_cross(IVC *src, IVC *dst) {
+    return vc_gray_dilate(src, dst, 15, 9, VC_SE_CROSS);
+}
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    VERIFICAES (E/S E EQUIVALNCIAS, SEM TEMPOS)
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Ficheiros temporrios, criados na pasta atual e apagados no fim de cada verificao
+#define BENCH_TMP_A "vc_bench_tmp_a.pgm"
+#define BENCH_TMP_B "vc_bench_tmp_b.pgm"
+
+// Mesmas dimenses e os mesmos bytes vlidos em todas as linhas
+static int bench_equal(IVC *a, IVC *b) {
+    int n, y;
+
+    if ((a == NULL) || (b == NULL) || (a->width != b->width) || (a->height != b->height) ||
+        (a->channels != b->channels) || (a->packed != b->packed)) return 0;
+
+    n = a->packed ? (a->width + 7) / 8 : a->width * a->channels;
+    for (y = 0; y < a->height; y++) {
+        if (memcmp(a->data + y * a->bytesperline, b->data + y * b->bytesperline, n) != 0) return 0;
+    }
+
+    return 1;
+}
+
+static int bench_copy(IVC *src, IVC *dst) {
+    int y;
+
+    if ((src == NULL) || (src->width != dst->width) || (src->height != dst->height) || (src->channels != dst->channels)) return 0;
+    for (y = 0; y < src->height; y++) memcpy(dst->data + y * dst->bytesperline, src->data + y * src->bytesperline, src->width * src->channels);
+
+    return 1;
+}
+
+// Ler -> escrever -> voltar a ler pelo I/O assncrono; a imagem relida tem de ser igual a src.
+// Com VC_AIO_AUTO tanto serve o io_uring como a thread de I/O (o io_uring pode no existir).
+static int bench_aio_roundtrip(IVC *src, IVC *dst, int backend) {
+    VC_AIO *aio = vc_aio_new(2, backend);
+    IVC *frame = NULL, *reread = NULL;
+    int ok = (aio != NULL) && ((backend == VC_AIO_AUTO) || (vc_aio_backend(aio) == backend));
+
+    ok = ok && vc_write_image(BENCH_TMP_A, src) && vc_aio_read(aio, BENCH_TMP_A) && ((frame = vc_aio_wait_read(aio)) != NULL);
+    ok = ok && bench_equal(frame, src) && vc_aio_write(aio, BENCH_TMP_B, frame) && vc_aio_flush(aio);
+    ok = ok && vc_aio_read(aio, BENCH_TMP_B) && ((reread = vc_aio_wait_read(aio)) != NULL);
+    ok = ok && bench_equal(reread, src) && bench_copy(reread, dst);
+
+    if (aio != NULL) {
+        vc_aio_release(aio, frame);
+        vc_aio_release(aio, reread);
+        vc_aio_free(aio);
+    }
+    remove(BENCH_TMP_A);
+    remove(BENCH_TMP_B);
+    return ok;
+}
+
+static int bench_aio_threads(IVC *src, IVC *dst) {
+    return bench_aio_roundtrip(src, dst, VC_AIO_THREADS);
+}
+
+static int bench_aio_auto(IVC *src, IVC *dst) {
+    return bench_aio_roundtrip(src, dst, VC_AIO_AUTO);
+}
+
+// Escreve a imagem em ASCII (P1, P2 ou P3), com comentrios no header (um deles logo a seguir a
+// um nmero), linhas de comprimentos variados e alguns valores com zeros  esquerda
+static int bench_write_ascii(char *filename, IVC *image, int format) {
+    FILE *file = fopen(filename, "wb");
+    int n = image->width * image->channels;
+    int x, y, i = 0, v;
+
+    if (file == NULL) return 0;
+
+    fprintf(file, "P%d\n# vc_bench\n%d %d# largura e altura\n", format, image->width, image->height);
+    if (format != 1) fprintf(file, "255\n");
+    for (y = 0; y < image->height; y++) {
+        for (x = 0; x < n; x++, i++) {
+            v = image->data[y * image->bytesperline + x];
+            // No PBM o 1  preto; os pixels podem estar ou no separados por espaos
+            if (format == 1) fprintf(file, (i % 7 == 6) ? "%c " : "%c", v ? '0' : '1');
+            else fprintf(file, (i % 97 == 0) ? "%04d%c" : "%d%c", v, (i % 17 == 16) ? '\n' : ' ');
+        }
+    }
+
+    return fclose(file) == 0;
+}
+
+// A imagem escrita em ASCII e relida tem de ser igual  relida do ficheiro binrio
+static int bench_ascii_roundtrip(IVC *src, IVC *dst, int format) {
+    IVC *binary = NULL, *ascii = NULL;
+    int ok = vc_write_image(BENCH_TMP_A, src) && ((binary = vc_read_image(BENCH_TMP_A)) != NULL);
+
+    ok = ok && bench_write_ascii(BENCH_TMP_B, binary, format) && ((ascii = vc_read_image(BENCH_TMP_B)) != NULL);
+    ok = ok && (ascii->levels == binary->levels) && bench_equal(ascii, binary) && bench_copy(ascii, dst);
+
+    vc_image_free(binary);
+    vc_image_free(ascii);
+    remove(BENCH_TMP_A);
+    remove(BENCH_TMP_B);
+    return ok;
+}
+
+static int bench_pgm_ascii(IVC *src, IVC *dst) {
+    return bench_ascii_roundtrip(src, dst, 2);
+}
+
+static int bench_ppm_ascii(IVC *src, IVC *dst) {
+    return bench_ascii_roundtrip(src, dst, 3);
+}
+
+// PBM: a mscara empacotada de vc_gray_to_binary  escrita em P4 e lida como imagem de 0/1
+static int bench_pbm_ascii(IVC *src, IVC *dst) {
+    IVC *mask = vc_image_new_packed(src->width, src->height);
+    int ok = (mask != NULL) && vc_gray_to_binary(src, mask, 128) && bench_ascii_roundtrip(mask, dst, 1);
+
+    vc_image_free(mask);
+    return ok;
+}
+
+// vc_stream_midpoint_threshold com faixas de vrias alturas tem de dar o mesmo que
+// vc_gray_midpoint_threshold sobre a imagem inteira. Nas faixas mais baixas que o kernel
+// o halo de cada faixa vem de vrias faixas anteriores.
+static int bench_stream_midpoint(IVC *src, IVC *dst) {
+    static int striprows[] = { 1, 5, 16, 25, 100 };
+    IVC *out;
+    int i, ok = vc_gray_midpoint_threshold(src, dst, 25) && vc_write_image(BENCH_TMP_A, src);
+
+    for (i = 0; ok && (i < (int) (sizeof(striprows) / sizeof(striprows[0]))); i++) {
+        ok = vc_stream_midpoint_threshold(BENCH_TMP_A, BENCH_TMP_B, 25, striprows[i]) && ((out = vc_read_image(BENCH_TMP_B)) != NULL);
+        if (ok) {
+            ok = bench_equal(out, dst);
+            vc_image_free(out);
+        }
+    }
+
+    remove(BENCH_TMP_A);
+    remove(BENCH_TMP_B);
+    return ok;
+}
+
+// Mscara empacotada de vc_gray_to_binary -> RLE -> vc_rle_write -> vc_rle_read: os segmentos
+// relidos tm de ser iguais; dst  a mscara descodificada (igual a gray_to_binary_packed)
+static int bench_rle_file(IVC *src, IVC *dst) {
+    IVC *mask = vc_image_new_packed(src->width, src->height);
+    VC_RLE *rle = NULL, *reread = NULL;
+    int ok = (mask != NULL) && vc_gray_to_binary(src, mask, 128) && ((rle = vc_rle_encode(mask)) != NULL);
+
+    ok = ok && vc_rle_write(BENCH_TMP_A, rle) && ((reread = vc_rle_read(BENCH_TMP_A)) != NULL);
+    ok = ok && (reread->width == rle->width) && (reread->height == rle->height) && (reread->nspans == rle->nspans) &&
+         (memcmp(reread->rowstart, rle->rowstart, (rle->height + 1) * sizeof(int)) == 0) &&
+         (memcmp(reread->spans, rle->spans, rle->nspans * sizeof(VC_SPAN)) == 0);
+    ok = ok && vc_rle_decode(reread, dst);
+
+    vc_rle_free(rle);
+    vc_rle_free(reread);
+    vc_image_free(mask);
+    remove(BENCH_TMP_A);
+    return ok;
+}
+
+static int bench_write_bytes(char *filename, char *bytes, size_t size) {
+    FILE *file = fopen(filename, "wb");
+    int ok;
+
+    if (file == NULL) return 0;
+    ok = (fwrite(bytes, 1, size, file) == size);
+    return (fclose(file) == 0) && ok;
+}
+
+// Paleta (1 -> 3 canais) no lugar: src  uma imagem de 1 canal sobre o buffer de dst, com o
+// mesmo bytesperline. O kernel escreveria 3 bytes por pixel sobre pixels de src ainda por ler,
+// pelo que vc_pipeline_run tem de trabalhar sobre uma cpia (igual a gray_to_color_palette).
+static int bench_pipeline_palette_inplace(IVC *src, IVC *dst) {
+    VC_PIPELINE *p = vc_pipeline_new();
+    IVC gray = *dst;
+    int y, ok;
+
+    gray.channels = 1;
+    gray.ownership = VC_OWN_VIEW;
+    for (y = 0; y < src->height; y++) memcpy(gray.data + y * gray.bytesperline, src->data + y * src->bytesperline, src->width);
+
+    ok = (p != NULL) && vc_pipeline_add_palette(p) && vc_pipeline_run(p, &gray, dst);
+    vc_pipeline_free(p);
+    return ok;
+}
+
+// Pastas temporrias do lote (criadas e apagadas por bench_batch)
+#define BENCH_TMP_IN "vc_bench_tmp_in"
+#define BENCH_TMP_OUT "vc_bench_tmp_out"
+#define BENCH_BATCH_FRAMES 5
+
+static void bench_mkdir(char *dir) {
+#ifdef _WIN32
+    CreateDirectoryA(dir, NULL);
+#else
+    mkdir(dir, 0755);
+#endif
+}
+
+static void bench_rmdir(char *dir) {
+#ifdef _WIN32
+    RemoveDirectoryA(dir);
+#else
+    rmdir(dir);
+#endif
+}
+
+// vc_batch_process (midpoint + inverso, como o main) sobre uma sequncia de imagens derivadas
+// de src: cada imagem escrita tem de ser igual a vc_pipeline_run sobre a mesma imagem.
+// dst  o resultado da primeira imagem.
+static int bench_batch(IVC *src, IVC *dst) {
+    VC_PIPELINE *p = vc_pipeline_new();
+    IVC *frame = vc_image_new(src->width, src->height, 1, 255);
+    IVC *ref = vc_image_new(src->width, src->height, 1, 255);
+    IVC *out;
+    char path[64];
+    int i, x, y, ok;
+
+    ok = (p != NULL) && (frame != NULL) && (ref != NULL) && vc_pipeline_add_midpoint_threshold(p, 25) && vc_pipeline_add_invert(p);
+    bench_mkdir(BENCH_TMP_IN);
+    bench_mkdir(BENCH_TMP_OUT);
+    for (i = 0; ok && (i < BENCH_BATCH_FRAMES); i++) {
+        for (y = 0; y < src->height; y++) {
+            for (x = 0; x < src->width; x++) frame->data[y * frame->bytesperline + x] = (unsigned char) (src->data[y * src->bytesperline + x] ^ (i * 37));
+        }
+        snprintf(path, sizeof(path), "%s/frame%d.pgm", BENCH_TMP_IN, i);
+        ok = vc_write_image(path, frame);
+    }
+
+    ok = ok && (vc_batch_process(BENCH_TMP_IN, BENCH_TMP_OUT, p, 2) == BENCH_BATCH_FRAMES);
+
+    for (i = 0; i < BENCH_BATCH_FRAMES; i++) {
+        snprintf(path, sizeof(path), "%s/frame%d.pgm", BENCH_TMP_IN, i);
+        out = ok ? vc_read_image(path) : NULL;
+        ok = ok && (out != NULL) && vc_pipeline_run(p, out, ref);
+        vc_image_free(out);
+        remove(path);
+
+        snprintf(path, sizeof(path), "%s/frame%d.pgm", BENCH_TMP_OUT, i);
+        out = ok ? vc_read_image(path) : NULL;
+        ok = ok && bench_equal(out, ref) && ((i > 0) || bench_copy(out, dst));
+        vc_image_free(out);
+        remove(path);
+    }
+    bench_rmdir(BENCH_TMP_IN);
+    bench_rmdir(BENCH_TMP_OUT);
+
+    vc_pipeline_free(p);
+    vc_image_free(frame);
+    vc_image_free(ref);
+    return ok;
+}
+
+// FNV-1a de 64 bits de um vetor (continua a partir de h)
+static unsigned long long bench_hash_bytes(unsigned long long h, void *data, size_t size) {
+    unsigned char *p = (unsigned char *) data;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+// Caractersticas dos blobs da mscara de vc_gray_to_binary. A sada (8 x 1)  a assinatura
+// dos vetores inteiros (rea, caixa, janelas do permetro e momentos). A acumulao por faixas
+// tem de dar o mesmo, e a tabela de vc_binary_blob_labelling a mesma rea, caixa e permetro.
+static int bench_blob_features(IVC *src, IVC *dst) {
+    IVC *mask = vc_image_new(src->width, src->height, 1, 255);
+    IVC *labels = vc_image_new(src->width, src->height, 2, 255);
+    IVC *strip;
+    VC_BLOB_FEATURES *f = NULL, *fs = NULL;
+    OVC *blobs = NULL;
+    unsigned long long h = 1469598103934665603ULL;
+    int nlabels = -1, n, y, i, ok;
+
+    ok = (mask != NULL) && (labels != NULL) && vc_gray_to_binary(src, mask, 128);
+    ok = ok && (((blobs = vc_binary_blob_labelling(mask, labels, &nlabels, VC_CONNECTIVITY_8)) != NULL) || (nlabels == 0));
+    ok = ok && ((f = vc_blob_features(labels, nlabels)) != NULL) && (f->count == nlabels) && ((fs = vc_blob_features_new(0)) != NULL);
+    for (y = 0; ok && (y < labels->height); y += 7) {
+        strip = vc_image_view(labels, 0, y, labels->width, (y + 7 < labels->height) ? 7 : labels->height - y);
+        ok = (strip != NULL) && vc_blob_features_accumulate(fs, strip, y);
+        vc_image_free(strip);
+    }
+    ok = ok && vc_blob_features_finish(fs) && (fs->count == f->count);
+
+    n = ok ? f->count : 0;
+    for (i = 0; ok && (i < n); i++) {
+        ok = (blobs[i].area == f->area[i]) && (blobs[i].x == f->xmin[i]) && (blobs[i].y == f->ymin[i]) &&
+             (blobs[i].width == f->xmax[i] - f->xmin[i] + 1) && (blobs[i].height == f->ymax[i] - f->ymin[i] + 1) &&
+             (blobs[i].perimeter == (int) (f->perimeter[i] + 0.5f));
+    }
+
+#define BENCH_FEATURE(field) \
+    ok = ok && (memcmp(f->field, fs->field, n * sizeof(f->field[0])) == 0); \
+    h = bench_hash_bytes(h, f->field, n * sizeof(f->field[0]));
+
+    BENCH_FEATURE(area)
+    BENCH_FEATURE(xmin)
+    BENCH_FEATURE(ymin)
+    BENCH_FEATURE(xmax)
+    BENCH_FEATURE(ymax)
+    BENCH_FEATURE(edges)
+    BENCH_FEATURE(corners)
+    BENCH_FEATURE(m10)
+    BENCH_FEATURE(m01)
+    BENCH_FEATURE(m20)
+    BENCH_FEATURE(m02)
+    BENCH_FEATURE(m11)
+#undef BENCH_FEATURE
+
+    for (i = 0; i < 8; i++) dst->data[i] = (unsigned char) (h >> (8 * i));
+
+    vc_blob_features_free(f);
+    vc_blob_features_free(fs);
+    free(blobs);
+    vc_image_free(mask);
+    vc_image_free(labels);
+    return ok;
+}
+
+// Escreve size bytes num ficheiro temporrio e l-o com vc_read_image
+static IVC *bench_read_bytes(char *bytes, size_t size) {
+    IVC *image = bench_write_bytes(BENCH_TMP_A, bytes, size) ? vc_read_image(BENCH_TMP_A) : NULL;
+
+    remove(BENCH_TMP_A);
+    return image;
+}
+
+// Headers e pixels invlidos tm de dar NULL; os casos limite vlidos tm de dar os pixels certos
+static int bench_netpbm_headers(void) {
+    static char *invalid[] = {
+        "P7 4 4 255\n",                         // Formato desconhecido
+        "P5 4\n",                               // Header incompleto
+        "P5 4 4",                               // Sem o valor mximo
+        "P5 99999999999 4 255\n",               // Largura no cabe num int
+        "P5 0 4 255\n",                         // Largura nula
+        "P5 4 4 256\n",                         // Valor mximo acima de 255
+        "P5 4x 4 255\n",                        // Lixo a seguir a um nmero
+        "P5 4 4 255\n0123456789",               // Pixels em falta (binrio)
+        "P2 2 2 255\n0 1 2\n",                  // Pixels em falta (ASCII)
+        "P2 2 1 255\n0 300\n",                  // Pixel acima do valor mximo
+        "P2 2 1 255\n0 -1\n",                   // Pixel negativo
+        "P1 2 1\n0 2\n",                        // Pixel PBM que no  0 nem 1
+        "P3 1 1 255\n1 2\n",                    // Canal em falta
+    };
+    // Comentrios em todo o lado, '#' colado aos nmeros, zeros  esquerda e sem '\n' no fim
+    static char *valid = "#c\nP2#c\n3#c\n2 255#c\n0 255\n#c\n007 1#c\n0 042";
+    static unsigned char pixels[] = { 0, 255, 7, 1, 0, 42 };
+    IVC *image;
+    int i, ok = 1;
+
+    printf("Ficheiros invlidos (com VC_DEBUG, os erros de vc_read_image so esperados):\n");
+    for (i = 0; i < (int) (sizeof(invalid) / sizeof(invalid[0])); i++) {
+        if ((image = bench_read_bytes(invalid[i], strlen(invalid[i]))) != NULL) {
+            printf("ERROR -> bench_netpbm_headers():\n\tAccepted invalid file: \"%s\"\n", invalid[i]);
+            vc_image_free(image);
+            ok = 0;
+        }
+    }
+
+    image = bench_read_bytes(valid, strlen(valid));
+    ok = ok && (image != NULL) && (image->width == 3) && (image->height == 2) &&
+         (memcmp(image->data, pixels, 3) == 0) && (memcmp(image->data + image->bytesperline, pixels + 3, 3) == 0);
+    vc_image_free(image);
+
+    return ok;
+}
+
+// vc_image_map de cada PGM do repositrio tem de dar os pixels de vc_read_image, com data a
+// apontar para dentro do mapeamento; depois de vc_image_free o mapeamento j no existe
+static int bench_image_map(void) {
+    char path[1024];
+    IVC *mapped, *read;
+    unsigned char *base;
+    size_t size;
+    int i, unmapped, ok = 1;
+#ifdef _WIN32
+    MEMORY_BASIC_INFORMATION info;
+#endif
+
+    for (i = 0; ok && (i < BENCH_NUM_BUNDLED); i++) {
+        snprintf(path, sizeof(path), "%s/%s.pgm", bench_imagedir, bench_bundled[i]);
+        mapped = vc_image_map(path, 1);
+        read = vc_read_image(path);
+        ok = (mapped != NULL) && (mapped->ownership == VC_OWN_MAP) && bench_equal(mapped, read) &&
+             (mapped->data > (unsigned char *) mapped->mapbase) &&
+             (mapped->data + (size_t) mapped->bytesperline * mapped->height <= (unsigned char *) mapped->mapbase + mapped->mapsize);
+        vc_image_free(read);
+        if (mapped == NULL) break;
+
+        base = (unsigned char *) mapped->mapbase;
+        size = mapped->mapsize;
+        vc_image_free(mapped);
+#ifdef _WIN32
+        unmapped = (VirtualQuery(base, &info, sizeof(info)) == 0) || (info.State == MEM_FREE);
+#else
+        unmapped = (msync(base, size, MS_ASYNC) != 0) && (errno == ENOMEM);
+#endif
+        ok = ok && unmapped;
+    }
+
+    return ok;
+}
+
+// Ficheiros RLE corrompidos tm de dar NULL (em especial inteiros que no cabem em 32 bits,
+// que truncados dariam um segmento vlido)
+static int bench_rle_corrupt(void) {
+    static struct { char *bytes; size_t size; } invalid[] = {
+        { "VCRLE 64 1\n\x01\x80\x80\x80\x80\x10\x01", 18 },   // Intervalo de 2^32 (truncado daria 0)
+        { "VCRLE 64 1\n\x01\x81\x80\x80\x80\x70\x01", 18 },   // Intervalo acima de 2^32 (truncado daria 1)
+        { "VCRLE 64 1\n\x01\x80\x80\x80\x80\x80\x01\x01", 19 }, // Inteiro com mais de 5 bytes
+        { "VCRLE 64 1\n\x01\x3F\x02", 14 },                       // Segmento para l do fim da linha
+        { "VCRLE 64 2\n\x01\x00\x04", 14 },                       // Falta a segunda linha
+        { "VCRLE 64 1\n\x02\x00\x04\x00\x04", 16 },               // Segmentos que se tocam
+    };
+    VC_RLE *rle;
+    int i, ok = 1;
+
+    printf("Ficheiros RLE invlidos (com VC_DEBUG, os erros de vc_rle_read so esperados):\n");
+    for (i = 0; i < (int) (sizeof(invalid) / sizeof(invalid[0])); i++) {
+        rle = bench_write_bytes(BENCH_TMP_A, invalid[i].bytes, invalid[i].size) ? vc_rle_read(BENCH_TMP_A) : NULL;
+        if (rle != NULL) {
+            printf("ERROR -> bench_rle_corrupt():\n\tAccepted invalid file %d\n", i);
+            vc_rle_free(rle);
+            ok = 0;
+        }
+    }
+
+    // Um intervalo 0 escrito com 5 bytes (sem bits acima de 2^32 no ltimo)  vlido
+    rle = bench_write_bytes(BENCH_TMP_A, "VCRLE 64 1\n\x01\x80\x80\x80\x80\x00\x01", 18) ? vc_rle_read(BENCH_TMP_A) : NULL;
+    ok = ok && (rle != NULL) && (rle->nspans == 1) && (rle->spans[0].xs == 0) && (rle->spans[0].xe == 1);
+    vc_rle_free(rle);
+    remove(BENCH_TMP_A);
+
+    return ok;
+}
+
+static BENCH_OP bench_ops[] = {
+    { "rgb_to_gray",            3, 1, 0, 0, vc_rgb_to_gray },
+    { "rgb_to_hsv",             3, 3, 0, 0, vc_rgb_to_hsv },
+    { "rgb_to_hsv_segmentation", 3, 1, 0, 0, bench_hsv_segmentation },
+    { "gray_to_color_palette",  1, 3, 0, 0, vc_scale_gray_to_color_palette },
+    { "gray_to_colormap_ironbow", 1, 3, 0, 0, bench_colormap_ironbow },
+    { "gray_to_binary",         1, 1, 0, 0, bench_gray_to_binary },
+    { "gray_to_binary_packed",  1, 1, 1, 0, bench_gray_to_binary },
+    { "gray_histogram",         1, 1, 0, 1024, bench_histogram },
+    { "mean_threshold",         1, 1, 0, 0, vc_gray_to_binary_mean_threshold },
+    { "otsu_threshold",         1, 1, 0, 0, vc_gray_to_binary_otsu_threshold },
+    { "percentile_threshold",   1, 1, 0, 0, bench_percentile_threshold },
+    { "midpoint_threshold",     1, 1, 0, 0, bench_midpoint_threshold },
+    { "midpoint_threshold_packed", 1, 1, 1, 0, bench_midpoint_threshold },
+    { "roi_midpoint_threshold", 1, 1, 0, 0, bench_roi_midpoint_threshold },
+    { "window_min",             1, 1, 0, 0, bench_window_min },
+    { "window_min_inplace",     1, 1, 0, 0, bench_window_min_inplace },
+    { "bradley_threshold",      1, 1, 0, 0, bench_bradley_threshold },
+    { "niblack_threshold",      1, 1, 0, 0, bench_niblack_threshold },
+    { "sauvola_threshold",      1, 1, 0, 0, bench_sauvola_threshold },
+    { "binary_pack",            1, 1, 1, 0, vc_binary_pack },
+    { "pipeline_gray_midpoint_invert", 3, 1, 0, 0, bench_pipeline },
+    { "box_filter_rgb",         3, 3, 0, 0, bench_box_filter_rgb },
+    { "gaussian_filter",        1, 1, 0, 0, bench_gaussian_filter },
+    { "pipeline_gray_gaussian_midpoint", 3, 1, 0, 0, bench_pipeline_gaussian },
+    { "sobel_l1",               1, 1, 0, 0, bench_sobel },
+    { "prewitt_l2_nms",         1, 2, 0, 0, bench_prewitt_nms },
+    { "threshold_blob_labelling", 1, 2, 0, 0, bench_blob_labelling },
+    { "threshold_binary_open_packed", 1, 1, 1, 0, bench_binary_open_packed },
+    { "threshold_rle_open_packed", 1, 1, 1, 0, bench_rle_open },
+    { "threshold_rle_blob_labelling", 1, 2, 0, 0, bench_rle_labelling },
+    { "gray_erode_rect",        1, 1, 0, 0, bench_gray_erode },
+    { "gray_dilate_cross",      1, 1, 0, 0, bench_gray_dilate_cross },
+    { "aio_roundtrip_threads",  1, 1, 0, 0, bench_aio_threads, 1 },
+    { "aio_roundtrip_auto",     3, 3, 0, 0, bench_aio_auto, 1 },
+    { "pbm_ascii_roundtrip",    1, 1, 0, 0, bench_pbm_ascii, 1 },
+    { "pgm_ascii_roundtrip",    1, 1, 0, 0, bench_pgm_ascii, 1 },
+    { "ppm_ascii_roundtrip",    3, 3, 0, 0, bench_ppm_ascii, 1 },
+    { "stream_midpoint_threshold", 1, 1, 0, 0, bench_stream_midpoint, 1 },
+    { "rle_file_roundtrip",     1, 1, 1, 0, bench_rle_file, 1 },
+    { "threshold_blob_features", 1, 1, 0, 8, bench_blob_features, 1 },
+    { "batch_pipeline",         1, 1, 0, 0, bench_batch, 1 },
+    { "pipeline_palette_inplace", 1, 3, 0, 0, bench_pipeline_palette_inplace, 1 },
+};
+
+#define BENCH_NUM_OPS ((int) (sizeof(bench_ops) / sizeof(bench_ops[0])))
+
+// Verificaes sem imagem de entrada (casos fixos)
+typedef struct {
+    char *name;
+    int (*run)(void);
+} BENCH_CHECK;
+
+static BENCH_CHECK bench_checks[] = {
+    { "netpbm_headers", bench_netpbm_headers },
+    { "rle_corrupt", bench_rle_corrupt },
+    { "image_map", bench_image_map },
+};
+
+#define BENCH_NUM_CHECKS ((int) (sizeof(bench_checks) / sizeof(bench_checks[0])))
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    TEMPO, ASSINATURAS E FICHEIROS DE RESULTADOS
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+static double bench_now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER t, f;
+    QueryPerformanceCounter(&t);
+    QueryPerformanceFrequency(&f);
+    return (double) t.QuadPart / (double) f.QuadPart;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double) t.tv_sec + (double) t.tv_nsec * 1e-9;
+#endif
+}
+
+// Ciclos do contador de tempo do CPU (0 se no existir)
+static unsigned long long bench_cycles(void) {
+#ifdef VC_SIMD_X86
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// FNV-1a de 64 bits sobre os bytes vlidos de cada linha (ignora o enchimento)
+static unsigned long long bench_hash(IVC *image) {
+    unsigned long long h = 1469598103934665603ULL;
+    int n = image->packed ? (image->width + 7) / 8 : image->width * image->channels;
+    int x, y;
+
+    for (y = 0; y < image->height; y++) {
+        unsigned char *data = image->data + y * image->bytesperline;
+        for (x = 0; x < n; x++) {
+            h ^= data[x];
+            h *= 1099511628211ULL;
+        }
+    }
+
+    return h;
+}
+
+static BENCH_RESULT *bench_find(BENCH_RESULT *results, int n, char *key) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (strcmp(results[i].key, key) == 0) return &results[i];
+    }
+
+    return NULL;
+}
+
+// Linhas "operador imagem valor" (o valor  ns/pixel ou uma assinatura em hexadecimal)
+static int bench_load(char *filename, BENCH_RESULT *results, int hex) {
+    FILE *file = fopen(filename, "r");
+    char op[64], image[64], value[64];
+    int n = 0;
+
+    if (file == NULL) return -1;
+
+    while ((n < BENCH_MAX_RESULTS) && (fscanf(file, "%63s %63s %63s", op, image, value) == 3)) {
+        snprintf(results[n].key, sizeof(results[n].key), "%s %s", op, image);
+        if (hex) results[n].hash = strtoull(value, NULL, 16);
+        else results[n].value = atof(value);
+        n++;
+    }
+    fclose(file);
+
+    return n;
+}
+
+static int bench_save(char *filename, BENCH_RESULT *results, int n, int hex) {
+    FILE *file = fopen(filename, "w");
+    int i;
+
+    if (file == NULL) {
+        printf("ERROR -> bench_save():\n\tCan't write %s\n", filename);
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (hex) fprintf(file, "%s %016llx\n", results[i].key, results[i].hash);
+        else fprintf(file, "%s %.4f\n", results[i].key, results[i].value);
+    }
+    fclose(file);
+
+    return 1;
+}
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    IMAGENS
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Padro determinstico com gradientes, textura e rudo (gerador congruencial)
+static void bench_synthetic(IVC *image, unsigned int seed) {
+    int x, y, c;
+
+    for (y = 0; y < image->height; y++) {
+        unsigned char *data = image->data + y * image->bytesperline;
+        for (x = 0; x < image->width; x++) {
+            for (c = 0; c < image->channels; c++) {
+                seed = seed * 1664525u + 1013904223u;
+                data[x * image->channels + c] = (unsigned char) ((x * (3 + c) + y * (5 - c) + ((x * y) >> 6) + (seed >> 27)) & 255);
+            }
+        }
+    }
+}
+
+static int bench_add_image(BENCH_IMAGE *images, int n, char *name, int bundled, IVC *gray) {
+    BENCH_IMAGE *image = &images[n];
+
+    if ((gray == NULL) || (n >= BENCH_MAX_IMAGES)) return n;
+
+    snprintf(image->name, sizeof(image->name), "%s", name);
+    image->bundled = bundled;
+    image->gray = gray;
+    image->rgb = vc_image_new(gray->width, gray->height, 3, 255);
+
+    // As imagens do repositrio so em cinzentos; a verso RGB sai da paleta
+    if (bundled) vc_scale_gray_to_color_palette(gray, image->rgb);
+    else bench_synthetic(image->rgb, (unsigned int) gray->width);
+
+    return n + 1;
+}
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    EXECUO
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+static IVC *bench_output(BENCH_OP *op, IVC *src) {
+    if (op->outwidth > 0) return vc_image_new(op->outwidth, 1, 1, 255);
+    if (op->outpacked) return vc_image_new_packed(src->width, src->height);
+    return vc_image_new(src->width, src->height, op->outchannels, 255);
+}
+
+// Executa o operador com um nvel de SIMD e um nmero de threads e devolve a assinatura da sada
+static int bench_signature(BENCH_OP *op, IVC *src, int simd, int threads, unsigned long long *hash) {
+    IVC *dst = bench_output(op, src);
+    int ok;
+
+    vc_set_simd_level(simd);
+    vc_set_num_threads(threads);
+
+    ok = (dst != NULL) && op->run(src, dst);
+    if (ok) *hash = bench_hash(dst);
+
+    vc_image_free(dst);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    static BENCH_IMAGE images[BENCH_MAX_IMAGES];
+    static BENCH_RESULT baseline[BENCH_MAX_RESULTS], golden[BENCH_MAX_RESULTS];
+    static BENCH_RESULT times[BENCH_MAX_RESULTS], hashes[BENCH_MAX_RESULTS];
+    static int sizes[][2] = { { 640, 480 }, { 1920, 1080 }, { 3840, 2160 }, { 7680, 4320 } };
+    static int threadcounts[] = { 1, 2, 3, 4 };
+    char *baselinefile = NULL, *savebaseline = NULL, *goldenfile = NULL, *updategolden = NULL;
+    char path[1024], name[64], key[128];
+    double mintime = 0.2, maxregression = 10.0;
+    int maxsize = 7680, threads = 0, checkonly = 0;
+    int nimages = 0, nbaseline = 0, ngolden = 0, ntimes = 0, nhashes = 0, failed = 0;
+    int maxsimd, i, j, s, t;
+
+    for (i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--images") == 0) && (i + 1 < argc)) bench_imagedir = argv[++i];
+        else if ((strcmp(argv[i], "--max-size") == 0) && (i + 1 < argc)) maxsize = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--min-time") == 0) && (i + 1 < argc)) mintime = atof(argv[++i]);
+        else if ((strcmp(argv[i], "--threads") == 0) && (i + 1 < argc)) threads = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--baseline") == 0) && (i + 1 < argc)) baselinefile = argv[++i];
+        else if ((strcmp(argv[i], "--max-regression") == 0) && (i + 1 < argc)) maxregression = atof(argv[++i]);
+        else if ((strcmp(argv[i], "--save-baseline") == 0) && (i + 1 < argc)) savebaseline = argv[++i];
+        else if ((strcmp(argv[i], "--golden") == 0) && (i + 1 < argc)) goldenfile = argv[++i];
+        else if ((strcmp(argv[i], "--update-golden") == 0) && (i + 1 < argc)) updategolden = argv[++i];
+        else if (strcmp(argv[i], "--check-only") == 0) checkonly = 1;
+        else {
+            printf("Uso: %s [--images DIR] [--max-size N] [--min-time S] [--threads N]\n"
+                   "       [--baseline FILE] [--max-regression P] [--save-baseline FILE]\n"
+                   "       [--golden FILE] [--update-golden FILE] [--check-only]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // Imagens do repositrio e imagens sintticas at maxsize
+    for (i = 0; i < BENCH_NUM_BUNDLED; i++) {
+        snprintf(path, sizeof(path), "%s/%s.pgm", bench_imagedir, bench_bundled[i]);
+        IVC *gray = vc_read_image(path);
+        if (gray == NULL) {
+            printf("ERROR -> vc_read_image():\n\tFile not found: %s\n", path);
+            return 1;
+        }
+        nimages = bench_add_image(images, nimages, bench_bundled[i], 1, gray);
+    }
+    for (i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++) {
+        if (sizes[i][0] > maxsize) break;
+        IVC *gray = vc_image_new(sizes[i][0], sizes[i][1], 1, 255);
+        if (gray == NULL) break;
+        bench_synthetic(gray, (unsigned int) i);
+        snprintf(name, sizeof(name), "%dx%d", sizes[i][0], sizes[i][1]);
+        nimages = bench_add_image(images, nimages, name, 0, gray);
+    }
+
+    if (goldenfile != NULL) {
+        ngolden = bench_load(goldenfile, golden, 1);
+        if (ngolden < 0) printf("Sem assinaturas em %s\n", goldenfile);
+    }
+    if (baselinefile != NULL) {
+        nbaseline = bench_load(baselinefile, baseline, 0);
+        if (nbaseline < 0) printf("Sem tempos de referncia em %s\n", baselinefile);
+    }
+
+    // Verificao: a sada escalar com uma thread  a referncia; todos os kernels SIMD
+    // e todas as divises em bandas tm de dar exatamente o mesmo resultado
+    maxsimd = vc_set_simd_level(VC_SIMD_AVX2);
+    printf("SIMD: nvel %d; threads: %d\n\n", maxsimd, vc_get_num_threads());
+
+    for (i = 0; i < BENCH_NUM_OPS; i++) {
+        BENCH_OP *op = &bench_ops[i];
+
+        for (j = 0; j < nimages; j++) {
+            IVC *src = (op->inchannels == 3) ? images[j].rgb : images[j].gray;
+            unsigned long long ref, hash;
+            BENCH_RESULT *g;
+
+            if (!images[j].bundled && (src->width > BENCH_CHECK_MAX_WIDTH)) continue;
+
+            snprintf(key, sizeof(key), "%.63s %.63s", op->name, images[j].name);
+            if (!bench_signature(op, src, VC_SIMD_NONE, 1, &ref)) {
+                printf("FALHOU    %s\n", key);
+                failed = 1;
+                continue;
+            }
+            for (s = VC_SIMD_NONE; s <= maxsimd; s++) {
+                for (t = 0; t < (int) (sizeof(threadcounts) / sizeof(threadcounts[0])); t++) {
+                    // As verificaes de E/S s se repetem com o SIMD e as threads no mximo
+                    if (op->untimed && ((s < maxsimd) || (t + 1 < (int) (sizeof(threadcounts) / sizeof(threadcounts[0]))))) continue;
+                    if (!bench_signature(op, src, s, threadcounts[t], &hash) || (hash != ref)) {
+                        printf("DIFERENTE %s (SIMD %d, %d threads)\n", key, s, threadcounts[t]);
+                        failed = 1;
+                    }
+                }
+            }
+
+            if (nhashes < BENCH_MAX_RESULTS) {
+                snprintf(hashes[nhashes].key, sizeof(hashes[nhashes].key), "%s", key);
+                hashes[nhashes++].hash = ref;
+            }
+            if ((ngolden > 0) && ((g = bench_find(golden, ngolden, key)) != NULL) && (g->hash != ref)) {
+                printf("DIFERENTE %s (assinatura %016llx, esperada %016llx)\n", key, ref, g->hash);
+                failed = 1;
+            }
+        }
+    }
+    for (i = 0; i < BENCH_NUM_CHECKS; i++) {
+        if (!bench_checks[i].run()) {
+            printf("FALHOU    %s\n", bench_checks[i].name);
+            failed = 1;
+        }
+    }
+    printf("Verificao bit a bit: %s\n\n", failed ? "FALHOU" : "OK");
+
+    if (updategolden != NULL) bench_save(updategolden, hashes, nhashes, 1);
+
+    if (!checkonly) {
+        vc_set_simd_level(maxsimd);
+        vc_set_num_threads(threads);
+
+        printf("%-32s %-10s %10s %10s %10s\n", "operador", "imagem", "MP/s", "ns/pixel", "ciclos/px");
+        for (i = 0; i < BENCH_NUM_OPS; i++) {
+            BENCH_OP *op = &bench_ops[i];
+
+            if (op->untimed) continue;
+            for (j = 0; j < nimages; j++) {
+                IVC *src = (op->inchannels == 3) ? images[j].rgb : images[j].gray;
+                IVC *dst = bench_output(op, src);
+                double pixels = (double) src->width * src->height;
+                double best = 1e30, start, elapsed, total = 0;
+                unsigned long long bestcycles = 0, c0;
+                int reps = 0;
+                BENCH_RESULT *b;
+
+                if ((dst == NULL) || !op->run(src, dst)) {
+                    printf("%-32s %-10s FALHOU\n", op->name, images[j].name);
+                    vc_image_free(dst);
+                    failed = 1;
+                    continue;
+                }
+
+                // Melhor tempo de pelo menos 3 execues (e de mintime segundos)
+                while ((reps < 3) || (total < mintime)) {
+                    c0 = bench_cycles();
+                    start = bench_now();
+                    op->run(src, dst);
+                    elapsed = bench_now() - start;
+                    if (elapsed < best) {
+                        best = elapsed;
+                        bestcycles = bench_cycles() - c0;
+                    }
+                    total += elapsed;
+                    reps++;
+                }
+                vc_image_free(dst);
+
+                printf("%-32s %-10s %10.1f %10.3f %10.2f", op->name, images[j].name,
+                       pixels / best * 1e-6, best * 1e9 / pixels, (double) bestcycles / pixels);
+
+                snprintf(key, sizeof(key), "%.63s %.63s", op->name, images[j].name);
+                if ((nbaseline > 0) && ((b = bench_find(baseline, nbaseline, key)) != NULL)) {
+                    double change = (best * 1e9 / pixels - b->value) / b->value * 100.0;
+                    printf(" %+7.1f%%", change);
+                    if (change > maxregression) {
+                        printf(" REGRESSO");
+                        failed = 1;
+                    }
+                }
+                printf("\n");
+
+                if (ntimes < BENCH_MAX_RESULTS) {
+                    snprintf(times[ntimes].key, sizeof(times[ntimes].key), "%s", key);
+                    times[ntimes++].value = best * 1e9 / pixels;
+                }
+            }
+        }
+
+        if (savebaseline != NULL) bench_save(savebaseline, times, ntimes, 0);
+    }
+
+    for (j = 0; j < nimages; j++) {
+        vc_image_free(images[j].gray);
+        vc_image_free(images[j].rgb);
+    }
+
+    return failed;
+}
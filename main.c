@@ -1,33 +1,69 @@
 #include <stdio.h>
 #include "vc.c"
 
-int main(void){
+// Uso: main [entrada.pgm] [saida.pgm] [kernel]
+//      main --batch <pasta|padro> <pasta de sada> [kernel] [workers]
+int main(int argc, char *argv[]){
     IVC *src;
     IVC *dst;
-    int i;
+    VC_PIPELINE *pipeline;
+    int written;
+    char *input = (argc > 1) ? argv[1] : "cells.pgm";
+    char *output = (argc > 2) ? argv[2] : "cells_midpoint.pgm";
+    int kernel = (argc > 3) ? atoi(argv[3]) : 25;
 
-    src = vc_read_image("C:/Users/marcocarvalho/Desktop/aula4/cells.pgm");
+    // Sequncia de imagens: o mesmo pipeline aplicado a todas
+    if ((argc > 3) && (strcmp(argv[1], "--batch") == 0)) {
+        pipeline = vc_pipeline_new();
+        vc_pipeline_add_midpoint_threshold(pipeline, (argc > 4) ? atoi(argv[4]) : 25);
+        vc_pipeline_add_invert(pipeline);
+        written = vc_batch_process(argv[2], argv[3], pipeline, (argc > 5) ? atoi(argv[5]) : 0);
+        pipeline = vc_pipeline_free(pipeline);
+        if (written < 0) {
+            printf("ERROR -> vc_batch_process():\n\tCan't process %s\n", argv[2]);
+            return 1;
+        }
+        printf("Lote: %d imagens escritas em %s\n", written, argv[3]);
+#ifdef VC_PROFILE
+        vc_profile_print_summary();
+        vc_profile_write_trace("vc_trace.json");
+#endif
+        return 0;
+    }
+
+    src = vc_read_image(input);
 
     if (src == NULL)
     {
-        printf("ERROR -> vc_read_image():\n\tFile not found!\n");
-        getchar();
-        return 0;
+        printf("ERROR -> vc_read_image():\n\tFile not found: %s\n", input);
+        return 1;
     }
     dst = vc_image_new(src->width,src->height,1,src->levels);
 //    vc_gray_to_binary(src,dst, 130);
 //    vc_gray_to_binary_mean_threshold(src, dst);
-    int kernel = 25;
-    vc_gray_midpoint_threshold(src, dst, kernel);
-    for (i = 0; i<dst->bytesperline*dst->height; i+=dst->channels) {
-        dst->data[i] = 255 - dst->data[i];
+    // Threshold pelo ponto mdio seguido da inverso, numa nica passagem
+    pipeline = vc_pipeline_new();
+    vc_pipeline_add_midpoint_threshold(pipeline, kernel);
+    vc_pipeline_add_invert(pipeline);
+    if (!vc_pipeline_run(pipeline, src, dst))
+    {
+        printf("ERROR -> vc_pipeline_run():\n\tCan't process %s\n", input);
+        vc_pipeline_free(pipeline);
+        vc_image_free(src);
+        vc_image_free(dst);
+        return 1;
     }
-    vc_write_image("flir01_conversion.pgm",dst);
+    printf("Pipeline: %d kernels, %d passagens e %lld bytes poupados\n", pipeline->kernels, pipeline->passes_saved, pipeline->bytes_saved);
+    pipeline = vc_pipeline_free(pipeline);
+    vc_write_image(output,dst);
     vc_image_free(src);
     vc_image_free(dst);
 
-    printf("Press any key to exit....\n");
-    getchar();
+#ifdef VC_PROFILE
+    // Tempos por operador e por thread (abrir vc_trace.json em chrome://tracing ou no Perfetto)
+    vc_profile_print_summary();
+    vc_profile_write_trace("vc_trace.json");
+#endif
 
     return 0;
 }
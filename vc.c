@@ -14,617 +14,7072 @@
 #include <ctype.h>
 #include <string.h>
 #include <malloc.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <glob.h>
+#include <sys/uio.h>
+#endif
+// io_uring pelas chamadas ao sistema (no  preciso a liburing)
+#if defined(__linux__) && defined(__GNUC__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define VC_HAVE_IO_URING
+#endif
+#endif
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define VC_SIMD_X86
+#include <immintrin.h>
+#endif
 #include "vc.h"
 
 
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    FUNES: INSTRUMENTAO DOS OPERADORES
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// O fim de cada chamada  registado com __attribute__((cleanup)), que s existe no GCC/Clang
+#if defined(VC_PROFILE) && !defined(__GNUC__)
+#undef VC_PROFILE
+#endif
+
+#ifdef VC_PROFILE
+
+#define VC_PROFILE_MAX_EVENTS (1 << 16)     // Eventos guardados (os seguintes so contados e descartados)
+#define VC_PROFILE_MAX_NAMES 128            // Operadores distintos no resumo
+
+typedef struct {
+    const char *name;
+    int thread;                 // Thread, pela ordem do primeiro evento registado (0, 1, ...)
+    int band;                   // 1 = banda de vc_parallel_rows, 0 = chamada de um operador
+    long long start, duration;  // ns
+    long long pixels, bytes;
+} VC_PROFILE_EVENT;
+
+typedef struct {
+    const char *name;
+    const char *outer;          // Operador que estava a correr nesta thread (chamadas encaixadas)
+    long long start;
+    IVC *src, *dst;             // Imagens de onde saem os pixels e os bytes da chamada
+} VC_PROFILE_SCOPE;
+
+static VC_PROFILE_EVENT vc_profile_events[VC_PROFILE_MAX_EVENTS];
+static int vc_profile_count = 0;
+static int vc_profile_dropped = 0;
+static int vc_profile_threads = 0;
+static VC_THREAD_LOCAL int vc_profile_thread = -1;
+static VC_THREAD_LOCAL const char *vc_profile_op = NULL;   // Operador atual (d o nome s bandas)
+
+// Colocar no incio de uma funo vc_*, depois das declaraes: regista a chamada quando a funo retorna
+#define VC_PROFILE_OP(src, dst) VC_PROFILE_SCOPE vc_profile_scope __attribute__((cleanup(vc_profile_end))) = vc_profile_begin(__func__, (src), (dst))
+// Imagens conhecidas s mais tarde (ex.: a imagem lida por vc_read_image)
+#define VC_PROFILE_IMAGES(a, b) (vc_profile_scope.src = (a), vc_profile_scope.dst = (b))
+
+
+static long long vc_profile_now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER t, f;
+    QueryPerformanceCounter(&t);
+    QueryPerformanceFrequency(&f);
+    return (long long) ((double) t.QuadPart * 1e9 / (double) f.QuadPart);
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * 1000000000LL + t.tv_nsec;
+#endif
+}
+
+static long long vc_profile_image_bytes(IVC *image) {
+    if (image == NULL) return 0;
+    return (long long) image->height * (image->packed ? (image->width + 7) / 8 : image->width * image->channels);
+}
+
+static void vc_profile_record(const char *name, int band, long long start, long long pixels, long long bytes) {
+    VC_PROFILE_EVENT *event;
+    long long end = vc_profile_now();
+    int i;
+
+    if (vc_profile_thread < 0) vc_profile_thread = __atomic_fetch_add(&vc_profile_threads, 1, __ATOMIC_RELAXED);
+
+    i = __atomic_fetch_add(&vc_profile_count, 1, __ATOMIC_RELAXED);
+    if (i >= VC_PROFILE_MAX_EVENTS) {
+        __atomic_fetch_add(&vc_profile_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    event = &vc_profile_events[i];
+    event->name = name;
+    event->thread = vc_profile_thread;
+    event->band = band;
+    event->start = start;
+    event->duration = end - start;
+    event->pixels = pixels;
+    event->bytes = bytes;
+}
+
+static VC_PROFILE_SCOPE vc_profile_begin(const char *name, IVC *src, IVC *dst) {
+    VC_PROFILE_SCOPE scope;
+
+    scope.name = name;
+    scope.outer = vc_profile_op;
+    scope.src = src;
+    scope.dst = dst;
+    vc_profile_op = name;
+    scope.start = vc_profile_now();
+
+    return scope;
+}
+
+static void vc_profile_end(VC_PROFILE_SCOPE *scope) {
+    IVC *image = (scope->src != NULL) ? scope->src : scope->dst;
+    long long pixels = (image != NULL) ? (long long) image->width * image->height : 0;
+
+    vc_profile_record(scope->name, 0, scope->start, pixels, vc_profile_image_bytes(scope->src) + vc_profile_image_bytes(scope->dst));
+    vc_profile_op = scope->outer;
+}
+
+// Banda de vc_parallel_rows: pixels e bytes das linhas da imagem despachada
+static void vc_profile_band(const char *name, IVC *image, VC_BAND *band, long long start) {
+    int rows = band->y1 - band->y0;
+
+    vc_profile_record((name != NULL) ? name : "vc_parallel_rows", 1, start, (long long) rows * image->width, vc_profile_image_bytes(image) / image->height * rows);
+}
+
+
+// Tile de vc_parallel_tiles
+static void vc_profile_tile(const char *name, IVC *image, VC_TILE *tile, long long start) {
+    long long pixels = (long long) (tile->x1 - tile->x0) * (tile->y1 - tile->y0);
+
+    vc_profile_record((name != NULL) ? name : "vc_parallel_tiles", 1, start, pixels, vc_profile_image_bytes(image) / ((long long) image->width * image->height) * pixels);
+}
+
+
+// Apaga os eventos registados
+void vc_profile_reset(void) {
+    vc_profile_count = 0;
+    vc_profile_dropped = 0;
+}
+
+// Escreve os eventos no formato de trace do Chrome (chrome://tracing, Perfetto): uma linha por thread,
+// com as chamadas dos operadores e, dentro delas, as bandas executadas por cada thread
+int vc_profile_write_trace(char *filename) {
+    FILE *file;
+    VC_PROFILE_EVENT *e;
+    long long t0;
+    int i, n = (vc_profile_count < VC_PROFILE_MAX_EVENTS) ? vc_profile_count : VC_PROFILE_MAX_EVENTS;
+
+    if ((file = fopen(filename, "w")) == NULL) return 0;
+
+    t0 = (n > 0) ? vc_profile_events[0].start : 0;
+    for (i = 1; i < n; i++) if (vc_profile_events[i].start < t0) t0 = vc_profile_events[i].start;
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (i = 0; i < n; i++) {
+        e = &vc_profile_events[i];
+        fprintf(file, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d,"
+                      "\"args\":{\"pixels\":%lld,\"bytes\":%lld}}%s\n",
+                e->name, e->band ? "band" : "op", (e->start - t0) / 1000.0, e->duration / 1000.0, e->thread,
+                e->pixels, e->bytes, (i + 1 < n) ? "," : "");
+    }
+    fprintf(file, "],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%d}}\n", vc_profile_dropped);
+
+    return (fclose(file) == 0);
+}
+
+// Resumo por operador (tempo inclusivo: um operador que chama outros conta tambm o tempo deles)
+// e por thread (tempo ocupado em bandas)
+void vc_profile_print_summary(void) {
+    const char *names[VC_PROFILE_MAX_NAMES];
+    long long calls[VC_PROFILE_MAX_NAMES], time[VC_PROFILE_MAX_NAMES], pixels[VC_PROFILE_MAX_NAMES], bytes[VC_PROFILE_MAX_NAMES];
+    long long bands[VC_MAX_THREADS], busy[VC_MAX_THREADS];
+    VC_PROFILE_EVENT *e;
+    int i, j, nnames = 0, n = (vc_profile_count < VC_PROFILE_MAX_EVENTS) ? vc_profile_count : VC_PROFILE_MAX_EVENTS;
+
+    memset(bands, 0, sizeof(bands));
+    memset(busy, 0, sizeof(busy));
+
+    for (i = 0; i < n; i++) {
+        e = &vc_profile_events[i];
+        if (e->band) {
+            if (e->thread < VC_MAX_THREADS) {
+                bands[e->thread]++;
+                busy[e->thread] += e->duration;
+            }
+            continue;
+        }
+        for (j = 0; (j < nnames) && (strcmp(names[j], e->name) != 0); j++);
+        if (j == nnames) {
+            if (nnames == VC_PROFILE_MAX_NAMES) continue;
+            names[nnames] = e->name;
+            calls[nnames] = time[nnames] = pixels[nnames] = bytes[nnames] = 0;
+            nnames++;
+        }
+        calls[j]++;
+        time[j] += e->duration;
+        pixels[j] += e->pixels;
+        bytes[j] += e->bytes;
+    }
+
+    printf("%-40s %8s %12s %12s %10s %10s\n", "operador", "chamadas", "total (ms)", "media (us)", "MP/s", "MB/s");
+    for (j = 0; j < nnames; j++) {
+        printf("%-40s %8lld %12.3f %12.3f %10.1f %10.1f\n", names[j], calls[j], time[j] / 1e6, time[j] / 1e3 / calls[j],
+               (time[j] > 0) ? pixels[j] * 1e3 / time[j] : 0.0, (time[j] > 0) ? bytes[j] * 1e3 / time[j] : 0.0);
+    }
+
+    printf("\n%-8s %8s %12s\n", "thread", "bandas", "ocupada (ms)");
+    for (i = 0; (i < vc_profile_threads) && (i < VC_MAX_THREADS); i++) {
+        if (bands[i] > 0) printf("%-8d %8lld %12.3f\n", i, bands[i], busy[i] / 1e6);
+    }
+    if (vc_profile_dropped > 0) printf("\n%d eventos descartados (mais de %d)\n", vc_profile_dropped, VC_PROFILE_MAX_EVENTS);
+}
+
+#else
+
+// Sem VC_PROFILE a instrumentao desaparece: as macros ficam vazias e no h eventos
+#define VC_PROFILE_OP(src, dst)
+#define VC_PROFILE_IMAGES(src, dst)
+
+void vc_profile_reset(void) {
+}
+
+int vc_profile_write_trace(char *filename) {
+    FILE *file;
+
+    if ((file = fopen(filename, "w")) == NULL) return 0;
+    fprintf(file, "{\"traceEvents\":[]}\n");
+
+    return (fclose(file) == 0);
+}
+
+void vc_profile_print_summary(void) {
+    printf("Instrumentao desativada (compilar com -DVC_PROFILE)\n");
+}
+
+#endif
+
+
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //            FUNES: ALOCAR E LIBERTAR UMA IMAGEM
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 
 
-// Alocar memria para uma imagem
-IVC *vc_image_new(int width, int height, int channels, int levels)
-{
-	IVC *image = (IVC *) malloc(sizeof(IVC));
+// Os buffers das imagens so alinhados a VC_ALIGN bytes e cada linha  arredondada a um mltiplo
+// de VC_ALIGN (bytesperline >= width * channels), para permitir leituras SIMD alinhadas.
+// Ao libertar uma imagem o buffer fica guardado numa pool, por classes de tamanho,
+// e  reutilizado pelo prximo vc_image_new() de tamanho compatvel (ex.: um por frame).
+#define VC_POOL_MIN_SIZE 4096						// Tamanho da classe mais pequena
+#define VC_POOL_BUCKETS 128							// 4 classes por potncia de 2 (at 2^44 bytes)
+#define VC_POOL_PER_BUCKET 8						// Buffers guardados por classe
+#define VC_POOL_MAX_BYTES (256 * 1024 * 1024)		// Total de bytes guardados na pool
+
+typedef struct {
+	void *raw;			// Ponteiro devolvido pelo malloc()
+	int bucket;			// Classe de tamanho (-1 = no vai para a pool)
+} VC_BUFFER_HEADER;
+
+static void *vc_buffer_pool[VC_POOL_BUCKETS][VC_POOL_PER_BUCKET];
+static int vc_buffer_pool_count[VC_POOL_BUCKETS];
+static size_t vc_buffer_pool_bytes = 0;
+static long vc_buffer_pool_hits = 0, vc_buffer_pool_misses = 0;
+static pthread_mutex_t vc_buffer_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+// Classe de tamanho de um buffer: tamanhos 2^k * (1, 1.25, 1.5, 1.75), a partir de VC_POOL_MIN_SIZE
+static int vc_buffer_bucket(size_t size, size_t *classsize)
+{
+	size_t base = VC_POOL_MIN_SIZE;
+	int bucket = 0, i;
+
+	for(;;)
+	{
+		for(i=0; i<4; i++, bucket++)
+		{
+			if(bucket >= VC_POOL_BUCKETS) return -1;
+			*classsize = base + i * (base / 4);
+			if(*classsize >= size) return bucket;
+		}
+		base *= 2;
+	}
+}
+
+
+static size_t vc_buffer_bucket_size(int bucket)
+{
+	size_t base = (size_t) VC_POOL_MIN_SIZE << (bucket / 4);
+
+	return base + (bucket % 4) * (base / 4);
+}
+
+
+// Aloca um buffer alinhado a VC_ALIGN bytes (reutiliza um buffer da pool, se houver)
+static unsigned char *vc_buffer_alloc(size_t size)
+{
+	VC_BUFFER_HEADER *header;
+	unsigned char *raw, *data;
+	size_t classsize = size;
+	int bucket = vc_buffer_bucket(size, &classsize);
+
+	if(bucket < 0) classsize = size;
+
+	if(bucket >= 0)
+	{
+		pthread_mutex_lock(&vc_buffer_pool_mutex);
+		if(vc_buffer_pool_count[bucket] > 0)
+		{
+			data = (unsigned char *) vc_buffer_pool[bucket][--vc_buffer_pool_count[bucket]];
+			vc_buffer_pool_bytes -= classsize;
+			vc_buffer_pool_hits++;
+			pthread_mutex_unlock(&vc_buffer_pool_mutex);
+			return data;
+		}
+		vc_buffer_pool_misses++;
+		pthread_mutex_unlock(&vc_buffer_pool_mutex);
+	}
+
+	raw = (unsigned char *) malloc(classsize + VC_ALIGN + sizeof(VC_BUFFER_HEADER));
+	if(raw == NULL) return NULL;
+
+	data = (unsigned char *) (((size_t) (raw + sizeof(VC_BUFFER_HEADER)) + VC_ALIGN - 1) & ~((size_t) VC_ALIGN - 1));
+	header = (VC_BUFFER_HEADER *) data - 1;
+	header->raw = raw;
+	header->bucket = bucket;
+
+	return data;
+}
+
+
+// Devolve um buffer de vc_buffer_alloc()  pool (ou liberta-o, se a pool estiver cheia)
+static void vc_buffer_free(unsigned char *data)
+{
+	VC_BUFFER_HEADER *header;
+	size_t classsize = 0;
+
+	if(data == NULL) return;
+
+	header = (VC_BUFFER_HEADER *) data - 1;
+
+	if(header->bucket >= 0)
+	{
+		classsize = vc_buffer_bucket_size(header->bucket);
+
+		pthread_mutex_lock(&vc_buffer_pool_mutex);
+		if((vc_buffer_pool_count[header->bucket] < VC_POOL_PER_BUCKET) && (vc_buffer_pool_bytes + classsize <= VC_POOL_MAX_BYTES))
+		{
+			vc_buffer_pool[header->bucket][vc_buffer_pool_count[header->bucket]++] = data;
+			vc_buffer_pool_bytes += classsize;
+			pthread_mutex_unlock(&vc_buffer_pool_mutex);
+			return;
+		}
+		pthread_mutex_unlock(&vc_buffer_pool_mutex);
+	}
+
+	free(header->raw);
+}
+
+
+// Liberta todos os buffers guardados na pool
+void vc_image_pool_release(void)
+{
+	VC_BUFFER_HEADER *header;
+	int b;
+
+	pthread_mutex_lock(&vc_buffer_pool_mutex);
+	for(b=0; b<VC_POOL_BUCKETS; b++)
+	{
+		while(vc_buffer_pool_count[b] > 0)
+		{
+			header = (VC_BUFFER_HEADER *) vc_buffer_pool[b][--vc_buffer_pool_count[b]] - 1;
+			free(header->raw);
+		}
+	}
+	vc_buffer_pool_bytes = 0;
+	pthread_mutex_unlock(&vc_buffer_pool_mutex);
+}
+
+
+// Nmero de alocaes servidas pela pool (hits) e pelo malloc() (misses)
+void vc_image_pool_stats(long *hits, long *misses)
+{
+	pthread_mutex_lock(&vc_buffer_pool_mutex);
+	if(hits != NULL) *hits = vc_buffer_pool_hits;
+	if(misses != NULL) *misses = vc_buffer_pool_misses;
+	pthread_mutex_unlock(&vc_buffer_pool_mutex);
+}
+
+
+// Alocar memria para uma imagem
+IVC *vc_image_new(int width, int height, int channels, int levels)
+{
+	IVC *image;
+
+	if((levels <= 0) || (levels > 255)) return NULL;
+
+	image = (IVC *) malloc(sizeof(IVC));
+	if(image == NULL) return NULL;
+
+	image->width = width;
+	image->height = height;
+	image->channels = channels;
+	image->levels = levels;
+	image->bytesperline = VC_ALIGN_UP(image->width * image->channels);
+	image->packed = 0;
+	image->ownership = VC_OWN_POOL;
+	image->mapbase = NULL;
+	image->mapsize = 0;
+	image->data = vc_buffer_alloc((size_t) image->bytesperline * image->height);
+
+	if(image->data == NULL)
+	{
+		return vc_image_free(image);
+	}
+
+	return image;
+}
+
+
+// Alocar memria para uma imagem binria com 1 bit por pixel (formato PBM: 1 = Preto, 0 = Branco)
+IVC *vc_image_new_packed(int width, int height)
+{
+	IVC *image = (IVC *) malloc(sizeof(IVC));
+
+	if(image == NULL) return NULL;
+
+	image->width = width;
+	image->height = height;
+	image->channels = 1;
+	image->levels = 1;
+	image->bytesperline = VC_ALIGN_UP((width + 7) / 8);
+	image->packed = 1;
+	image->ownership = VC_OWN_POOL;
+	image->mapbase = NULL;
+	image->mapsize = 0;
+	image->data = vc_buffer_alloc((size_t) image->bytesperline * height);
+
+	if(image->data == NULL)
+	{
+		return vc_image_free(image);
+	}
+
+	// Os bits de enchimento de cada linha ficam a 0
+	memset(image->data, 0, (size_t) image->bytesperline * height);
+
+	return image;
+}
+
+
+// Criar uma vista sobre o retngulo [x, x + width) x [y, y + height) de outra imagem, sem copiar:
+// a vista partilha o buffer (e o bytesperline) de parent, que tem de existir enquanto a vista for usada.
+// Numa imagem empacotada o retngulo comea num byte (x mltiplo de 8) e acaba num byte ou na
+// margem direita, para que a escrita do ltimo byte de cada linha no altere pixels fora da vista.
+IVC *vc_image_view(IVC *parent, int x, int y, int width, int height)
+{
+	IVC *image;
+
+	if((parent == NULL) || (parent->data == NULL)) return NULL;
+	if((x < 0) || (y < 0) || (width <= 0) || (height <= 0)) return NULL;
+	if((x + width > parent->width) || (y + height > parent->height)) return NULL;
+	if(parent->packed && ((x % 8) || ((width % 8) && (x + width != parent->width)))) return NULL;
+
+	image = (IVC *) malloc(sizeof(IVC));
+	if(image == NULL) return NULL;
+
+	*image = *parent;
+	image->width = width;
+	image->height = height;
+	image->data = parent->data + (size_t) y * parent->bytesperline + (parent->packed ? x / 8 : x * parent->channels);
+	image->ownership = VC_OWN_VIEW;
+	image->mapbase = NULL;
+	image->mapsize = 0;
+
+	return image;
+}
+
+
+// Indica se duas imagens (ou vistas) partilham memria
+static int vc_image_overlaps(IVC *a, IVC *b)
+{
+	unsigned char *enda, *endb;
+
+	if((a->data == NULL) || (b->data == NULL)) return 0;
+
+	enda = a->data + (size_t) (a->height - 1) * a->bytesperline + (a->packed ? (a->width + 7) / 8 : a->width * a->channels);
+	endb = b->data + (size_t) (b->height - 1) * b->bytesperline + (b->packed ? (b->width + 7) / 8 : b->width * b->channels);
+
+	return (a->data < endb) && (b->data < enda);
+}
+
+
+// Cpia de uma imagem (ou vista) para uma imagem nova, com as linhas alinhadas
+static IVC *vc_image_copy(IVC *src)
+{
+	IVC *copy = src->packed ? vc_image_new_packed(src->width, src->height) : vc_image_new(src->width, src->height, src->channels, src->levels);
+	int y;
+
+	if(copy == NULL) return NULL;
+
+	for(y=0; y<src->height; y++)
+	{
+		memcpy(copy->data + y * copy->bytesperline, src->data + y * src->bytesperline, src->packed ? (src->width + 7) / 8 : src->width * src->channels);
+	}
+
+	return copy;
+}
+
+
+// Libertar memria de uma imagem
+IVC *vc_image_free(IVC *image)
+{
+	if(image != NULL)
+	{
+		if(image->ownership == VC_OWN_MAP)
+		{
+			// Imagem mapeada com vc_image_map(): data aponta para dentro do mapeamento
+			#ifdef _WIN32
+			UnmapViewOfFile(image->mapbase);
+			#else
+			munmap(image->mapbase, image->mapsize);
+			#endif
+			image->mapbase = NULL;
+			image->data = NULL;
+		}
+		else if(image->ownership == VC_OWN_POOL)
+		{
+			vc_buffer_free(image->data);
+			image->data = NULL;
+		}
+		else if(image->ownership == VC_OWN_VIEW)
+		{
+			// Vista: o buffer pertence  imagem de origem
+			image->data = NULL;
+		}
+		else if(image->data != NULL)
+		{
+			free(image->data);
+			image->data = NULL;
+		}
+
+		free(image);
+		image = NULL;
+	}
+
+	return image;
+}
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    FUNES: LEITURA E ESCRITA DE IMAGENS (PBM, PGM E PPM)
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+
+// Leitor com buffer para ficheiros netpbm: o header e os pixels em ASCII so lidos diretamente
+// do buffer (sem getc/sscanf por carcter); os pixels binrios vo, sempre que possvel,
+// diretamente do ficheiro para as linhas da imagem.
+#define VC_READER_SIZE (64 * 1024)
+
+typedef struct
+{
+	FILE *file;
+	unsigned char *buf;
+	size_t pos, len;
+} VC_READER;
+
+#define VC_IS_SPACE(c) (((c) == ' ') || (((c) >= '\t') && ((c) <= '\r')))
+
+
+static int vc_reader_open(VC_READER *reader, char *filename)
+{
+	reader->pos = reader->len = 0;
+	reader->buf = NULL;
+	if((reader->file = fopen(filename, "rb")) == NULL) return 0;
+	if((reader->buf = vc_buffer_alloc(VC_READER_SIZE)) == NULL) return 0;
+
+	return 1;
+}
+
+
+static void vc_reader_close(VC_READER *reader)
+{
+	if(reader->file != NULL) fclose(reader->file);
+	vc_buffer_free(reader->buf);
+	reader->file = NULL;
+	reader->buf = NULL;
+}
+
+
+// L a partir de um ficheiro que j est todo em memria (sem FILE)
+static void vc_reader_memory(VC_READER *reader, unsigned char *buf, size_t size)
+{
+	reader->file = NULL;
+	reader->buf = buf;
+	reader->pos = 0;
+	reader->len = size;
+}
+
+
+// Devolve o prximo carcter (EOF no fim do ficheiro)
+static int vc_reader_getc(VC_READER *reader)
+{
+	if(reader->pos >= reader->len)
+	{
+		if(reader->file == NULL) return EOF;
+		reader->len = fread(reader->buf, 1, VC_READER_SIZE, reader->file);
+		reader->pos = 0;
+		if(reader->len == 0) return EOF;
+	}
+
+	return reader->buf[reader->pos++];
+}
+
+
+// L size bytes: primeiro o que resta no buffer, depois diretamente do ficheiro
+static int vc_reader_read(VC_READER *reader, unsigned char *dst, size_t size)
+{
+	size_t n = reader->len - reader->pos;
+
+	if(n > size) n = size;
+	memcpy(dst, reader->buf + reader->pos, n);
+	reader->pos += n;
+	size -= n;
+
+	if(size == 0) return 1;
+	if(reader->file == NULL) return 0;
+	if(size >= VC_READER_SIZE) return fread(dst + n, 1, size, reader->file) == size;
+
+	reader->len = fread(reader->buf, 1, VC_READER_SIZE, reader->file);
+	reader->pos = size;
+	if(reader->len < size) return 0;
+	memcpy(dst + n, reader->buf, size);
+
+	return 1;
+}
+
+
+// Salta espaos e comentrios (# at ao fim da linha); devolve o primeiro carcter seguinte
+static int vc_reader_skip(VC_READER *reader)
+{
+	int c;
+
+	for(;;)
+	{
+		do c = vc_reader_getc(reader);
+		while(VC_IS_SPACE(c));
+		if(c != '#') return c;
+		do c = vc_reader_getc(reader);
+		while((c != '\n') && (c != EOF));
+	}
+}
+
+
+// L um inteiro no negativo (campo do header ou pixel em ASCII) para *value.
+// Consome o espao que termina o nmero (um '#' fica para o prximo campo).
+static int vc_reader_int(VC_READER *reader, int *value)
+{
+	int c = vc_reader_skip(reader);
+	int v = 0;
+
+	if((c < '0') || (c > '9')) return 0;
+
+	do
+	{
+		if(v > (0x7FFFFFFF - 9) / 10) return 0;
+		v = v * 10 + (c - '0');
+		c = vc_reader_getc(reader);
+	} while((c >= '0') && (c <= '9'));
+
+	if(c == '#') reader->pos--;
+	else if((c != EOF) && !VC_IS_SPACE(c)) return 0;
+
+	*value = v;
+
+	return 1;
+}
+
+
+// L o header de um ficheiro netpbm (P1 a P6). *format fica com o nmero do formato.
+// Os PBM (P1 e P4) no tm o campo do valor mximo: levels = 1.
+static int vc_reader_header(VC_READER *reader, int *format, int *width, int *height, int *channels, int *levels)
+{
+	int c;
+
+	if(vc_reader_skip(reader) != 'P') return 0;
+	c = vc_reader_getc(reader);
+	if((c < '1') || (c > '6')) return 0;
+	*format = c - '0';
+	*channels = ((*format == 3) || (*format == 6)) ? 3 : 1;
+	*levels = 1;
+
+	if(!vc_reader_int(reader, width) || !vc_reader_int(reader, height)) return 0;
+	if((*format != 1) && (*format != 4) && !vc_reader_int(reader, levels)) return 0;
+
+	return (*width > 0) && (*height > 0) && (*levels > 0) && (*levels <= 255);
+}
+
+
+// L um pixel em ASCII pelo caminho geral (comentrios, nmeros longos ou fim do buffer)
+static int vc_reader_ascii_value(VC_READER *reader, int format, int levels)
+{
+	int c, v;
+
+	if(format == 1)
+	{
+		c = vc_reader_skip(reader);
+		if((c != '0') && (c != '1')) return -1;
+		// No PBM o 1  preto
+		return (c == '0');
+	}
+
+	if(!vc_reader_int(reader, &v) || (v > levels)) return -1;
+
+	return v;
+}
+
+
+// L uma linha de pixels em ASCII: P1 (um carcter '0'/'1' por pixel, com ou sem espaos)
+// ou P2/P3 (inteiros separados por espaos, no mximo levels).
+// Os nmeros at 3 dgitos so lidos diretamente do buffer; o resto vai para vc_reader_ascii_value().
+static int vc_reader_ascii_row(VC_READER *reader, unsigned char *dst, int count, int format, int levels)
+{
+	unsigned char *p, *end;
+	int i = 0, v;
+
+	while(i < count)
+	{
+		// Margem no fim do buffer para um nmero de 3 dgitos e o separador
+		p = reader->buf + reader->pos;
+		end = reader->buf + ((reader->len > 4) ? reader->len - 4 : 0);
+
+		while((i < count) && (p < end))
+		{
+			if(VC_IS_SPACE(*p)) { p++; continue; }
+			if((*p < '0') || (*p > '9')) break;
+
+			if(format == 1)
+			{
+				if(*p > '1') break;
+				dst[i++] = (*p++ == '0');
+				continue;
+			}
+
+			v = *p++ - '0';
+			if((*p >= '0') && (*p <= '9'))
+			{
+				v = v * 10 + (*p++ - '0');
+				if((*p >= '0') && (*p <= '9')) v = v * 10 + (*p++ - '0');
+			}
+			if(!VC_IS_SPACE(*p) || (v > levels))
+			{
+				// Volta ao incio do nmero e deixa o caminho geral tratar dele
+				while((p > reader->buf + reader->pos) && (p[-1] >= '0') && (p[-1] <= '9')) p--;
+				break;
+			}
+			dst[i++] = (unsigned char) v;
+			p++;
+		}
+
+		reader->pos = p - reader->buf;
+
+		if(i < count)
+		{
+			if((v = vc_reader_ascii_value(reader, format, levels)) < 0) return 0;
+			dst[i++] = (unsigned char) v;
+		}
+	}
+
+	return 1;
+}
+
+
+// Tabelas para converter 8 pixels de cada vez entre PBM (1 bit por pixel) e bytes.
+// Numa imagem PBM: 1 = Preto, 0 = Branco (o bit mais significativo  o pixel mais  esquerda).
+// Na nossa imagem: 0 = Preto, 1 (ou 255) = Branco.
+static unsigned char vc_pbm_unpack_lut[2][256][8];	// [0]: branco = 1; [1]: branco = 255
+static unsigned char vc_bit_reverse[256];
+static int vc_pbm_tables_ready = 0;
+
+static void vc_pbm_tables_init(void)
+{
+	int b, i;
+
+	if(vc_pbm_tables_ready) return;
+
+	for(b=0; b<256; b++)
+	{
+		vc_bit_reverse[b] = 0;
+		for(i=0; i<8; i++)
+		{
+			vc_pbm_unpack_lut[0][b][i] = (b & (0x80 >> i)) ? 0 : 1;
+			vc_pbm_unpack_lut[1][b][i] = (b & (0x80 >> i)) ? 0 : 255;
+			if(b & (1 << i)) vc_bit_reverse[b] |= 0x80 >> i;
+		}
+	}
+	vc_pbm_tables_ready = 1;
+}
+
+
+// Empacota uma linha de bytes em bits PBM (pixel a 0 -> bit a 1). Os bits de enchimento do ltimo byte ficam a 0.
+static void vc_pbm_pack_row_c(unsigned char *src, unsigned char *dst, int width)
+{
+	int x, i;
+	unsigned char byte;
+
+	for(x=0; x+8<=width; x+=8, src+=8)
+	{
+		*dst++ = (unsigned char) (((src[0] == 0) << 7) | ((src[1] == 0) << 6) | ((src[2] == 0) << 5) | ((src[3] == 0) << 4) |
+		                          ((src[4] == 0) << 3) | ((src[5] == 0) << 2) | ((src[6] == 0) << 1) | (src[7] == 0));
+	}
+	if(x < width)
+	{
+		byte = 0;
+		for(i=0; x+i<width; i++) byte |= (src[i] == 0) << (7 - i);
+		*dst = byte;
+	}
+}
+
+#ifdef VC_SIMD_X86
+// 16 pixels de cada vez: a mscara de comparao d os bits pela ordem inversa da do PBM
+__attribute__((target("sse2")))
+static void vc_pbm_pack_row_sse2(unsigned char *src, unsigned char *dst, int width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int x, m;
+
+	for(x=0; x+16<=width; x+=16)
+	{
+		m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *) (src + x)), zero));
+		*dst++ = vc_bit_reverse[m & 0xFF];
+		*dst++ = vc_bit_reverse[m >> 8];
+	}
+
+	vc_pbm_pack_row_c(src + x, dst, width - x);
+}
+#endif
+
+static void vc_pbm_pack_row(unsigned char *src, unsigned char *dst, int width)
+{
+	vc_pbm_tables_init();
+
+	#ifdef VC_SIMD_X86
+	if(vc_get_simd_level() >= VC_SIMD_SSE2) { vc_pbm_pack_row_sse2(src, dst, width); return; }
+	#endif
+	vc_pbm_pack_row_c(src, dst, width);
+}
+
+
+// Desempacota uma linha PBM; white  o valor dos pixels brancos (1 ou 255)
+static void vc_pbm_unpack_row(unsigned char *src, unsigned char *dst, int width, int white)
+{
+	unsigned char (*lut)[8] = vc_pbm_unpack_lut[white > 1];
+	int x;
+
+	vc_pbm_tables_init();
+
+	for(x=0; x+8<=width; x+=8) memcpy(dst + x, lut[*src++], 8);
+	if(x < width) memcpy(dst + x, lut[*src], width - x);
+}
+
+
+long int unsigned_char_to_bit(unsigned char *datauchar, unsigned char *databit, int width, int height)
+{
+	int y;
+	long int bytesperrow = (width + 7) / 8;
+
+	for(y=0; y<height; y++)
+	{
+		vc_pbm_pack_row(datauchar + (long int) y * width, databit + y * bytesperrow, width);
+	}
+
+	return bytesperrow * height;
+}
+
+
+void bit_to_unsigned_char(unsigned char *databit, unsigned char *datauchar, int width, int height)
+{
+	int y;
+	long int bytesperrow = (width + 7) / 8;
+
+	for(y=0; y<height; y++)
+	{
+		vc_pbm_unpack_row(databit + y * bytesperrow, datauchar + (long int) y * width, width, 1);
+	}
+}
+
+
+// L os pixels de uma imagem cujo header j foi lido com vc_reader_header()
+static int vc_reader_pixels(VC_READER *reader, IVC *image, int format, int levels)
+{
+	unsigned char *row = NULL;
+	int nbytes = (image->width + 7) / 8;
+	int size = image->width * image->channels;
+	int y;
+
+	for(y=0; y<image->height; y++)
+	{
+		if(format == 4) // PBM binrio: desempacota diretamente do buffer, se a linha l estiver inteira
+		{
+			if(reader->len - reader->pos >= (size_t) nbytes)
+			{
+				vc_pbm_unpack_row(reader->buf + reader->pos, image->data + y * image->bytesperline, image->width, 1);
+				reader->pos += nbytes;
+				continue;
+			}
+			if((row == NULL) && ((row = (unsigned char *) malloc(nbytes)) == NULL)) break;
+			if(!vc_reader_read(reader, row, nbytes)) break;
+			vc_pbm_unpack_row(row, image->data + y * image->bytesperline, image->width, 1);
+		}
+		else if(format >= 5) // PGM ou PPM binrio
+		{
+			// As linhas da imagem podem ter enchimento (bytesperline > width * channels)
+			if(!vc_reader_read(reader, image->data + y * image->bytesperline, size)) break;
+		}
+		else // P1, P2 ou P3 (ASCII)
+		{
+			if(!vc_reader_ascii_row(reader, image->data + y * image->bytesperline, size, format, levels)) break;
+		}
+	}
+
+	free(row);
+
+	return y == image->height;
+}
+
+
+IVC *vc_read_image(char *filename)
+{
+	VC_READER reader;
+	IVC *image = NULL;
+	char *error = NULL;
+	int format, width, height, channels, levels;
+	VC_PROFILE_OP(NULL, NULL);
+	
+	// Abre o ficheiro
+	if(!vc_reader_open(&reader, filename))
+	{
+		error = "File not found.";
+		goto cleanup;
+	}
+
+	// Efectua a leitura do header
+	if(!vc_reader_header(&reader, &format, &width, &height, &channels, &levels))
+	{
+		error = "File is not a valid PBM, PGM or PPM file.\n\tBad magic number or size!";
+		goto cleanup;
+	}
+
+	// Aloca memria para imagem
+	if((image = vc_image_new(width, height, channels, levels)) == NULL)
+	{
+		error = "Out of memory.";
+		goto cleanup;
+	}
+
+	if(!vc_reader_pixels(&reader, image, format, levels)) error = "Premature EOF or bad pixel value on file.";
+
+cleanup:
+	#ifdef VC_DEBUG
+	if(error != NULL) printf("ERROR -> vc_read_image():\n\t%s\n", error);
+	#endif
+
+	if(error != NULL) image = vc_image_free(image);
+	vc_reader_close(&reader);
+	
+	VC_PROFILE_IMAGES(NULL, image);
+
+	return image;
+}
+
+
+// Tamanho mximo de uma imagem no formato de vc_write_image() (header includo)
+static size_t vc_image_file_size(IVC *image)
+{
+	int binary = image->packed || (image->levels == 1);
+
+	return 64 + (size_t) (binary ? (image->width + 7) / 8 : image->width * image->channels) * image->height;
+}
+
+
+// Escreve em buf (pelo menos 64 bytes) o header de vc_write_image(); devolve o nmero de bytes
+static size_t vc_image_header(IVC *image, char *buf)
+{
+	if(image->packed || (image->levels == 1)) return sprintf(buf, "%s %d %d\n", "P4", image->width, image->height);
+	return sprintf(buf, "%s %d %d 255\n", (image->channels == 1) ? "P5" : "P6", image->width, image->height);
+}
+
+
+// Serializa a imagem em buf, no formato de vc_write_image(); devolve o nmero de bytes
+static size_t vc_image_encode(IVC *image, unsigned char *buf)
+{
+	int binary = image->packed || (image->levels == 1);
+	size_t rowsize = binary ? (image->width + 7) / 8 : image->width * image->channels;
+	size_t n = vc_image_header(image, (char *) buf);
+	int y;
+
+	for(y=0; y<image->height; y++, n+=rowsize)
+	{
+		if(binary && !image->packed) vc_pbm_pack_row(image->data + y * image->bytesperline, buf + n, image->width);
+		else memcpy(buf + n, image->data + y * image->bytesperline, rowsize);
+	}
+
+	return n;
+}
+
+
+// Escreve as linhas diretamente de image->data (sem o enchimento); s uma imagem binria
+// no empacotada passa por um buffer de uma linha (vc_pbm_pack_row). O header  o de
+// vc_image_encode(), pelo que o ficheiro  igual ao serializado para vc_aio_write().
+int vc_write_image(char *filename, IVC *image)
+{
+	FILE *file;
+	char header[64];
+	unsigned char *row = NULL, *line;
+	size_t rowsize, size;
+	int binary, y, ok;
+	VC_PROFILE_OP(image, NULL);
+	
+	if(image == NULL) return 0;
+
+	binary = image->packed || (image->levels == 1);
+	rowsize = binary ? (image->width + 7) / 8 : image->width * image->channels;
+	if(binary && !image->packed && ((row = (unsigned char *) malloc(rowsize)) == NULL)) return 0;
+
+	if((file = fopen(filename, "wb")) == NULL)
+	{
+		free(row);
+		return 0;
+	}
+
+	size = vc_image_header(image, header);
+	ok = (fwrite(header, sizeof(char), size, file) == size);
+	for(y=0; ok && (y<image->height); y++)
+	{
+		line = image->data + y * image->bytesperline;
+		if(row != NULL)
+		{
+			vc_pbm_pack_row(line, row, image->width);
+			line = row;
+		}
+		ok = (fwrite(line, sizeof(unsigned char), rowsize, file) == rowsize);
+	}
+	ok = (fclose(file) == 0) && ok;
+	free(row);
+
+	#ifdef VC_DEBUG
+	if(!ok) fprintf(stderr, "ERROR -> vc_write_image():\n\tError writing PBM, PGM or PPM file.\n");
+	#endif
+
+	return ok;
+}
+
+
+// Mapeia um ficheiro PBM (P4), PGM (P5) ou PPM (P6) em memria, sem copiar os pixels:
+// image->data aponta diretamente para dentro do mapeamento.
+// Com readonly = 0 o mapeamento  partilhado e as alteraes aos pixels so escritas no ficheiro.
+// Com readonly = 1 no se pode escrever em image->data.
+// Um PBM d uma imagem empacotada (packed = 1, 1 bit por pixel), tal como est no ficheiro.
+// A imagem  libertada com vc_image_free(), que desfaz o mapeamento.
+IVC *vc_image_map(char *filename, int readonly)
+{
+	IVC *image = NULL;
+	VC_READER reader;
+	unsigned char *base = NULL;
+	size_t size = 0;
+	int format, width, height, channels, levels, packed;
+	#ifdef _WIN32
+	HANDLE file, mapping;
+	LARGE_INTEGER filesize;
+	#else
+	int fd;
+	struct stat st;
+	#endif
+	VC_PROFILE_OP(NULL, NULL);
+
+	#ifdef _WIN32
+	file = CreateFileA(filename, readonly ? GENERIC_READ : (GENERIC_READ | GENERIC_WRITE), FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file != INVALID_HANDLE_VALUE)
+	{
+		if(GetFileSizeEx(file, &filesize) && (filesize.QuadPart > 0))
+		{
+			size = (size_t) filesize.QuadPart;
+			mapping = CreateFileMappingA(file, NULL, readonly ? PAGE_READONLY : PAGE_READWRITE, 0, 0, NULL);
+			if(mapping != NULL)
+			{
+				base = (unsigned char *) MapViewOfFile(mapping, readonly ? FILE_MAP_READ : FILE_MAP_WRITE, 0, 0, 0);
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(file);
+	}
+	#else
+	if((fd = open(filename, readonly ? O_RDONLY : O_RDWR)) >= 0)
+	{
+		if((fstat(fd, &st) == 0) && (st.st_size > 0))
+		{
+			size = (size_t) st.st_size;
+			base = (unsigned char *) mmap(NULL, size, readonly ? PROT_READ : (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+			if(base == (unsigned char *) MAP_FAILED) base = NULL;
+		}
+		close(fd);
+	}
+	#endif
+
+	if(base == NULL)
+	{
+		#ifdef VC_DEBUG
+		printf("ERROR -> vc_image_map():\n\tFile not found or cannot be mapped.\n");
+		#endif
+
+		return NULL;
+	}
+
+	// Efectua a leitura do header diretamente no mapeamento (s os formatos binrios)
+	vc_reader_memory(&reader, base, size);
+	if(!vc_reader_header(&reader, &format, &width, &height, &channels, &levels) || (format < 4))
+	{
+		#ifdef VC_DEBUG
+		printf("ERROR -> vc_image_map():\n\tFile is not a valid PBM, PGM or PPM file.\n\tBad magic number or size!\n");
+		#endif
+
+		#ifdef _WIN32
+		UnmapViewOfFile(base);
+		#else
+		munmap(base, size);
+		#endif
+		return NULL;
+	}
+
+	packed = (format == 4);
+	if((size_t) (packed ? (width + 7) / 8 : width * channels) * height > size - reader.pos)
+	{
+		#ifdef VC_DEBUG
+		printf("ERROR -> vc_image_map():\n\tPremature EOF on file.\n");
+		#endif
+
+		#ifdef _WIN32
+		UnmapViewOfFile(base);
+		#else
+		munmap(base, size);
+		#endif
+		return NULL;
+	}
+
+	image = (IVC *) malloc(sizeof(IVC));
+	if(image == NULL)
+	{
+		#ifdef _WIN32
+		UnmapViewOfFile(base);
+		#else
+		munmap(base, size);
+		#endif
+		return NULL;
+	}
+
+	image->width = width;
+	image->height = height;
+	image->channels = channels;
+	image->levels = levels;
+	image->bytesperline = packed ? (width + 7) / 8 : width * channels;
+	image->packed = packed;
+	image->ownership = VC_OWN_MAP;
+	image->mapbase = base;
+	image->mapsize = size;
+	image->data = base + reader.pos;
+	VC_PROFILE_IMAGES(NULL, image);
+
+	return image;
+}
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    FUNES: LEITURA E ESCRITA POR FAIXAS DE LINHAS (PBM, PGM E PPM)
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+
+// Abre um ficheiro PBM (P4), PGM (P5) ou PPM (P6) para ler as linhas aos poucos.
+// S o header  lido; as linhas so lidas com vc_stream_read_rows().
+VC_STREAM *vc_stream_open_read(char *filename)
+{
+	VC_STREAM *stream;
+	VC_READER reader;
+	FILE *file;
+	int format, width, height, channels, levels;
+	int packed;
+
+	if(!vc_reader_open(&reader, filename))
+	{
+		#ifdef VC_DEBUG
+		printf("ERROR -> vc_stream_open_read():\n\tFile not found.\n");
+		#endif
+
+		vc_reader_close(&reader);
+		return NULL;
+	}
+
+	// S os formatos binrios podem ser lidos por linhas; os bytes do buffer que j so
+	// pixels so devolvidos ao ficheiro
+	if(!vc_reader_header(&reader, &format, &width, &height, &channels, &levels) || (format < 4) ||
+	   (fseek(reader.file, -(long) (reader.len - reader.pos), SEEK_CUR) != 0))
+	{
+		#ifdef VC_DEBUG
+		printf("ERROR -> vc_stream_open_read():\n\tFile is not a valid PBM, PGM or PPM file.\n\tBad magic number or size!\n");
+		#endif
+
+		vc_reader_close(&reader);
+		return NULL;
+	}
+
+	file = reader.file;
+	reader.file = NULL;
+	vc_reader_close(&reader);
+	packed = (format == 4);
+
+	stream = (VC_STREAM *) malloc(sizeof(VC_STREAM));
+	if(stream == NULL)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	stream->file = file;
+	stream->width = width;
+	stream->height = height;
+	stream->channels = channels;
+	stream->levels = levels;
+	stream->packed = packed;
+	stream->writing = 0;
+	stream->row = 0;
+	stream->rowsize = packed ? (width + 7) / 8 : width * channels;
+	stream->rowbuf = packed ? (unsigned char *) malloc(stream->rowsize) : NULL;
+
+	if(packed && (stream->rowbuf == NULL))
+	{
+		vc_stream_close(stream);
+		return NULL;
+	}
+
+	return stream;
+}
+
+
+// Cria um ficheiro e escreve o header; as linhas so escritas com vc_stream_write_rows().
+// levels = 1 d um PBM (P4); caso contrrio PGM (1 canal) ou PPM (3 canais).
+VC_STREAM *vc_stream_open_write(char *filename, int width, int height, int channels, int levels)
+{
+	VC_STREAM *stream;
+	FILE *file;
+	int packed = (levels == 1);
+
+	if((width <= 0) || (height <= 0) || (levels <= 0) || (levels > 255)) return NULL;
+	if((channels != 1) && (channels != 3)) return NULL;
+	if(packed && (channels != 1)) return NULL;
+
+	if((file = fopen(filename, "wb")) == NULL) return NULL;
+
+	if(packed) fprintf(file, "%s %d %d\n", "P4", width, height);
+	else fprintf(file, "%s %d %d 255\n", (channels == 1) ? "P5" : "P6", width, height);
+
+	stream = (VC_STREAM *) malloc(sizeof(VC_STREAM));
+	if(stream == NULL)
+	{
+		fclose(file);
+		return NULL;
+	}
+
+	stream->file = file;
+	stream->width = width;
+	stream->height = height;
+	stream->channels = channels;
+	stream->levels = levels;
+	stream->packed = packed;
+	stream->writing = 1;
+	stream->row = 0;
+	stream->rowsize = packed ? (width + 7) / 8 : width * channels;
+	stream->rowbuf = packed ? (unsigned char *) malloc(stream->rowsize) : NULL;
+
+	if(packed && (stream->rowbuf == NULL))
+	{
+		vc_stream_close(stream);
+		return NULL;
+	}
+
+	return stream;
+}
+
+
+// Fecha o ficheiro. Devolve 0 se um ficheiro de escrita ficou incompleto.
+int vc_stream_close(VC_STREAM *stream)
+{
+	int complete;
+
+	if(stream == NULL) return 0;
+
+	complete = !stream->writing || (stream->row == stream->height);
+
+	if(stream->file != NULL) fclose(stream->file);
+	free(stream->rowbuf);
+	free(stream);
+
+	return complete;
+}
+
+
+// L as prximas nrows linhas do ficheiro para as linhas [y, y + nrows) de strip.
+// strip tem de ter a largura e os canais do ficheiro; num PBM pode ser empacotada ou em bytes
+// (os pixels brancos ficam com o valor strip->levels).
+// Devolve o nmero de linhas lidas (menos que nrows no fim do ficheiro), ou -1 em caso de erro.
+int vc_stream_read_rows(VC_STREAM *stream, IVC *strip, int y, int nrows)
+{
+	int i;
+	unsigned char *line;
+
+	if((stream == NULL) || stream->writing || (strip == NULL)) return -1;
+	if((strip->width != stream->width) || (strip->channels != stream->channels)) return -1;
+	if(strip->packed && !stream->packed) return -1;
+	if((y < 0) || (nrows < 0) || (y + nrows > strip->height)) return -1;
+
+	if(nrows > stream->height - stream->row) nrows = stream->height - stream->row;
+
+	for(i=0; i<nrows; i++)
+	{
+		line = strip->data + (y + i) * strip->bytesperline;
+
+		if(stream->packed && !strip->packed)
+		{
+			if(fread(stream->rowbuf, sizeof(unsigned char), stream->rowsize, stream->file) != (size_t) stream->rowsize) return -1;
+			vc_pbm_unpack_row(stream->rowbuf, line, stream->width, strip->levels);
+		}
+		else
+		{
+			if(fread(line, sizeof(unsigned char), stream->rowsize, stream->file) != (size_t) stream->rowsize) return -1;
+		}
+
+		stream->row++;
+	}
+
+	return nrows;
+}
+
+
+// Escreve as linhas [y, y + nrows) de strip no ficheiro. Devolve o nmero de linhas escritas, ou -1.
+int vc_stream_write_rows(VC_STREAM *stream, IVC *strip, int y, int nrows)
+{
+	int i;
+	unsigned char *line;
+
+	if((stream == NULL) || !stream->writing || (strip == NULL)) return -1;
+	if((strip->width != stream->width) || (strip->channels != stream->channels)) return -1;
+	if(strip->packed && !stream->packed) return -1;
+	if((y < 0) || (nrows < 0) || (y + nrows > strip->height)) return -1;
+	if(nrows > stream->height - stream->row) return -1;
+
+	for(i=0; i<nrows; i++)
+	{
+		line = strip->data + (y + i) * strip->bytesperline;
+
+		if(stream->packed && !strip->packed)
+		{
+			vc_pbm_pack_row(line, stream->rowbuf, stream->width);
+			line = stream->rowbuf;
+		}
+
+		if(fwrite(line, sizeof(unsigned char), stream->rowsize, stream->file) != (size_t) stream->rowsize) return -1;
+
+		stream->row++;
+	}
+
+	return nrows;
+}
+
+
+// Aplica op(src, dst, ctx) a um ficheiro, faixa a faixa, sem nunca ter a imagem inteira em memria.
+// Cada faixa tem striprows linhas de sada; para operadores de vizinhana, halo  o nmero de
+// linhas que a janela precisa acima e abaixo (ex.: kernel / 2). Essas linhas vm da faixa anterior
+// e da seguinte, pelo que o resultado  igual ao de aplicar op  imagem inteira.
+// O ficheiro de sada tem outchannels canais; outlevels = 1 d um PBM e op recebe um dst empacotado.
+// A memria usada  O(largura x (striprows + 2 x halo)).
+int vc_stream_process(char *infile, char *outfile, int striprows, int halo, int outchannels, int outlevels, vc_stream_op op, void *ctx)
+{
+	VC_STREAM *in = NULL, *out = NULL;
+	IVC *src = NULL, *dst = NULL;
+	int capacity, b0, b1, y, y1, need0, need1, n, ok = 0;
+	VC_PROFILE_OP(NULL, NULL);
+
+	if((striprows <= 0) || (halo < 0) || (op == NULL)) return 0;
+
+	if((in = vc_stream_open_read(infile)) == NULL) return 0;
+	if((out = vc_stream_open_write(outfile, in->width, in->height, outchannels, outlevels)) == NULL) goto cleanup;
+
+	capacity = striprows + 2 * halo;
+	if(capacity > in->height) capacity = in->height;
+
+	// Uma imagem PBM de entrada  lida em bytes (0 / 255), que  o que os operadores esperam
+	src = vc_image_new(in->width, capacity, in->channels, in->packed ? 255 : in->levels);
+	dst = (outlevels == 1) ? vc_image_new_packed(in->width, capacity) : vc_image_new(in->width, capacity, outchannels, outlevels);
+	if((src == NULL) || (dst == NULL)) goto cleanup;
+
+	// As linhas [b0, b1) da imagem esto nas linhas [0, b1 - b0) de src
+	b0 = b1 = 0;
+
+	for(y=0; y<in->height; y=y1)
+	{
+		y1 = (y + striprows < in->height) ? y + striprows : in->height;
+		need0 = (y - halo < 0) ? 0 : y - halo;
+		need1 = (y1 + halo < in->height) ? y1 + halo : in->height;
+
+		// Mantm as linhas de halo que j foram lidas (no mximo 2 x halo) e l as restantes
+		if(need0 < b1)
+		{
+			memmove(src->data, src->data + (need0 - b0) * src->bytesperline, (b1 - need0) * src->bytesperline);
+			b0 = need0;
+		}
+		else
+		{
+			b0 = b1 = need0;
+		}
+
+		n = vc_stream_read_rows(in, src, b1 - b0, need1 - b1);
+		if(n != need1 - b1) goto cleanup;
+		b1 = need1;
+
+		// Os operadores veem uma imagem com as linhas da faixa mais o halo
+		src->height = dst->height = b1 - b0;
+		if(!op(src, dst, ctx)) goto cleanup;
+		src->height = dst->height = capacity;
+
+		if(vc_stream_write_rows(out, dst, y - b0, y1 - y) != y1 - y) goto cleanup;
+	}
+
+	ok = 1;
+
+cleanup:
+	vc_image_free(src);
+	vc_image_free(dst);
+	if(!vc_stream_close(out)) ok = 0;
+	vc_stream_close(in);
+
+	return ok;
+}
+
+
+static int vc_stream_midpoint_op(IVC *src, IVC *dst, void *ctx)
+{
+	return vc_gray_midpoint_threshold(src, dst, *(int *) ctx);
+}
+
+
+// vc_gray_midpoint_threshold() aplicado a um ficheiro PGM por faixas de striprows linhas
+int vc_stream_midpoint_threshold(char *infile, char *outfile, int kernel, int striprows)
+{
+	if(kernel < 1) kernel = 1;
+
+	return vc_stream_process(infile, outfile, striprows, kernel / 2, 1, 255, vc_stream_midpoint_op, &kernel);
+}
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    FUNES: EXECUO PARALELA POR BANDAS DE LINHAS
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Nmero mnimo de linhas por banda (abaixo disto no compensa dividir)
+#define VC_MIN_BAND_ROWS 16
+// Nmero de bandas por thread (permite equilibrar bandas de custo desigual)
+#define VC_BANDS_PER_THREAD 4
+
+typedef struct {
+    IVC *image;
+    vc_rows_fn fn;
+    void *ctx;
+    int halo;
+    int nbands;
+    int nextband;           // Prxima banda por atribuir
+    int pending;            // Bandas ainda por terminar
+    const char *name;       // Operador que despachou (instrumentao)
+    vc_tile_fn tilefn;      // Trabalho por tiles (NULL = por bandas)
+    int tilew, tileh;       // Tamanho dos tiles
+    int ntx;                // Tiles por linha de tiles
+    int nqueues;            // Filas de tiles (uma por thread)
+} VC_JOB;
+
+// Fila de tiles de cada thread: a dona tira do incio, as outras roubam do fim
+typedef struct {
+    pthread_mutex_t mutex;
+    int head, tail;         // ndices de tiles [head, tail) ainda por executar
+} VC_DEQUE;
+
+static pthread_mutex_t vc_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vc_pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t vc_pool_done = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t vc_pool_dispatch = PTHREAD_MUTEX_INITIALIZER;   // Um trabalho de cada vez
+static pthread_t vc_pool_threads[VC_MAX_THREADS];
+static int vc_pool_size = 0;            // Workers criados (sem contar a thread que despacha)
+static int vc_num_threads = 0;          // 0 = automtico (nmero de CPUs)
+static int vc_pool_quit = 0;
+static unsigned long vc_pool_generation = 0;
+static VC_JOB vc_pool_job;
+static VC_DEQUE vc_pool_deques[VC_MAX_THREADS];
+static pthread_once_t vc_pool_deques_once = PTHREAD_ONCE_INIT;
+static int vc_pool_active = 0;          // Threads a executar o trabalho atual
+static VC_THREAD_LOCAL int vc_thread_busy = 0;     // Evita despachar a partir de uma banda
+
+
+static int vc_cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int) info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int) n : 1;
+#endif
+}
+
+
+// Executa bandas do trabalho atual at no haver mais nenhuma por atribuir
+static void vc_pool_run_bands(int thread) {
+    VC_BAND band;
+    IVC *image;
+    vc_rows_fn fn;
+    void *ctx;
+    const char *name;
+    int b, nbands, halo, height;
+#ifdef VC_PROFILE
+    long long start;
+#endif
+
+    for (;;) {
+        pthread_mutex_lock(&vc_pool_mutex);
+        if (vc_pool_job.nextband >= vc_pool_job.nbands) {
+            pthread_mutex_unlock(&vc_pool_mutex);
+            break;
+        }
+        b = vc_pool_job.nextband++;
+        image = vc_pool_job.image;
+        fn = vc_pool_job.fn;
+        ctx = vc_pool_job.ctx;
+        halo = vc_pool_job.halo;
+        nbands = vc_pool_job.nbands;
+        name = vc_pool_job.name;
+        pthread_mutex_unlock(&vc_pool_mutex);
+
+        height = image->height;
+        band.y0 = (int) ((long long) b * height / nbands);
+        band.y1 = (int) ((long long) (b + 1) * height / nbands);
+        band.hy0 = (band.y0 - halo < 0) ? 0 : band.y0 - halo;
+        band.hy1 = (band.y1 + halo > height) ? height : band.y1 + halo;
+        band.thread = thread;
+#ifdef VC_PROFILE
+        start = vc_profile_now();
+        fn(image, &band, ctx);
+        vc_profile_band(name, image, &band, start);
+#else
+        (void) name;
+        fn(image, &band, ctx);
+#endif
+
+        pthread_mutex_lock(&vc_pool_mutex);
+        if (--vc_pool_job.pending == 0) pthread_cond_signal(&vc_pool_done);
+        pthread_mutex_unlock(&vc_pool_mutex);
+    }
+}
+
+
+static void vc_pool_deques_init(void) {
+    int i;
+
+    for (i = 0; i < VC_MAX_THREADS; i++) pthread_mutex_init(&vc_pool_deques[i].mutex, NULL);
+}
+
+
+static void vc_tile_rect(IVC *image, int t, int ntx, int tilew, int tileh, int halo, VC_TILE *tile) {
+    tile->x0 = (t % ntx) * tilew;
+    tile->y0 = (t / ntx) * tileh;
+    tile->x1 = (tile->x0 + tilew > image->width) ? image->width : tile->x0 + tilew;
+    tile->y1 = (tile->y0 + tileh > image->height) ? image->height : tile->y0 + tileh;
+    tile->hx0 = (tile->x0 - halo < 0) ? 0 : tile->x0 - halo;
+    tile->hy0 = (tile->y0 - halo < 0) ? 0 : tile->y0 - halo;
+    tile->hx1 = (tile->x1 + halo > image->width) ? image->width : tile->x1 + halo;
+    tile->hy1 = (tile->y1 + halo > image->height) ? image->height : tile->y1 + halo;
+}
+
+
+// Executa tiles da prpria fila e, quando esta acaba, rouba metade dos que restam na fila
+// mais cheia das outras threads, at no haver mais tiles por executar
+static void vc_pool_run_tiles(int thread) {
+    VC_JOB *job = &vc_pool_job;
+    VC_DEQUE *own = &vc_pool_deques[thread];
+    VC_DEQUE *victim;
+    VC_TILE tile;
+    int t, i, n, best, left, done = 0;
+#ifdef VC_PROFILE
+    long long start;
+#endif
+
+    for (;;) {
+        pthread_mutex_lock(&own->mutex);
+        t = (own->head < own->tail) ? own->head++ : -1;
+        pthread_mutex_unlock(&own->mutex);
+
+        if (t < 0) {
+            // Procura a fila com mais tiles por executar
+            victim = NULL;
+            best = 0;
+            for (i = 0; i < job->nqueues; i++) {
+                if (i == thread) continue;
+                pthread_mutex_lock(&vc_pool_deques[i].mutex);
+                left = vc_pool_deques[i].tail - vc_pool_deques[i].head;
+                pthread_mutex_unlock(&vc_pool_deques[i].mutex);
+                if (left > best) {
+                    best = left;
+                    victim = &vc_pool_deques[i];
+                }
+            }
+            if (victim == NULL) break;
+
+            pthread_mutex_lock(&victim->mutex);
+            n = (victim->tail - victim->head + 1) / 2;
+            victim->tail -= n;
+            t = victim->tail;
+            pthread_mutex_unlock(&victim->mutex);
+            if (n <= 0) continue;
+
+            // O primeiro tile roubado  executado j, os restantes passam para a prpria fila
+            pthread_mutex_lock(&own->mutex);
+            own->head = t + 1;
+            own->tail = t + n;
+            pthread_mutex_unlock(&own->mutex);
+        }
+
+        vc_tile_rect(job->image, t, job->ntx, job->tilew, job->tileh, job->halo, &tile);
+        tile.thread = thread;
+#ifdef VC_PROFILE
+        start = vc_profile_now();
+        job->tilefn(job->image, &tile, job->ctx);
+        vc_profile_tile(job->name, job->image, &tile, start);
+#else
+        job->tilefn(job->image, &tile, job->ctx);
+#endif
+        done++;
+    }
+
+    pthread_mutex_lock(&vc_pool_mutex);
+    job->pending -= done;
+    if (job->pending == 0) pthread_cond_broadcast(&vc_pool_done);
+    pthread_mutex_unlock(&vc_pool_mutex);
+}
+
+
+static void *vc_pool_worker(void *arg) {
+    int thread = (int) (long) arg;
+    unsigned long seen = 0;
+
+    vc_thread_busy = 1;
+
+    pthread_mutex_lock(&vc_pool_mutex);
+    for (;;) {
+        while (!vc_pool_quit && (vc_pool_generation == seen)) pthread_cond_wait(&vc_pool_work, &vc_pool_mutex);
+        if (vc_pool_quit) break;
+        seen = vc_pool_generation;
+        vc_pool_active++;
+        pthread_mutex_unlock(&vc_pool_mutex);
+
+        if (vc_pool_job.tilefn != NULL) vc_pool_run_tiles(thread);
+        else vc_pool_run_bands(thread);
+
+        pthread_mutex_lock(&vc_pool_mutex);
+        if (--vc_pool_active == 0) pthread_cond_broadcast(&vc_pool_done);
+    }
+    pthread_mutex_unlock(&vc_pool_mutex);
+
+    return NULL;
+}
+
+
+// Termina os workers (chamar com vc_pool_dispatch bloqueado)
+static void vc_pool_stop(void) {
+    int i;
+
+    if (vc_pool_size == 0) return;
+
+    pthread_mutex_lock(&vc_pool_mutex);
+    vc_pool_quit = 1;
+    pthread_cond_broadcast(&vc_pool_work);
+    pthread_mutex_unlock(&vc_pool_mutex);
+
+    for (i = 0; i < vc_pool_size; i++) pthread_join(vc_pool_threads[i], NULL);
+
+    vc_pool_size = 0;
+    vc_pool_quit = 0;
+}
+
+
+// Cria os workers que faltam (chamar com vc_pool_dispatch bloqueado)
+static void vc_pool_start(int nthreads) {
+    while (vc_pool_size < nthreads - 1) {
+        if (pthread_create(&vc_pool_threads[vc_pool_size], NULL, vc_pool_worker, (void *) (long) (vc_pool_size + 1)) != 0) break;
+        vc_pool_size++;
+    }
+}
+
+
+// Define o nmero de threads usadas pelos operadores (0 = nmero de CPUs)
+int vc_set_num_threads(int nthreads) {
+    if (nthreads < 0) return 0;
+    if (nthreads > VC_MAX_THREADS) nthreads = VC_MAX_THREADS;
+
+    pthread_mutex_lock(&vc_pool_dispatch);
+    vc_pool_stop();
+    vc_num_threads = nthreads;
+    pthread_mutex_unlock(&vc_pool_dispatch);
+
+    return 1;
+}
+
+
+int vc_get_num_threads(void) {
+    int n = vc_num_threads;
+
+    if (n == 0) n = vc_cpu_count();
+    if (n > VC_MAX_THREADS) n = VC_MAX_THREADS;
+
+    return n;
+}
+
+
+// Divide a imagem em bandas de linhas e executa fn sobre cada uma, em paralelo.
+// Cada banda recebe tambm as linhas de halo [hy0, hy1) que pode ler
+// (usado pelos operadores de vizinhana). As bandas nunca escrevem nas mesmas linhas,
+// pelo que o resultado  igual ao da execuo sequencial.
+int vc_parallel_rows_halo(IVC *image, int halo, vc_rows_fn fn, void *ctx) {
+    VC_BAND band;
+    int nthreads, nbands, minrows;
+#ifdef VC_PROFILE
+    long long start = vc_profile_now();
+#endif
+
+    if ((image == NULL) || (fn == NULL) || (image->height <= 0) || (halo < 0)) return 0;
+
+    nthreads = vc_get_num_threads();
+    minrows = VC_MIN_BAND_ROWS + 2 * halo;
+    nbands = nthreads * VC_BANDS_PER_THREAD;
+    if (nbands > image->height / minrows) nbands = image->height / minrows;
+
+    // Execuo sequencial: uma nica banda com a imagem inteira
+    if ((nthreads <= 1) || (nbands <= 1) || vc_thread_busy) {
+        band.y0 = band.hy0 = 0;
+        band.y1 = band.hy1 = image->height;
+        band.thread = 0;
+        fn(image, &band, ctx);
+#ifdef VC_PROFILE
+        vc_profile_band(vc_profile_op, image, &band, start);
+#endif
+        return 1;
+    }
+
+    pthread_mutex_lock(&vc_pool_dispatch);
+    vc_pool_start(nthreads);
+
+    pthread_mutex_lock(&vc_pool_mutex);
+    // Um worker atrasado ainda pode estar a sair do trabalho anterior
+    while (vc_pool_active > 0) pthread_cond_wait(&vc_pool_done, &vc_pool_mutex);
+    vc_pool_job.image = image;
+    vc_pool_job.fn = fn;
+    vc_pool_job.tilefn = NULL;
+    vc_pool_job.ctx = ctx;
+    vc_pool_job.halo = halo;
+    vc_pool_job.nbands = nbands;
+    vc_pool_job.nextband = 0;
+    vc_pool_job.pending = nbands;
+#ifdef VC_PROFILE
+    vc_pool_job.name = vc_profile_op;
+#else
+    vc_pool_job.name = NULL;
+#endif
+    vc_pool_generation++;
+    pthread_cond_broadcast(&vc_pool_work);
+    pthread_mutex_unlock(&vc_pool_mutex);
+
+    // A thread que despacha tambm trabalha
+    vc_thread_busy = 1;
+    vc_pool_run_bands(0);
+    vc_thread_busy = 0;
+
+    pthread_mutex_lock(&vc_pool_mutex);
+    while (vc_pool_job.pending > 0) pthread_cond_wait(&vc_pool_done, &vc_pool_mutex);
+    pthread_mutex_unlock(&vc_pool_mutex);
+
+    pthread_mutex_unlock(&vc_pool_dispatch);
+
+    return 1;
+}
+
+
+int vc_parallel_rows(IVC *image, vc_rows_fn fn, void *ctx) {
+    return vc_parallel_rows_halo(image, 0, fn, ctx);
+}
+
+
+// Tamanho dos tiles definido com vc_set_tile_size (0 = automtico)
+static int vc_tile_width = 0, vc_tile_height = 0;
+static int vc_cache_l2 = 0;
+
+// Tamanho da cache L2 (por core), em bytes: sysconf/sysfs no Linux, GetLogicalProcessorInformation no Windows
+static int vc_cache_l2_size(void) {
+    int size = 0;
+#ifdef _WIN32
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION info[256];
+    DWORD len = sizeof(info);
+    int i;
+
+    if (GetLogicalProcessorInformation(info, &len)) {
+        for (i = 0; i < (int) (len / sizeof(info[0])); i++) {
+            if ((info[i].Relationship == RelationCache) && (info[i].Cache.Level == 2)) size = (int) info[i].Cache.Size;
+        }
+    }
+#else
+    FILE *file;
+    char path[128], unit = 0;
+    int i, level;
+
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    size = (int) sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    for (i = 0; (size <= 0) && (i < 8); i++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+        if ((file = fopen(path, "r")) == NULL) break;
+        level = 0;
+        if (fscanf(file, "%d", &level) != 1) level = 0;
+        fclose(file);
+        if (level != 2) continue;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+        if ((file = fopen(path, "r")) == NULL) break;
+        if (fscanf(file, "%d%c", &size, &unit) < 1) size = 0;
+        fclose(file);
+        if ((unit == 'K') || (unit == 'k')) size *= 1024;
+        else if ((unit == 'M') || (unit == 'm')) size *= 1024 * 1024;
+    }
+#endif
+    // Valor tpico quando no  possvel detetar
+    return (size > 0) ? size : 256 * 1024;
+}
+
+// Define o tamanho dos tiles de vc_parallel_tiles (0 = automtico, a partir da cache L2).
+// A largura  arredondada a um mltiplo de 64 pixels.
+int vc_set_tile_size(int width, int height) {
+    if ((width < 0) || (height < 0)) return 0;
+
+    vc_tile_width = (width > 0) ? VC_ALIGN_UP(width) : 0;
+    vc_tile_height = height;
+
+    return 1;
+}
+
+// Escolhe tiles em que o tile com o halo (a bytesperpixel bytes por pixel de trabalho,
+// contando entrada, sada e buffers intermdios) ocupa metade da L2: a outra metade fica
+// para as linhas de halo partilhadas com os tiles vizinhos e para o resto do programa.
+static void vc_tile_size(IVC *image, int halo, int bytesperpixel, int *tilew, int *tileh) {
+    long long budget, side;
+    int w, h;
+
+    if (vc_cache_l2 == 0) vc_cache_l2 = vc_cache_l2_size();
+    if (bytesperpixel < 1) bytesperpixel = 1;
+    budget = vc_cache_l2 / 2 / bytesperpixel;
+
+    // Tile quadrado (com halo), largura em mltiplos de 64 pixels
+    for (side = 64; (side + 64) * (side + 64) <= budget; side += 64);
+    w = (int) side - 2 * halo;
+    w = (w < 64) ? 64 : w & ~63;
+    h = (int) (budget / (w + 2 * halo)) - 2 * halo;
+    if (h < VC_MIN_BAND_ROWS) h = VC_MIN_BAND_ROWS;
+
+    if (vc_tile_width > 0) w = vc_tile_width;
+    if (vc_tile_height > 0) h = vc_tile_height;
+
+    *tilew = (w > image->width) ? image->width : w;
+    *tileh = (h > image->height) ? image->height : h;
+}
+
+// Divide a imagem em tiles do tamanho da cache e executa fn sobre cada um, em paralelo.
+// Cada tile recebe tambm os pixels de halo [hx0, hx1) x [hy0, hy1) que pode ler. Os tiles
+// so distribudos por filas, uma por thread (blocos contguos, pela ordem das linhas);
+// uma thread sem tiles rouba metade dos que restam na fila mais cheia.
+int vc_parallel_tiles(IVC *image, int halo, int bytesperpixel, vc_tile_fn fn, void *ctx) {
+    VC_TILE tile;
+    int nthreads, tilew, tileh, ntx, ntiles, nqueues, t, i;
+#ifdef VC_PROFILE
+    long long start;
+#endif
+
+    if ((image == NULL) || (fn == NULL) || (image->width <= 0) || (image->height <= 0) || (halo < 0)) return 0;
+
+    vc_tile_size(image, halo, bytesperpixel, &tilew, &tileh);
+    ntx = (image->width + tilew - 1) / tilew;
+    ntiles = ntx * ((image->height + tileh - 1) / tileh);
+    nthreads = vc_get_num_threads();
+
+    // Execuo sequencial: os tiles um a um, pela ordem das linhas
+    if ((nthreads <= 1) || (ntiles <= 1) || vc_thread_busy) {
+        for (t = 0; t < ntiles; t++) {
+            vc_tile_rect(image, t, ntx, tilew, tileh, halo, &tile);
+            tile.thread = 0;
+#ifdef VC_PROFILE
+            start = vc_profile_now();
+            fn(image, &tile, ctx);
+            vc_profile_tile(vc_profile_op, image, &tile, start);
+#else
+            fn(image, &tile, ctx);
+#endif
+        }
+        return 1;
+    }
+
+    pthread_once(&vc_pool_deques_once, vc_pool_deques_init);
+    pthread_mutex_lock(&vc_pool_dispatch);
+    vc_pool_start(nthreads);
+    nqueues = vc_pool_size + 1;
+
+    pthread_mutex_lock(&vc_pool_mutex);
+    while (vc_pool_active > 0) pthread_cond_wait(&vc_pool_done, &vc_pool_mutex);
+    vc_pool_job.image = image;
+    vc_pool_job.fn = NULL;
+    vc_pool_job.tilefn = fn;
+    vc_pool_job.ctx = ctx;
+    vc_pool_job.halo = halo;
+    vc_pool_job.tilew = tilew;
+    vc_pool_job.tileh = tileh;
+    vc_pool_job.ntx = ntx;
+    vc_pool_job.nqueues = nqueues;
+    vc_pool_job.pending = ntiles;
+#ifdef VC_PROFILE
+    vc_pool_job.name = vc_profile_op;
+#else
+    vc_pool_job.name = NULL;
+#endif
+    for (i = 0; i < nqueues; i++) {
+        vc_pool_deques[i].head = (int) ((long long) i * ntiles / nqueues);
+        vc_pool_deques[i].tail = (int) ((long long) (i + 1) * ntiles / nqueues);
+    }
+    vc_pool_generation++;
+    pthread_cond_broadcast(&vc_pool_work);
+    pthread_mutex_unlock(&vc_pool_mutex);
+
+    // A thread que despacha tambm trabalha
+    vc_thread_busy = 1;
+    vc_pool_run_tiles(0);
+    vc_thread_busy = 0;
+
+    pthread_mutex_lock(&vc_pool_mutex);
+    while (vc_pool_job.pending > 0) pthread_cond_wait(&vc_pool_done, &vc_pool_mutex);
+    pthread_mutex_unlock(&vc_pool_mutex);
+
+    pthread_mutex_unlock(&vc_pool_dispatch);
+
+    return 1;
+}
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    FUNES: KERNELS DE LINHA (ESCALAR E SIMD)
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Pesos de vc_rgb_to_gray em vrgula fixa Q15 (0.299, 0.587, 0.114).
+// A soma  exatamente 32768, pelo que (255,255,255) d 255.
+// Arredondamento: truncatura (>> 15), tal como o cast (unsigned char) da verso em float.
+// O resultado difere no mximo de 1 nvel da frmula em float.
+#define VC_GRAY_WR 9798
+#define VC_GRAY_WG 19235
+#define VC_GRAY_WB 3735
+#define VC_GRAY_SHIFT 15
+
+static int vc_simd_level = -1;      // -1 = ainda no detetado
+
+static void vc_rgb_to_gray_row_c(unsigned char *src, unsigned char *dst, int width) {
+    int x;
+
+    for (x = 0; x < width; x++, src += 3) {
+        dst[x] = (unsigned char) ((VC_GRAY_WR * src[0] + VC_GRAY_WG * src[1] + VC_GRAY_WB * src[2]) >> VC_GRAY_SHIFT);
+    }
+}
+
+static void vc_gray_to_binary_row_c(unsigned char *src, unsigned char *dst, int width, int threshold) {
+    int x;
+
+    for (x = 0; x < width; x++) {
+        dst[x] = (src[x] > threshold) ? 255 : 0;
+    }
+}
+
+
+// Verso de vc_gray_to_binary_row_c que escreve diretamente em bits PBM (pixel <= threshold -> preto -> bit a 1)
+static void vc_gray_to_binary_row_packed_c(unsigned char *src, unsigned char *dst, int width, int threshold) {
+    int x, i;
+    unsigned char byte;
+
+    for (x = 0; x + 8 <= width; x += 8, src += 8) {
+        *dst++ = (unsigned char) (((src[0] <= threshold) << 7) | ((src[1] <= threshold) << 6) |
+                                  ((src[2] <= threshold) << 5) | ((src[3] <= threshold) << 4) |
+                                  ((src[4] <= threshold) << 3) | ((src[5] <= threshold) << 2) |
+                                  ((src[6] <= threshold) << 1) | (src[7] <= threshold));
+    }
+    if (x < width) {
+        byte = 0;
+        for (i = 0; x + i < width; i++) byte |= (src[i] <= threshold) << (7 - i);
+        *dst = byte;
+    }
+}
+
+// Tabelas de recprocos para vc_rgb_to_hsv (vrgula fixa Q16, arredondadas por excesso):
+//   S = (d * vc_hsv_sat_recip[max]) >> 16    = 255 * d / max
+//   H = (n * vc_hsv_hue_recip[d]) >> 16      = 255 * n / (6 * d), com n em [0, 6d)
+// em que d = max - min. As entradas de ndice 0 so 0, o que d H = S = 0 para cinzentos.
+static unsigned int vc_hsv_sat_recip[256];
+static unsigned int vc_hsv_hue_recip[256];
+static int vc_hsv_tables_ready = 0;
+
+static void vc_hsv_tables_init(void) {
+    unsigned int i;
+
+    if (vc_hsv_tables_ready) return;
+
+    vc_hsv_sat_recip[0] = vc_hsv_hue_recip[0] = 0;
+    for (i = 1; i < 256; i++) {
+        vc_hsv_sat_recip[i] = (255u * 65536u + i - 1) / i;
+        vc_hsv_hue_recip[i] = (255u * 65536u + 6 * i - 1) / (6 * i);
+    }
+    vc_hsv_tables_ready = 1;
+}
+
+// Mximo/mnimo sem saltos (a mscara  0 ou ~0)
+#define VC_MAX_BRANCHLESS(a, b) ((a) ^ (((a) ^ (b)) & -((a) < (b))))
+#define VC_MIN_BRANCHLESS(a, b) ((a) ^ (((a) ^ (b)) & -((a) > (b))))
+
+// Converte n pixels RGB em trs planos H, S e V (escala [0, 255], como vc_rgb_to_hsv)
+static void vc_rgb_to_hsv_planar_c(unsigned char *src, unsigned char *h, unsigned char *s, unsigned char *v, int n) {
+    int x, r, g, b, mx, mn, d, num, mr, mg, mb;
+
+    for (x = 0; x < n; x++, src += 3) {
+        r = src[0];
+        g = src[1];
+        b = src[2];
+        mx = VC_MAX_BRANCHLESS(r, g);
+        mx = VC_MAX_BRANCHLESS(mx, b);
+        mn = VC_MIN_BRANCHLESS(r, g);
+        mn = VC_MIN_BRANCHLESS(mn, b);
+        d = mx - mn;
+
+        // Canal dominante (por esta ordem de prioridade: R, G, B)
+        mr = -(mx == r);
+        mg = -(mx == g) & ~mr;
+        mb = ~(mr | mg);
+
+        // Numerador do hue em sextos de volta: R -> 0d + (g-b), G -> 2d + (b-r), B -> 4d + (r-g)
+        num = ((g - b) & mr) | ((b - r) & mg) | ((r - g) & mb);
+        num += ((2 * d) & mg) | ((4 * d) & mb) | ((6 * d) & mr & -(num < 0));
+
+        h[x] = (unsigned char) (((unsigned int) num * vc_hsv_hue_recip[d]) >> 16);
+        s[x] = (unsigned char) (((unsigned int) d * vc_hsv_sat_recip[mx]) >> 16);
+        v[x] = (unsigned char) mx;
+    }
+}
+
+// Cinzentos -> RGB por tabela. Cada entrada de lut tem os 3 bytes RGB (e um byte livre) numa palavra,
+// pelo que cada pixel custa uma leitura da tabela e uma escrita de 4 bytes, que o pixel seguinte sobrepe
+static void vc_gray_to_color_row_c(unsigned char *src, unsigned char *dst, int width, unsigned int *lut) {
+    int x;
+
+    if (width <= 0) return;
+    for (x = 0; x < width - 1; x++) memcpy(dst + x * 3, &lut[src[x]], 4);
+    memcpy(dst + x * 3, &lut[src[x]], 3);
+}
+
+#ifdef VC_SIMD_X86
+
+// Separa 16 pixels RGB (48 bytes) nos planos R, G e B
+#define VC_DEINTERLEAVE_RGB16(p, r, g, b) do { \
+    __m128i a_ = _mm_loadu_si128((__m128i *) (p)); \
+    __m128i b_ = _mm_loadu_si128((__m128i *) ((p) + 16)); \
+    __m128i c_ = _mm_loadu_si128((__m128i *) ((p) + 32)); \
+    (r) = _mm_or_si128(_mm_or_si128( \
+          _mm_shuffle_epi8(a_, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)), \
+          _mm_shuffle_epi8(b_, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))), \
+          _mm_shuffle_epi8(c_, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13))); \
+    (g) = _mm_or_si128(_mm_or_si128( \
+          _mm_shuffle_epi8(a_, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)), \
+          _mm_shuffle_epi8(b_, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))), \
+          _mm_shuffle_epi8(c_, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14))); \
+    (b) = _mm_or_si128(_mm_or_si128( \
+          _mm_shuffle_epi8(a_, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)), \
+          _mm_shuffle_epi8(b_, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))), \
+          _mm_shuffle_epi8(c_, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15))); \
+} while (0)
+
+__attribute__((target("ssse3")))
+static void vc_rgb_to_gray_row_ssse3(unsigned char *src, unsigned char *dst, int width) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i wrg = _mm_set1_epi32((VC_GRAY_WG << 16) | VC_GRAY_WR);
+    const __m128i wb = _mm_set1_epi32(VC_GRAY_WB);
+    __m128i r, g, b, r16, g16, b16, s0, s1, s2, s3;
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16, src += 48) {
+        VC_DEINTERLEAVE_RGB16(src, r, g, b);
+
+        // r*WR + g*WG (pares de 16 bits) + b*WB, acumulado em 32 bits
+        r16 = _mm_unpacklo_epi8(r, zero);
+        g16 = _mm_unpacklo_epi8(g, zero);
+        b16 = _mm_unpacklo_epi8(b, zero);
+        s0 = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r16, g16), wrg), _mm_madd_epi16(_mm_unpacklo_epi16(b16, zero), wb));
+        s1 = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r16, g16), wrg), _mm_madd_epi16(_mm_unpackhi_epi16(b16, zero), wb));
+        r16 = _mm_unpackhi_epi8(r, zero);
+        g16 = _mm_unpackhi_epi8(g, zero);
+        b16 = _mm_unpackhi_epi8(b, zero);
+        s2 = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r16, g16), wrg), _mm_madd_epi16(_mm_unpacklo_epi16(b16, zero), wb));
+        s3 = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r16, g16), wrg), _mm_madd_epi16(_mm_unpackhi_epi16(b16, zero), wb));
+
+        s0 = _mm_packs_epi32(_mm_srli_epi32(s0, VC_GRAY_SHIFT), _mm_srli_epi32(s1, VC_GRAY_SHIFT));
+        s2 = _mm_packs_epi32(_mm_srli_epi32(s2, VC_GRAY_SHIFT), _mm_srli_epi32(s3, VC_GRAY_SHIFT));
+        _mm_storeu_si128((__m128i *) (dst + x), _mm_packus_epi16(s0, s2));
+    }
+
+    vc_rgb_to_gray_row_c(src, dst + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void vc_rgb_to_gray_row_avx2(unsigned char *src, unsigned char *dst, int width) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i wrg = _mm256_set1_epi32((VC_GRAY_WG << 16) | VC_GRAY_WR);
+    const __m256i wb = _mm256_set1_epi32(VC_GRAY_WB);
+    __m128i r0, g0, b0, r1, g1, b1;
+    __m256i r, g, b, r16, g16, b16, s0, s1, s2, s3;
+    int x;
+
+    for (x = 0; x + 32 <= width; x += 32, src += 96) {
+        // Cada metade de 128 bits recebe 16 pixels; os unpack/pack seguintes so por metade
+        VC_DEINTERLEAVE_RGB16(src, r0, g0, b0);
+        VC_DEINTERLEAVE_RGB16(src + 48, r1, g1, b1);
+        r = _mm256_set_m128i(r1, r0);
+        g = _mm256_set_m128i(g1, g0);
+        b = _mm256_set_m128i(b1, b0);
+
+        r16 = _mm256_unpacklo_epi8(r, zero);
+        g16 = _mm256_unpacklo_epi8(g, zero);
+        b16 = _mm256_unpacklo_epi8(b, zero);
+        s0 = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(r16, g16), wrg), _mm256_madd_epi16(_mm256_unpacklo_epi16(b16, zero), wb));
+        s1 = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(r16, g16), wrg), _mm256_madd_epi16(_mm256_unpackhi_epi16(b16, zero), wb));
+        r16 = _mm256_unpackhi_epi8(r, zero);
+        g16 = _mm256_unpackhi_epi8(g, zero);
+        b16 = _mm256_unpackhi_epi8(b, zero);
+        s2 = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(r16, g16), wrg), _mm256_madd_epi16(_mm256_unpacklo_epi16(b16, zero), wb));
+        s3 = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(r16, g16), wrg), _mm256_madd_epi16(_mm256_unpackhi_epi16(b16, zero), wb));
+
+        s0 = _mm256_packs_epi32(_mm256_srli_epi32(s0, VC_GRAY_SHIFT), _mm256_srli_epi32(s1, VC_GRAY_SHIFT));
+        s2 = _mm256_packs_epi32(_mm256_srli_epi32(s2, VC_GRAY_SHIFT), _mm256_srli_epi32(s3, VC_GRAY_SHIFT));
+        _mm256_storeu_si256((__m256i *) (dst + x), _mm256_packus_epi16(s0, s2));
+    }
+
+    vc_rgb_to_gray_row_c(src, dst + x, width - x);
+}
+
+// x > t  <=>  saturate(x - t) != 0
+__attribute__((target("sse2")))
+static void vc_gray_to_binary_row_sse2(unsigned char *src, unsigned char *dst, int width, int threshold) {
+    const __m128i t = _mm_set1_epi8((char) threshold);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi8(-1);
+    __m128i v;
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        v = _mm_loadu_si128((__m128i *) (src + x));
+        v = _mm_xor_si128(_mm_cmpeq_epi8(_mm_subs_epu8(v, t), zero), ones);
+        _mm_storeu_si128((__m128i *) (dst + x), v);
+    }
+
+    vc_gray_to_binary_row_c(src + x, dst + x, width - x, threshold);
+}
+
+__attribute__((target("sse2")))
+static void vc_gray_to_binary_row_packed_sse2(unsigned char *src, unsigned char *dst, int width, int threshold) {
+    const __m128i t = _mm_set1_epi8((char) threshold);
+    const __m128i zero = _mm_setzero_si128();
+    int x, m;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(_mm_loadu_si128((__m128i *) (src + x)), t), zero));
+        *dst++ = vc_bit_reverse[m & 0xFF];
+        *dst++ = vc_bit_reverse[m >> 8];
+    }
+
+    vc_gray_to_binary_row_packed_c(src + x, dst, width - x, threshold);
+}
+
+__attribute__((target("avx2")))
+static void vc_gray_to_binary_row_avx2(unsigned char *src, unsigned char *dst, int width, int threshold) {
+    const __m256i t = _mm256_set1_epi8((char) threshold);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi8(-1);
+    __m256i v;
+    int x;
+
+    for (x = 0; x + 32 <= width; x += 32) {
+        v = _mm256_loadu_si256((__m256i *) (src + x));
+        v = _mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_subs_epu8(v, t), zero), ones);
+        _mm256_storeu_si256((__m256i *) (dst + x), v);
+    }
+
+    vc_gray_to_binary_row_c(src + x, dst + x, width - x, threshold);
+}
+
+// Verso AVX2 de vc_gray_to_color_row_c: gather de 8 entradas da tabela e compactao
+// das palavras RGBx em 24 bytes RGB, com duas escritas de 16 bytes sobrepostas
+__attribute__((target("avx2")))
+static void vc_gray_to_color_row_avx2(unsigned char *src, unsigned char *dst, int width, unsigned int *lut) {
+    const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                          0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    __m256i idx, rgb;
+    int x;
+
+    // A segunda escrita vai at ao byte 28 de 24: os ltimos pixels ficam para a verso escalar
+    for (x = 0; x + 10 <= width; x += 8) {
+        idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) (src + x)));
+        rgb = _mm256_shuffle_epi8(_mm256_i32gather_epi32((const int *) lut, idx, 4), pack);
+        _mm_storeu_si128((__m128i *) (dst + x * 3), _mm256_castsi256_si128(rgb));
+        _mm_storeu_si128((__m128i *) (dst + x * 3 + 12), _mm256_extracti128_si256(rgb, 1));
+    }
+
+    vc_gray_to_color_row_c(src + x, dst + x * 3, width - x, lut);
+}
+
+// Verso AVX2 de vc_rgb_to_hsv_planar_c: mnimos/mximos e mscaras em 16 bits,
+// recprocos obtidos com gather de 32 bits (8 pixels de cada vez)
+__attribute__((target("avx2")))
+static void vc_rgb_to_hsv_planar_avx2(unsigned char *src, unsigned char *h, unsigned char *s, unsigned char *v, int n) {
+    const __m256i ones = _mm256_set1_epi16(-1);
+    const __m256i zero = _mm256_setzero_si256();
+    __m128i r8, g8, b8, mx8, mn8;
+    __m256i r, g, b, mx, d, mr, mg, mb, num, neg, lo, hi;
+    int x;
+
+    for (x = 0; x + 16 <= n; x += 16, src += 48) {
+        VC_DEINTERLEAVE_RGB16(src, r8, g8, b8);
+        mx8 = _mm_max_epu8(_mm_max_epu8(r8, g8), b8);
+        mn8 = _mm_min_epu8(_mm_min_epu8(r8, g8), b8);
+        _mm_storeu_si128((__m128i *) (v + x), mx8);
+
+        r = _mm256_cvtepu8_epi16(r8);
+        g = _mm256_cvtepu8_epi16(g8);
+        b = _mm256_cvtepu8_epi16(b8);
+        mx = _mm256_cvtepu8_epi16(mx8);
+        d = _mm256_sub_epi16(mx, _mm256_cvtepu8_epi16(mn8));
+
+        mr = _mm256_cmpeq_epi16(mx, r);
+        mg = _mm256_andnot_si256(mr, _mm256_cmpeq_epi16(mx, g));
+        mb = _mm256_xor_si256(_mm256_or_si256(mr, mg), ones);
+
+        num = _mm256_or_si256(_mm256_or_si256(
+              _mm256_and_si256(_mm256_sub_epi16(g, b), mr),
+              _mm256_and_si256(_mm256_sub_epi16(b, r), mg)),
+              _mm256_and_si256(_mm256_sub_epi16(r, g), mb));
+        neg = _mm256_and_si256(_mm256_cmpgt_epi16(zero, num), mr);
+        num = _mm256_add_epi16(num, _mm256_and_si256(_mm256_slli_epi16(d, 1), mg));
+        num = _mm256_add_epi16(num, _mm256_and_si256(_mm256_slli_epi16(d, 2), mb));
+        num = _mm256_add_epi16(num, _mm256_and_si256(_mm256_mullo_epi16(d, _mm256_set1_epi16(6)), neg));
+
+        // H = (num * recip[d]) >> 16
+        lo = _mm256_mullo_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(num)),
+                                _mm256_i32gather_epi32((const int *) vc_hsv_hue_recip, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(d)), 4));
+        hi = _mm256_mullo_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(num, 1)),
+                                _mm256_i32gather_epi32((const int *) vc_hsv_hue_recip, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(d, 1)), 4));
+        lo = _mm256_permute4x64_epi64(_mm256_packus_epi32(_mm256_srli_epi32(lo, 16), _mm256_srli_epi32(hi, 16)), 0xD8);
+        _mm_storeu_si128((__m128i *) (h + x), _mm_packus_epi16(_mm256_castsi256_si128(lo), _mm256_extracti128_si256(lo, 1)));
+
+        // S = (d * recip[max]) >> 16
+        lo = _mm256_mullo_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(d)),
+                                _mm256_i32gather_epi32((const int *) vc_hsv_sat_recip, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(mx)), 4));
+        hi = _mm256_mullo_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(d, 1)),
+                                _mm256_i32gather_epi32((const int *) vc_hsv_sat_recip, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(mx, 1)), 4));
+        lo = _mm256_permute4x64_epi64(_mm256_packus_epi32(_mm256_srli_epi32(lo, 16), _mm256_srli_epi32(hi, 16)), 0xD8);
+        _mm_storeu_si128((__m128i *) (s + x), _mm_packus_epi16(_mm256_castsi256_si128(lo), _mm256_extracti128_si256(lo, 1)));
+    }
+
+    vc_rgb_to_hsv_planar_c(src, h + x, s + x, v + x, n - x);
+}
+
+#endif
+
+
+static int vc_simd_detect(void) {
+#ifdef VC_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return VC_SIMD_AVX2;
+    if (__builtin_cpu_supports("ssse3")) return VC_SIMD_SSSE3;
+    if (__builtin_cpu_supports("sse2")) return VC_SIMD_SSE2;
+#endif
+    return VC_SIMD_NONE;
+}
+
+
+// Nvel de SIMD em uso (deteo na primeira chamada)
+int vc_get_simd_level(void) {
+    if (vc_simd_level < 0) vc_simd_level = vc_simd_detect();
+
+    return vc_simd_level;
+}
+
+
+// Limita o nvel de SIMD (ex.: VC_SIMD_NONE para forar os kernels escalares de referncia).
+// Devolve o nvel efetivamente usado, que nunca excede o suportado pelo CPU.
+int vc_set_simd_level(int level) {
+    int supported = vc_simd_detect();
+
+    if (level < VC_SIMD_NONE) level = VC_SIMD_NONE;
+    vc_simd_level = (level < supported) ? level : supported;
+
+    return vc_simd_level;
+}
+
+
+static void vc_rgb_to_gray_row(unsigned char *src, unsigned char *dst, int width) {
+#ifdef VC_SIMD_X86
+    int level = vc_get_simd_level();
+
+    if (level >= VC_SIMD_AVX2) { vc_rgb_to_gray_row_avx2(src, dst, width); return; }
+    if (level >= VC_SIMD_SSSE3) { vc_rgb_to_gray_row_ssse3(src, dst, width); return; }
+#endif
+    vc_rgb_to_gray_row_c(src, dst, width);
+}
+
+
+static void vc_gray_to_binary_row(unsigned char *src, unsigned char *dst, int width, int threshold) {
+    // Limiares fora de [0, 254] do uma linha constante
+    if (threshold < 0) { memset(dst, 255, width); return; }
+    if (threshold > 254) { memset(dst, 0, width); return; }
+
+#ifdef VC_SIMD_X86
+    {
+        int level = vc_get_simd_level();
+
+        if (level >= VC_SIMD_AVX2) { vc_gray_to_binary_row_avx2(src, dst, width, threshold); return; }
+        if (level >= VC_SIMD_SSE2) { vc_gray_to_binary_row_sse2(src, dst, width, threshold); return; }
+    }
+#endif
+    vc_gray_to_binary_row_c(src, dst, width, threshold);
+}
+
+
+static void vc_gray_to_binary_row_packed(unsigned char *src, unsigned char *dst, int width, int threshold) {
+    vc_pbm_tables_init();
+
+    // Limiares fora de [0, 254] do uma linha constante
+    if (threshold < 0) { memset(dst, 0, (width + 7) / 8); return; }
+    if (threshold > 254) { threshold = 255; }
+
+#ifdef VC_SIMD_X86
+    if ((threshold < 255) && (vc_get_simd_level() >= VC_SIMD_SSE2)) { vc_gray_to_binary_row_packed_sse2(src, dst, width, threshold); return; }
+#endif
+    vc_gray_to_binary_row_packed_c(src, dst, width, threshold);
+}
+
+
+static void vc_rgb_to_hsv_planar(unsigned char *src, unsigned char *h, unsigned char *s, unsigned char *v, int n) {
+#ifdef VC_SIMD_X86
+    if (vc_get_simd_level() >= VC_SIMD_AVX2) { vc_rgb_to_hsv_planar_avx2(src, h, s, v, n); return; }
+#endif
+    vc_rgb_to_hsv_planar_c(src, h, s, v, n);
+}
+
+
+static void vc_gray_to_color_row(unsigned char *src, unsigned char *dst, int width, unsigned int *lut) {
+#ifdef VC_SIMD_X86
+    if (vc_get_simd_level() >= VC_SIMD_AVX2) { vc_gray_to_color_row_avx2(src, dst, width, lut); return; }
+#endif
+    vc_gray_to_color_row_c(src, dst, width, lut);
+}
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    FUNES: ADICIONADAS
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Contexto comum aos operadores executados por bandas de linhas
+typedef struct {
+    IVC *src;
+    IVC *dst;
+    int threshold;
+    int kernel;
+    int error;
+} VC_OP_CTX;
+
+static void vc_rgb_to_gray_rows(IVC *image, VC_BAND *band, void *ctx) {
+    IVC *src = ((VC_OP_CTX *) ctx)->src;
+    IVC *dst = ((VC_OP_CTX *) ctx)->dst;
+    int y;
+
+    // Kernel de linha em vrgula fixa (escalar, SSSE3 ou AVX2 conforme o CPU)
+    for (y = band->y0; y < band->y1; y++) {
+        vc_rgb_to_gray_row(src->data + y * src->bytesperline, dst->data + y * dst->bytesperline, src->width);
+    }
+}
+
+int vc_rgb_to_gray(IVC *src, IVC *dst) {
+    VC_OP_CTX ctx;
+    VC_PROFILE_OP(src, dst);
+
+    // Verificao de erros
+    if((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
+    if((src->width != dst->width) || (src->height != dst->height)) return 0;
+    if((src->channels != 3) || (dst->channels != 1)) return 0;
+
+    ctx.src = src;
+    ctx.dst = dst;
+    vc_get_simd_level();
+
+    return vc_parallel_rows(dst, vc_rgb_to_gray_rows, &ctx);
+}
+
+// Nmero de pixels convertidos de cada vez para os planos H, S e V (ficam na cache L1)
+#define VC_HSV_CHUNK 256
+
+static void vc_rgb_to_hsv_rows(IVC *image, VC_BAND *band, void *ctx) {
+    IVC *src = ((VC_OP_CTX *) ctx)->src;
+    IVC *dst = ((VC_OP_CTX *) ctx)->dst;
+    unsigned char h[VC_HSV_CHUNK], s[VC_HSV_CHUNK], v[VC_HSV_CHUNK];
+    unsigned char *datasrc, *datadst;
+    int x, y, i, n;
+
+    for (y = band->y0; y < band->y1; y++) {
+        datasrc = src->data + y * src->bytesperline;
+        datadst = dst->data + y * dst->bytesperline;
+
+        for (x = 0; x < src->width; x += n) {
+            n = (src->width - x < VC_HSV_CHUNK) ? src->width - x : VC_HSV_CHUNK;
+            vc_rgb_to_hsv_planar(datasrc + x * 3, h, s, v, n);
+
+            for (i = 0; i < n; i++, datadst += 3) {
+                datadst[0] = h[i];
+                datadst[1] = s[i];
+                datadst[2] = v[i];
+            }
+        }
+    }
+}
+
+// Converte RGB para HSV, com os trs canais na escala [0, 255]:
+// H = hue / 360 * 255, S = saturao * 255, V = max(R, G, B).
+// Usa apenas aritmtica inteira (tabelas de recprocos); difere no mximo de 1 nvel da frmula em float.
+int vc_rgb_to_hsv(IVC *src, IVC *dst) {
+    VC_OP_CTX ctx;
+    VC_PROFILE_OP(src, dst);
+
+    // Verificao de erros
+    if((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
+    if((src->width != dst->width) || (src->height != dst->height)) return 0;
+    if((src->channels != 3) || (dst->channels != 3)) return 0;
+
+    ctx.src = src;
+    ctx.dst = dst;
+    vc_hsv_tables_init();
+    vc_get_simd_level();
+
+    return vc_parallel_rows(dst, vc_rgb_to_hsv_rows, &ctx);
+}
+
+typedef struct {
+    IVC *src;
+    IVC *dst;
+    int hmin, hmax, smin, smax, vmin, vmax;
+    int error;
+} VC_HSV_SEG_CTX;
+
+static void vc_rgb_to_hsv_segmentation_rows(IVC *image, VC_BAND *band, void *ctx) {
+    VC_HSV_SEG_CTX *c = (VC_HSV_SEG_CTX *) ctx;
+    unsigned char h[VC_HSV_CHUNK], s[VC_HSV_CHUNK], v[VC_HSV_CHUNK];
+    unsigned char *datasrc, *datadst;
+    unsigned char *rowbuf = NULL, *row;
+    int wrap = c->hmin > c->hmax;
+    int x, y, i, n, inhue;
+
+    // Numa imagem empacotada cada linha  segmentada em bytes e depois convertida em bits
+    if (c->dst->packed) {
+        rowbuf = (unsigned char *) malloc(c->src->width);
+        if (rowbuf == NULL) {
+            c->error = 1;
+            return;
+        }
+    }
+
+    for (y = band->y0; y < band->y1; y++) {
+        datasrc = c->src->data + y * c->src->bytesperline;
+        datadst = c->dst->data + y * c->dst->bytesperline;
+        row = c->dst->packed ? rowbuf : datadst;
+
+        for (x = 0; x < c->src->width; x += n) {
+            n = (c->src->width - x < VC_HSV_CHUNK) ? c->src->width - x : VC_HSV_CHUNK;
+            vc_rgb_to_hsv_planar(datasrc + x * 3, h, s, v, n);
+
+            for (i = 0; i < n; i++) {
+                // Com hmin > hmax o intervalo d a volta (ex.: vermelhos, [240, 15])
+                inhue = wrap ? ((h[i] >= c->hmin) | (h[i] <= c->hmax)) : ((h[i] >= c->hmin) & (h[i] <= c->hmax));
+                row[x + i] = (inhue & (s[i] >= c->smin) & (s[i] <= c->smax) & (v[i] >= c->vmin) & (v[i] <= c->vmax)) ? 255 : 0;
+            }
+        }
+
+        if (c->dst->packed) vc_pbm_pack_row(row, datadst, c->src->width);
+    }
+
+    free(rowbuf);
+}
+
+// Converte RGB para HSV e segmenta no mesmo passo, sem criar a imagem HSV intermdia.
+// Os limites esto na mesma escala [0, 255] de vc_rgb_to_hsv. dst  uma imagem de 1 canal:
+// 255 para os pixels dentro dos trs intervalos, 0 para os restantes (pode ser empacotada).
+int vc_rgb_to_hsv_segmentation(IVC *src, IVC *dst, int hmin, int hmax, int smin, int smax, int vmin, int vmax) {
+    VC_HSV_SEG_CTX ctx;
+    VC_PROFILE_OP(src, dst);
+
+    // Verificao de erros
+    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
+    if ((src->width != dst->width) || (src->height != dst->height)) return 0;
+    if ((src->channels != 3) || (dst->channels != 1)) return 0;
+
+    ctx.src = src;
+    ctx.dst = dst;
+    ctx.hmin = hmin;
+    ctx.hmax = hmax;
+    ctx.smin = smin;
+    ctx.smax = smax;
+    ctx.vmin = vmin;
+    ctx.vmax = vmax;
+    ctx.error = 0;
+    vc_hsv_tables_init();
+    vc_pbm_tables_init();
+    vc_get_simd_level();
+
+    if (!vc_parallel_rows(dst, vc_rgb_to_hsv_segmentation_rows, &ctx)) return 0;
+
+    return !ctx.error;
+}
+
+// Pontos de controlo dos mapas de cores (nvel, R, G, B), interpolados linearmente entre si
+static const unsigned char vc_colormap_ironbow_points[][4] = {
+    { 0, 0, 0, 0 }, { 40, 30, 0, 120 }, { 90, 140, 0, 160 }, { 140, 220, 40, 70 },
+    { 190, 250, 130, 0 }, { 230, 255, 210, 30 }, { 255, 255, 255, 255 }
+};
+static const unsigned char vc_colormap_rainbow_points[][4] = {
+    { 0, 143, 0, 255 }, { 42, 0, 0, 255 }, { 85, 0, 255, 255 }, { 128, 0, 255, 0 },
+    { 170, 255, 255, 0 }, { 212, 255, 128, 0 }, { 255, 255, 0, 0 }
+};
+static const unsigned char vc_colormap_grayscale_points[][4] = {
+    { 0, 0, 0, 0 }, { 255, 255, 255, 255 }
+};
+
+static void vc_colormap_interpolate(const unsigned char (*points)[4], int npoints, unsigned char *lut) {
+    int i, v, c, span;
+
+    for (i = 0; i + 1 < npoints; i++) {
+        span = points[i + 1][0] - points[i][0];
+        for (v = points[i][0]; v <= points[i + 1][0]; v++) {
+            for (c = 0; c < 3; c++) {
+                lut[v * 3 + c] = (unsigned char) ((points[i][c + 1] * (span - (v - points[i][0])) +
+                                                   points[i + 1][c + 1] * (v - points[i][0]) + span / 2) / span);
+            }
+        }
+    }
+}
+
+// Preenche lut (256 x 3 bytes, RGB por nvel de cinzento) com um dos mapas de cores VC_COLORMAP_*
+int vc_colormap(int colormap, unsigned char *lut) {
+    int v;
+
+    // Verificao de erros
+    if (lut == NULL) return 0;
+
+    switch (colormap) {
+        case VC_COLORMAP_DEFAULT:
+            // Azul -> ciano -> verde -> amarelo -> vermelho, por troos de 64 nveis
+            for (v = 0; v < 256; v++) {
+                if (v < 64) {
+                    lut[v * 3] = 0;
+                    lut[v * 3 + 1] = (unsigned char) (v * 4);
+                    lut[v * 3 + 2] = 255;
+                } else if (v < 128) {
+                    lut[v * 3] = 0;
+                    lut[v * 3 + 1] = 255;
+                    lut[v * 3 + 2] = (unsigned char) (255 - (v - 64) * 4);
+                } else if (v < 192) {
+                    lut[v * 3] = (unsigned char) (255 - (v - 128) * 4);
+                    lut[v * 3 + 1] = 255;
+                    lut[v * 3 + 2] = 0;
+                } else {
+                    lut[v * 3] = 255;
+                    lut[v * 3 + 1] = (unsigned char) (255 - (v - 192) * 4);
+                    lut[v * 3 + 2] = 0;
+                }
+            }
+            return 1;
+        case VC_COLORMAP_IRONBOW:
+            vc_colormap_interpolate(vc_colormap_ironbow_points, 7, lut);
+            return 1;
+        case VC_COLORMAP_RAINBOW:
+            vc_colormap_interpolate(vc_colormap_rainbow_points, 7, lut);
+            return 1;
+        case VC_COLORMAP_GRAYSCALE:
+            vc_colormap_interpolate(vc_colormap_grayscale_points, 2, lut);
+            return 1;
+    }
+
+    return 0;
+}
+
+// Converte a tabela RGB (256 x 3 bytes) para palavras de 4 bytes, uma por nvel
+static void vc_color_lut_words(unsigned char *lut, unsigned int *words) {
+    unsigned char entry[4] = { 0, 0, 0, 0 };
+    int v;
+
+    for (v = 0; v < 256; v++) {
+        memcpy(entry, lut + v * 3, 3);
+        memcpy(&words[v], entry, 4);
+    }
+}
+
+typedef struct {
+    IVC *src;
+    IVC *dst;
+    unsigned int lut[256];
+} VC_COLOR_CTX;
+
+static void vc_gray_to_color_rows(IVC *image, VC_BAND *band, void *ctx) {
+    VC_COLOR_CTX *c = (VC_COLOR_CTX *) ctx;
+    int y;
+
+    for (y = band->y0; y < band->y1; y++) {
+        vc_gray_to_color_row(c->src->data + y * c->src->bytesperline, c->dst->data + y * c->dst->bytesperline, c->src->width, c->lut);
+    }
+}
+
+// Converte uma imagem em cinzentos para RGB com uma paleta qualquer (lut: 256 x 3 bytes)
+int vc_gray_to_color_lut(IVC *src, IVC *dst, unsigned char *lut) {
+    VC_COLOR_CTX ctx;
+    VC_PROFILE_OP(src, dst);
+
+    // Verificao de erros
+    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL) || (lut == NULL)) return 0;
+    if ((src->width != dst->width) || (src->height != dst->height)) return 0;
+    if ((src->channels != 1) || (dst->channels != 3) || src->packed) return 0;
+
+    ctx.src = src;
+    ctx.dst = dst;
+    vc_color_lut_words(lut, ctx.lut);
+    vc_get_simd_level();
+
+    return vc_parallel_rows(dst, vc_gray_to_color_rows, &ctx);
+}
+
+int vc_gray_to_colormap(IVC *src, IVC *dst, int colormap) {
+    unsigned char lut[256 * 3];
+
+    if (!vc_colormap(colormap, lut)) return 0;
+
+    return vc_gray_to_color_lut(src, dst, lut);
+}
+
+int vc_scale_gray_to_color_palette(IVC *src, IVC *dst) {
+    return vc_gray_to_colormap(src, dst, VC_COLORMAP_DEFAULT);
+}
+
+static void vc_gray_to_binary_rows(IVC *image, VC_BAND *band, void *ctx) {
+    IVC *src = ((VC_OP_CTX *) ctx)->src;
+    IVC *dst = ((VC_OP_CTX *) ctx)->dst;
+    int threshold = ((VC_OP_CTX *) ctx)->threshold;
+    int y;
+
+    // Pixel acima do threshold fica branco (255), no ou abaixo fica preto (0)
+    for (y = band->y0; y < band->y1; y++) {
+        if (dst->packed) {
+            vc_gray_to_binary_row_packed(src->data + y * src->bytesperline, dst->data + y * dst->bytesperline, src->width, threshold);
+        } else {
+            vc_gray_to_binary_row(src->data + y * src->bytesperline, dst->data + y * dst->bytesperline, src->width, threshold);
+        }
+    }
+}
+
+int vc_gray_to_binary(IVC *src, IVC *dst, int threshold) {
+    VC_OP_CTX ctx;
+    VC_PROFILE_OP(src, dst);
+
+    // Verificao de erros
+    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
+    if ((src->width != dst->width) || (src->height != dst->height)) return 0;
+    if ((src->channels != 1) || (dst->channels != 1) || src->packed) return 0;
+
+    ctx.src = src;
+    ctx.dst = dst;
+    ctx.threshold = threshold;
+    vc_pbm_tables_init();
+    vc_get_simd_level();
+
+    return vc_parallel_rows(dst, vc_gray_to_binary_rows, &ctx);
+}
+// Nmero de bancos de contadores por histograma: pixels vizinhos com o mesmo valor
+// incrementam contadores diferentes, o que evita esperar pelo incremento anterior
+#define VC_HIST_BANKS 4
+
+typedef struct {
+    IVC *src;
+    unsigned int (*threadhist)[256];    // Um histograma por thread, somados no fim
+} VC_HIST_CTX;
+
+static void vc_gray_histogram_rows(IVC *image, VC_BAND *band, void *ctx) {
+    VC_HIST_CTX *c = (VC_HIST_CTX *) ctx;
+    IVC *src = c->src;
+    unsigned int bank[VC_HIST_BANKS][256];
+    unsigned int *hist = c->threadhist[band->thread];
+    unsigned char *data;
+    int width = src->width;
+    int x, y, i;
+
+    memset(bank, 0, sizeof(bank));
+
+    for (y = band->y0; y < band->y1; y++) {
+        data = src->data + y * src->bytesperline;
+        for (x = 0; x + VC_HIST_BANKS <= width; x += VC_HIST_BANKS) {
+            bank[0][data[x]]++;
+            bank[1][data[x + 1]]++;
+            bank[2][data[x + 2]]++;
+            bank[3][data[x + 3]]++;
+        }
+        for (; x < width; x++) bank[0][data[x]]++;
+    }
+
+    // Cada thread s escreve no seu histograma (as bandas da mesma thread correm em sequncia)
+    for (i = 0; i < 256; i++) hist[i] += bank[0][i] + bank[1][i] + bank[2][i] + bank[3][i];
+}
+
+// Calcula o histograma de uma imagem em cinzentos (hist tem 256 posies)
+int vc_gray_histogram(IVC *src, unsigned int *hist) {
+    VC_HIST_CTX ctx;
+    int nthreads = vc_get_num_threads();
+    int i, t;
+    VC_PROFILE_OP(src, NULL);
+
+    // Verificao de erros
+    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL) || (hist == NULL)) return 0;
+    if ((src->channels != 1) || src->packed) return 0;
+
+    ctx.src = src;
+    ctx.threadhist = (unsigned int (*)[256]) calloc(nthreads, sizeof(unsigned int[256]));
+    if (ctx.threadhist == NULL) return 0;
+
+    if (!vc_parallel_rows(src, vc_gray_histogram_rows, &ctx)) {
+        free(ctx.threadhist);
+        return 0;
+    }
+
+    for (i = 0; i < 256; i++) {
+        hist[i] = 0;
+        for (t = 0; t < nthreads; t++) hist[i] += ctx.threadhist[t][i];
+    }
+
+    free(ctx.threadhist);
+
+    return 1;
+}
+
+// Limiar de Otsu: maximiza a varincia entre as classes [0, T] e ]T, 255]
+int vc_histogram_otsu_threshold(unsigned int *hist) {
+    double total = 0, sum = 0, sumb = 0, wb = 0, wf, mb, mf, var, best = -1.0;
+    int i, threshold = 0;
+
+    for (i = 0; i < 256; i++) {
+        total += hist[i];
+        sum += (double) i * hist[i];
+    }
+
+    for (i = 0; i < 256; i++) {
+        wb += hist[i];
+        if (wb == 0) continue;
+        wf = total - wb;
+        if (wf == 0) break;
+
+        sumb += (double) i * hist[i];
+        mb = sumb / wb;
+        mf = (sum - sumb) / wf;
+        var = wb * wf * (mb - mf) * (mb - mf);
+        if (var > best) {
+            best = var;
+            threshold = i;
+        }
+    }
+
+    return threshold;
+}
+
+// Limiar tal que pelo menos percentile % dos pixels ficam no ou abaixo dele (pretos)
+int vc_histogram_percentile_threshold(unsigned int *hist, float percentile) {
+    double total = 0, target, count = 0;
+    int i;
+
+    if (percentile < 0.0f) percentile = 0.0f;
+    if (percentile > 100.0f) percentile = 100.0f;
+
+    for (i = 0; i < 256; i++) total += hist[i];
+    target = total * percentile / 100.0;
+
+    for (i = 0; i < 255; i++) {
+        count += hist[i];
+        if ((count >= target) && (count > 0)) break;
+    }
+
+    return i;
+}
+
+// Mdia das intensidades (parte inteira: "pixel > mdia" equivale a "pixel > T")
+int vc_histogram_mean_threshold(unsigned int *hist) {
+    unsigned long long total = 0, sum = 0;
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        total += hist[i];
+        sum += (unsigned long long) i * hist[i];
+    }
+
+    return (total > 0) ? (int) (sum / total) : 0;
+}
+
+// Uma passagem para o histograma e outra para aplicar o limiar; src nunca  alterada
+// (dst pode ser a prpria src)
+int vc_gray_to_binary_mean_threshold(IVC *src, IVC *dst) {
+    unsigned int hist[256];
+    VC_PROFILE_OP(src, dst);
+
+    if (!vc_gray_histogram(src, hist)) return 0;
+
+    return vc_gray_to_binary(src, dst, vc_histogram_mean_threshold(hist));
+}
+
+int vc_gray_to_binary_otsu_threshold(IVC *src, IVC *dst) {
+    unsigned int hist[256];
+    VC_PROFILE_OP(src, dst);
+
+    if (!vc_gray_histogram(src, hist)) return 0;
+
+    return vc_gray_to_binary(src, dst, vc_histogram_otsu_threshold(hist));
+}
+
+int vc_gray_to_binary_percentile_threshold(IVC *src, IVC *dst, float percentile) {
+    unsigned int hist[256];
+    VC_PROFILE_OP(src, dst);
+
+    if (!vc_gray_histogram(src, hist)) return 0;
+
+    return vc_gray_to_binary(src, dst, vc_histogram_percentile_threshold(hist, percentile));
+}
+
+// Mnimo e mximo de uma janela deslizante 1D (algoritmo de van Herk/Gil-Werman).
+// A linha "pad" j vem com r posies replicadas de cada lado, o que d
+// o mesmo resultado que recortar a janela aos limites da imagem.
+// hmin e hmax so buffers de trabalho com 2r+1 posies.
+static void vc_window_minmax_line(unsigned char *pad, int n, int r,
+                                  unsigned char *outmin, unsigned char *outmax,
+                                  unsigned char *hmin, unsigned char *hmax) {
+    int w = 2 * r + 1;
+    int s, k;
+    unsigned char gmin = 0, gmax = 0, v;
+
+    for (s = 0; s < n; s += w) {
+        // Sufixos do bloco [s, s+w-1]
+        hmin[w - 1] = hmax[w - 1] = pad[s + w - 1];
+        for (k = w - 2; k >= 0; k--) {
+            v = pad[s + k];
+            hmin[k] = (v < hmin[k + 1]) ? v : hmin[k + 1];
+            hmax[k] = (v > hmax[k + 1]) ? v : hmax[k + 1];
+        }
+
+        outmin[s] = hmin[0];
+        outmax[s] = hmax[0];
+
+        // Prefixos do bloco seguinte, combinados com os sufixos
+        for (k = 1; (k < w) && (s + k < n); k++) {
+            v = pad[s + w + k - 1];
+            if (k == 1) {
+                gmin = gmax = v;
+            } else {
+                if (v < gmin) gmin = v;
+                if (v > gmax) gmax = v;
+            }
+            outmin[s + k] = (hmin[k] < gmin) ? hmin[k] : gmin;
+            outmax[s + k] = (hmax[k] > gmax) ? hmax[k] : gmax;
+        }
+    }
+}
+
+// Mesmo algoritmo na vertical, aplicado a linhas inteiras de uma s vez.
+// rowmin[j]/rowmax[j] apontam para a linha j (com margem de r linhas replicadas).
+static void vc_window_minmax_columns(unsigned char **rowmin, unsigned char **rowmax, int n, int width, int r,
+                                     unsigned char **outmin, unsigned char **outmax,
+                                     unsigned char *hmin, unsigned char *hmax,
+                                     unsigned char *gmin, unsigned char *gmax) {
+    int w = 2 * r + 1;
+    int s, k, x;
+    unsigned char *hmin_k, *hmax_k, *hmin_n, *hmax_n, *pmin, *pmax, *omin, *omax;
+
+    for (s = 0; s < n; s += w) {
+        // Sufixos do bloco [s, s+w-1]
+        memcpy(hmin + (w - 1) * width, rowmin[s + w - 1], width);
+        memcpy(hmax + (w - 1) * width, rowmax[s + w - 1], width);
+        for (k = w - 2; k >= 0; k--) {
+            hmin_k = hmin + k * width;
+            hmax_k = hmax + k * width;
+            hmin_n = hmin_k + width;
+            hmax_n = hmax_k + width;
+            pmin = rowmin[s + k];
+            pmax = rowmax[s + k];
+            for (x = 0; x < width; x++) {
+                hmin_k[x] = (pmin[x] < hmin_n[x]) ? pmin[x] : hmin_n[x];
+                hmax_k[x] = (pmax[x] > hmax_n[x]) ? pmax[x] : hmax_n[x];
+            }
+        }
+
+        if (outmin[s] != NULL) memcpy(outmin[s], hmin, width);
+        if (outmax[s] != NULL) memcpy(outmax[s], hmax, width);
+
+        // Prefixos do bloco seguinte, combinados com os sufixos
+        for (k = 1; (k < w) && (s + k < n); k++) {
+            pmin = rowmin[s + w + k - 1];
+            pmax = rowmax[s + w + k - 1];
+            if (k == 1) {
+                memcpy(gmin, pmin, width);
+                memcpy(gmax, pmax, width);
+            } else {
+                for (x = 0; x < width; x++) {
+                    if (pmin[x] < gmin[x]) gmin[x] = pmin[x];
+                    if (pmax[x] > gmax[x]) gmax[x] = pmax[x];
+                }
+            }
+
+            hmin_k = hmin + k * width;
+            hmax_k = hmax + k * width;
+            omin = outmin[s + k];
+            omax = outmax[s + k];
+            if (omin != NULL) {
+                for (x = 0; x < width; x++) omin[x] = (hmin_k[x] < gmin[x]) ? hmin_k[x] : gmin[x];
+            }
+            if (omax != NULL) {
+                for (x = 0; x < width; x++) omax[x] = (hmax_k[x] > gmax[x]) ? hmax_k[x] : gmax[x];
+            }
+        }
+    }
+}
+
+// Calcula o mnimo e o mximo da janela (2rx+1)x(2ry+1) para o retngulo [x0, x1) x [y0, y1) de src.
+// outmin[i]/outmax[i] apontam para a linha de sada y0+i, com x1-x0 pixels (ou NULL se no for pedida).
+// S so lidos os pixels [x0-rx, x1+rx) x [y0-ry, y1+ry) da imagem (o halo do tile);
+// fora da imagem a janela  recortada (o que equivale a replicar os pixels da margem).
+static int vc_window_minmax_tile(IVC *src, int rx, int ry, int x0, int x1, int y0, int y1, unsigned char **outmin, unsigned char **outmax) {
+    int width = x1 - x0;
+    int height = src->height;
+    int lx0 = (x0 - rx < 0) ? 0 : x0 - rx;
+    int lx1 = (x1 + rx > src->width) ? src->width : x1 + rx;
+    int wx = 2 * rx + 1;
+    int wy = 2 * ry + 1;
+    int n = y1 - y0;
+    int hy0 = (y0 - ry < 0) ? 0 : y0 - ry;
+    int hy1 = (y1 + ry > height) ? height : y1 + ry;
+    int y, j, ok = 0;
+    size_t hsize = ((size_t) wy * width > (size_t) wx) ? (size_t) wy * width : (size_t) wx;
+    unsigned char *tmpmin = NULL, *tmpmax = NULL, *pad = NULL;
+    unsigned char *hmin = NULL, *hmax = NULL, *gmin = NULL, *gmax = NULL;
+    unsigned char **rowmin = NULL, **rowmax = NULL;
+    unsigned char *line;
+
+    tmpmin = (unsigned char *) malloc(width * (hy1 - hy0));
+    tmpmax = (unsigned char *) malloc(width * (hy1 - hy0));
+    pad = (unsigned char *) malloc(width + 2 * rx);
+    hmin = (unsigned char *) malloc(hsize);
+    hmax = (unsigned char *) malloc(hsize);
+    gmin = (unsigned char *) malloc(width);
+    gmax = (unsigned char *) malloc(width);
+    rowmin = (unsigned char **) malloc((n + 2 * ry) * sizeof(unsigned char *));
+    rowmax = (unsigned char **) malloc((n + 2 * ry) * sizeof(unsigned char *));
+    if ((tmpmin == NULL) || (tmpmax == NULL) || (pad == NULL) || (hmin == NULL) || (hmax == NULL) ||
+        (gmin == NULL) || (gmax == NULL) || (rowmin == NULL) || (rowmax == NULL)) {
+        goto cleanup;
+    }
+
+    // Passagem horizontal: cada linha do tile (com o halo)  copiada com margens replicadas
+    for (y = hy0; y < hy1; y++) {
+        line = src->data + y * src->bytesperline;
+        memset(pad, line[0], lx0 - (x0 - rx));
+        memcpy(pad + (lx0 - (x0 - rx)), line + lx0, lx1 - lx0);
+        memset(pad + (lx1 - (x0 - rx)), line[src->width - 1], (x1 + rx) - lx1);
+        vc_window_minmax_line(pad, width, rx, tmpmin + (y - hy0) * width, tmpmax + (y - hy0) * width, hmin, hmax);
+    }
+
+    // Passagem vertical: as linhas de margem apontam para a primeira/ltima linha da imagem
+    for (j = 0; j < n + 2 * ry; j++) {
+        y = y0 + j - ry;
+        if (y < 0) y = 0;
+        if (y > height - 1) y = height - 1;
+        rowmin[j] = tmpmin + (y - hy0) * width;
+        rowmax[j] = tmpmax + (y - hy0) * width;
+    }
+    vc_window_minmax_columns(rowmin, rowmax, n, width, ry, outmin, outmax, hmin, hmax, gmin, gmax);
+
+    ok = 1;
+
+cleanup:
+    free(tmpmin); free(tmpmax); free(pad);
+    free(hmin); free(hmax); free(gmin); free(gmax);
+    free(rowmin); free(rowmax);
+
+    return ok;
+}
+
+// Linhas [y0, y1) inteiras
+static int vc_window_minmax_band(IVC *src, int rx, int ry, int y0, int y1, unsigned char **outmin, unsigned char **outmax) {
+    return vc_window_minmax_tile(src, rx, ry, 0, src->width, y0, y1, outmin, outmax);
+}
+
+// Bytes de trabalho por pixel de um tile (entrada, mnimos e mximos intermdios e finais, sada)
+#define VC_MINMAX_TILE_BYTES 8
+
+typedef struct {
+    IVC *src;
+    IVC *dstmin;
+    IVC *dstmax;
+    int r;
+    int error;
+} VC_MINMAX_CTX;
+
+static void vc_gray_window_minmax_tile(IVC *image, VC_TILE *tile, void *ctx) {
+    VC_MINMAX_CTX *c = (VC_MINMAX_CTX *) ctx;
+    int n = tile->y1 - tile->y0;
+    int i;
+    unsigned char **outmin = (unsigned char **) malloc(n * sizeof(unsigned char *));
+    unsigned char **outmax = (unsigned char **) malloc(n * sizeof(unsigned char *));
+
+    if ((outmin != NULL) && (outmax != NULL)) {
+        for (i = 0; i < n; i++) {
+            outmin[i] = (c->dstmin != NULL) ? c->dstmin->data + (tile->y0 + i) * c->dstmin->bytesperline + tile->x0 : NULL;
+            outmax[i] = (c->dstmax != NULL) ? c->dstmax->data + (tile->y0 + i) * c->dstmax->bytesperline + tile->x0 : NULL;
+        }
+        if (!vc_window_minmax_tile(c->src, c->r, c->r, tile->x0, tile->x1, tile->y0, tile->y1, outmin, outmax)) c->error = 1;
+    } else {
+        c->error = 1;
+    }
+
+    free(outmin);
+    free(outmax);
+}
+
+// Calcula, para cada pixel, o mnimo e o mximo numa vizinhana kernel x kernel
+// (janela recortada aos limites da imagem). O custo por pixel no depende do kernel.
+// dstmin ou dstmax podem ser NULL se s for preciso um dos resultados.
+int vc_gray_window_minmax(IVC *src, IVC *dstmin, IVC *dstmax, int kernel) {
+    VC_MINMAX_CTX ctx;
+    IVC *copy = NULL;
+    int ok;
+    VC_PROFILE_OP(src, dstmin);
+
+    // Verificao de erros
+    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
+    if (src->channels != 1 || src->packed || kernel < 1) return 0;
+    if ((dstmin == NULL) && (dstmax == NULL)) return 0;
+    if ((dstmin != NULL) && ((dstmin->width != src->width) || (dstmin->height != src->height) || (dstmin->channels != 1) || dstmin->packed)) return 0;
+    if ((dstmax != NULL) && ((dstmax->width != src->width) || (dstmax->height != src->height) || (dstmax->channels != 1) || dstmax->packed)) return 0;
+
+    // Cada banda (ou tile) l linhas de halo de src que as bandas vizinhas j podem ter escrito em dstmin/dstmax:
+    // se src se sobrepe a um dos destinos trabalha-se sobre uma cpia
+    if (((dstmin != NULL) && vc_image_overlaps(src, dstmin)) || ((dstmax != NULL) && vc_image_overlaps(src, dstmax))) {
+        if ((copy = vc_image_copy(src)) == NULL) return 0;
+        src = copy;
+    }
+
+    ctx.src = src;
+    ctx.dstmin = dstmin;
+    ctx.dstmax = dstmax;
+    ctx.r = kernel / 2;
+    ctx.error = 0;
+
+    ok = vc_parallel_tiles(src, ctx.r, VC_MINMAX_TILE_BYTES, vc_gray_window_minmax_tile, &ctx) && !ctx.error;
+
+    vc_image_free(copy);
+
+    return ok;
+}
+
+// Cada tile calcula o mnimo/mximo s dos seus pixels (usando o halo) e aplica logo o limiar,
+// enquanto as linhas do tile ainda esto na cache
+static void vc_gray_midpoint_threshold_tile(IVC *image, VC_TILE *tile, void *ctx) {
+    VC_OP_CTX *c = (VC_OP_CTX *) ctx;
+    IVC *src = c->src;
+    IVC *dst = c->dst;
+    int width = tile->x1 - tile->x0;
+    int n = tile->y1 - tile->y0;
+    int x, y;
+    unsigned char *bandmin = (unsigned char *) malloc(n * width);
+    unsigned char *bandmax = (unsigned char *) malloc(n * width);
+    unsigned char **outmin = (unsigned char **) malloc(n * sizeof(unsigned char *));
+    unsigned char **outmax = (unsigned char **) malloc(n * sizeof(unsigned char *));
+    unsigned char *data_src, *data_dst, *data_min, *data_max;
+    unsigned char threshold;
+
+    if ((bandmin == NULL) || (bandmax == NULL) || (outmin == NULL) || (outmax == NULL)) {
+        c->error = 1;
+        goto cleanup;
+    }
+
+    for (y = 0; y < n; y++) {
+        outmin[y] = bandmin + y * width;
+        outmax[y] = bandmax + y * width;
+    }
+    if (!vc_window_minmax_tile(src, c->kernel / 2, c->kernel / 2, tile->x0, tile->x1, tile->y0, tile->y1, outmin, outmax)) {
+        c->error = 1;
+        goto cleanup;
+    }
+
+    for (y = tile->y0; y < tile->y1; y++) {
+        data_src = src->data + y * src->bytesperline + tile->x0;
+        data_min = outmin[y - tile->y0];
+        data_max = outmax[y - tile->y0];
+        // Numa imagem empacotada a linha  calculada em bytes (reaproveita data_min) e depois convertida em bits
+        // (x0  mltiplo de 64, pelo que o tile comea num byte)
+        data_dst = dst->packed ? data_min : dst->data + y * dst->bytesperline + tile->x0;
+
+        for (x = 0; x < width; x++) {
+            // Calcula o limiar para o pixel atual e aplica o threshold
+            threshold = (data_min[x] + data_max[x]) / 2;
+            data_dst[x] = (data_src[x] > threshold) ? 0 : 255;
+        }
+
+        if (dst->packed) vc_pbm_pack_row(data_dst, dst->data + y * dst->bytesperline + tile->x0 / 8, width);
+    }
+
+cleanup:
+    free(bandmin);
+    free(bandmax);
+    free(outmin);
+    free(outmax);
+}
+
+int vc_gray_midpoint_threshold(IVC *src, IVC *dst, int kernel) {
+    VC_OP_CTX ctx;
+    IVC *copy = NULL;
+    int ok;
+    VC_PROFILE_OP(src, dst);
+
+    if (src->channels != 1 || dst->channels != 1 || src->packed) {
+#ifdef VC_DEBUG
+        printf("ERROR -> vc_gray_midpoint_threshold():\n\tBoth source and destination images must be grayscale.\n");
+#endif
+        return 0;
+    }
+    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
+    if ((src->width != dst->width) || (src->height != dst->height)) return 0;
+
+    // Um kernel de 0 corresponde a uma janela de 1 pixel
+    if (kernel < 1) kernel = 1;
+
+    // Os tiles leem pixels de halo de src: se src e dst se sobrepem trabalha-se sobre uma cpia
+    if (vc_image_overlaps(src, dst)) {
+        if ((copy = vc_image_copy(src)) == NULL) return 0;
+        src = copy;
+    }
+
+    ctx.src = src;
+    ctx.dst = dst;
+    ctx.kernel = kernel;
+    ctx.error = 0;
+    vc_pbm_tables_init();
+    vc_get_simd_level();
+
+    ok = vc_parallel_tiles(dst, kernel / 2, VC_MINMAX_TILE_BYTES, vc_gray_midpoint_threshold_tile, &ctx) && !ctx.error;
+
+    vc_image_free(copy);
+
+    return ok; // Sucesso
+}
+
+// Constri as tabelas integrais numa passagem: cada linha  a soma acumulada da linha
+// da imagem mais a linha anterior da tabela
+VC_INTEGRAL *vc_integral_new(IVC *src, int squares) {
+    VC_INTEGRAL *ii;
+    unsigned long long pixels, rowsum, rowsq;
+    size_t n;
+    unsigned char *data;
+    int x, y, stride, i, prev;
+    VC_PROFILE_OP(src, NULL);
+
+    // Verificao de erros
+    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return NULL;
+    if ((src->channels != 1) || src->packed) return NULL;
+
+    if ((ii = (VC_INTEGRAL *) calloc(1, sizeof(VC_INTEGRAL))) == NULL) return NULL;
+    ii->width = src->width;
+    ii->height = src->height;
+    ii->stride = stride = src->width + 1;
+    n = (size_t) stride * (src->height + 1);
+    pixels = (unsigned long long) src->width * src->height;
+
+    // 32 bits chegam enquanto o total da imagem couber em 32 bits
+    if (pixels * 255 <= 0xFFFFFFFFULL) ii->sum = (unsigned int *) calloc(n, sizeof(unsigned int));
+    else ii->sum64 = (unsigned long long *) calloc(n, sizeof(unsigned long long));
+    if (squares) {
+        if (pixels * 255 * 255 <= 0xFFFFFFFFULL) ii->sqsum = (unsigned int *) calloc(n, sizeof(unsigned int));
+        else ii->sqsum64 = (unsigned long long *) calloc(n, sizeof(unsigned long long));
+    }
+    if (((ii->sum == NULL) && (ii->sum64 == NULL)) || (squares && (ii->sqsum == NULL) && (ii->sqsum64 == NULL))) {
+        return vc_integral_free(ii);
+    }
+
+    for (y = 0; y < src->height; y++) {
+        data = src->data + y * src->bytesperline;
+        i = (y + 1) * stride + 1;
+        prev = y * stride + 1;
+        rowsum = rowsq = 0;
+
+        for (x = 0; x < src->width; x++, i++, prev++) {
+            rowsum += data[x];
+            rowsq += data[x] * data[x];
+            if (ii->sum != NULL) ii->sum[i] = ii->sum[prev] + (unsigned int) rowsum;
+            else ii->sum64[i] = ii->sum64[prev] + rowsum;
+            if (ii->sqsum != NULL) ii->sqsum[i] = ii->sqsum[prev] + (unsigned int) rowsq;
+            else if (ii->sqsum64 != NULL) ii->sqsum64[i] = ii->sqsum64[prev] + rowsq;
+        }
+    }
+
+    return ii;
+}
+
+VC_INTEGRAL *vc_integral_free(VC_INTEGRAL *ii) {
+    if (ii != NULL) {
+        free(ii->sum);
+        free(ii->sum64);
+        free(ii->sqsum);
+        free(ii->sqsum64);
+        free(ii);
+    }
+
+    return NULL;
+}
+
+// Soma dos pixels do retngulo [x0, x1) x [y0, y1), com 4 acessos  tabela
+unsigned long long vc_integral_sum(VC_INTEGRAL *ii, int x0, int y0, int x1, int y1) {
+    int a = y0 * ii->stride, b = y1 * ii->stride;
+
+    if (ii->sum != NULL) return (unsigned long long) (ii->sum[b + x1] - ii->sum[a + x1] - ii->sum[b + x0] + ii->sum[a + x0]);
+    return ii->sum64[b + x1] - ii->sum64[a + x1] - ii->sum64[b + x0] + ii->sum64[a + x0];
+}
+
+unsigned long long vc_integral_sqsum(VC_INTEGRAL *ii, int x0, int y0, int x1, int y1) {
+    int a = y0 * ii->stride, b = y1 * ii->stride;
+
+    if (ii->sqsum != NULL) return (unsigned long long) (ii->sqsum[b + x1] - ii->sqsum[a + x1] - ii->sqsum[b + x0] + ii->sqsum[a + x0]);
+    if (ii->sqsum64 != NULL) return ii->sqsum64[b + x1] - ii->sqsum64[a + x1] - ii->sqsum64[b + x0] + ii->sqsum64[a + x0];
+    return 0;
+}
+
+// Limiares adaptativos calculados com a imagem integral
+#define VC_ADAPTIVE_BRADLEY 0
+#define VC_ADAPTIVE_NIBLACK 1
+#define VC_ADAPTIVE_SAUVOLA 2
+#define VC_SAUVOLA_R 128.0      // Gama dinmica do desvio padro (R)
+
+typedef struct {
+    IVC *src;
+    IVC *dst;
+    VC_INTEGRAL *ii;
+    int method;
+    int kernel;
+    double k;
+    int error;
+} VC_ADAPTIVE_CTX;
+
+// d > c * sqrt(var), sem calcular a raiz quadrada
+static int vc_greater_than_scaled_sqrt(double d, double c, double var) {
+    if (c >= 0) return (d > 0) && (d * d > c * c * var);
+    if (d > 0) return 1;
+    if (d == 0) return var > 0;
+    return d * d < c * c * var;
+}
+
+static void vc_gray_adaptive_threshold_rows(IVC *image, VC_BAND *band, void *ctx) {
+    VC_ADAPTIVE_CTX *c = (VC_ADAPTIVE_CTX *) ctx;
+    IVC *src = c->src;
+    IVC *dst = c->dst;
+    VC_INTEGRAL *ii = c->ii;
+    int width = src->width;
+    int height = src->height;
+    int r = c->kernel / 2;
+    unsigned char *data_src, *data_dst;
+    unsigned char *tmp = NULL;
+    unsigned long long sum, sqsum;
+    double n, mean, var;
+    int x, y, x0, x1, y0, y1, white;
+
+    if (dst->packed && ((tmp = (unsigned char *) malloc(width)) == NULL)) {
+        c->error = 1;
+        return;
+    }
+
+    for (y = band->y0; y < band->y1; y++) {
+        data_src = src->data + y * src->bytesperline;
+        data_dst = dst->packed ? tmp : dst->data + y * dst->bytesperline;
+        // Janela de kernel x kernel centrada no pixel, recortada aos limites da imagem
+        y0 = (y - r < 0) ? 0 : y - r;
+        y1 = (y + r + 1 > height) ? height : y + r + 1;
+
+        for (x = 0; x < width; x++) {
+            x0 = (x - r < 0) ? 0 : x - r;
+            x1 = (x + r + 1 > width) ? width : x + r + 1;
+            n = (double) (x1 - x0) * (y1 - y0);
+            sum = vc_integral_sum(ii, x0, y0, x1, y1);
+
+            if (c->method == VC_ADAPTIVE_BRADLEY) {
+                // Branco se o pixel estiver acima de (1 - t) vezes a mdia da janela
+                white = (double) data_src[x] * n > (double) sum * (1.0 - c->k);
+            } else {
+                sqsum = vc_integral_sqsum(ii, x0, y0, x1, y1);
+                mean = (double) sum / n;
+                var = ((double) sqsum * n - (double) sum * sum) / (n * n);
+                if (var < 0) var = 0;
+                if (c->method == VC_ADAPTIVE_NIBLACK) {
+                    // T = m + k * s
+                    white = vc_greater_than_scaled_sqrt(data_src[x] - mean, c->k, var);
+                } else {
+                    // T = m * (1 + k * (s / R - 1)) = m * (1 - k) + (m * k / R) * s
+                    white = vc_greater_than_scaled_sqrt(data_src[x] - mean * (1.0 - c->k), mean * c->k / VC_SAUVOLA_R, var);
+                }
+            }
+            data_dst[x] = white ? 255 : 0;
+        }
+
+        if (dst->packed) vc_pbm_pack_row(data_dst, dst->data + y * dst->bytesperline, width);
+    }
+
+    free(tmp);
+}
+
+// O custo por pixel  constante (4 acessos por tabela), qualquer que seja o kernel
+static int vc_gray_adaptive_threshold(IVC *src, IVC *dst, int kernel, int method, double k) {
+    VC_ADAPTIVE_CTX ctx;
+    IVC *copy = NULL;
+
+    // Verificao de erros
+    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
+    if ((src->width != dst->width) || (src->height != dst->height)) return 0;
+    if ((src->channels != 1) || (dst->channels != 1) || src->packed) return 0;
+
+    // Um kernel de 0 corresponde a uma janela de 1 pixel
+    if (kernel < 1) kernel = 1;
+
+    // A vizinhana vem das tabelas integrais, construdas antes de qualquer escrita: cada pixel s l
+    // o prprio valor de src, pelo que src == dst  possvel. Com vistas desfasadas trabalha-se sobre uma cpia.
+    if (vc_image_overlaps(src, dst) && ((src->data != dst->data) || (src->bytesperline != dst->bytesperline) || dst->packed)) {
+        if ((copy = vc_image_copy(src)) == NULL) return 0;
+        src = copy;
+    }
+
+    ctx.ii = vc_integral_new(src, method != VC_ADAPTIVE_BRADLEY);
+    if (ctx.ii == NULL) {
+        vc_image_free(copy);
+        return 0;
+    }
+    ctx.src = src;
+    ctx.dst = dst;
+    ctx.method = method;
+    ctx.kernel = kernel;
+    ctx.k = k;
+    ctx.error = 0;
+    vc_pbm_tables_init();
+
+    if (!vc_parallel_rows(dst, vc_gray_adaptive_threshold_rows, &ctx)) ctx.error = 1;
+    vc_integral_free(ctx.ii);
+    vc_image_free(copy);
+
+    return !ctx.error;
+}
+
+// Bradley: acima de (1 - t) x mdia local fica branco (255), no ou abaixo fica preto (0). Ex.: t = 0.15
+int vc_gray_bradley_threshold(IVC *src, IVC *dst, int kernel, float t) {
+    VC_PROFILE_OP(src, dst);
+    return vc_gray_adaptive_threshold(src, dst, kernel, VC_ADAPTIVE_BRADLEY, t);
+}
+
+// Niblack: T = mdia + k x desvio padro local. Ex.: k = -0.2
+int vc_gray_niblack_threshold(IVC *src, IVC *dst, int kernel, float k) {
+    VC_PROFILE_OP(src, dst);
+    return vc_gray_adaptive_threshold(src, dst, kernel, VC_ADAPTIVE_NIBLACK, k);
+}
+
+// Sauvola: T = mdia x (1 + k x (desvio padro / 128 - 1)). Ex.: k = 0.5
+int vc_gray_sauvola_threshold(IVC *src, IVC *dst, int kernel, float k) {
+    VC_PROFILE_OP(src, dst);
+    return vc_gray_adaptive_threshold(src, dst, kernel, VC_ADAPTIVE_SAUVOLA, k);
+}
+
+// Converte uma imagem binria em bytes (0 = Preto, != 0 = Branco) para uma imagem empacotada
+int vc_binary_pack(IVC *src, IVC *dst) {
+    int y;
+    VC_PROFILE_OP(src, dst);
+
+    // Verificao de erros
+    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
+    if ((src->width != dst->width) || (src->height != dst->height)) return 0;
+    if ((src->channels != 1) || src->packed || !dst->packed) return 0;
+
+    for (y = 0; y < src->height; y++) {
+        vc_pbm_pack_row(src->data + y * src->bytesperline, dst->data + y * dst->bytesperline, src->width);
+    }
+
+    return 1;
+}
+
+// Converte uma imagem empacotada para bytes; os pixels brancos ficam com o valor dst->levels (1 ou 255)
+int vc_binary_unpack(IVC *src, IVC *dst) {
+    int y;
+    VC_PROFILE_OP(src, dst);
+
+    // Verificao de erros
+    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
+    if ((src->width != dst->width) || (src->height != dst->height)) return 0;
+    if (!src->packed || (dst->channels != 1) || dst->packed) return 0;
+
+    for (y = 0; y < src->height; y++) {
+        vc_pbm_unpack_row(src->data + y * src->bytesperline, dst->data + y * dst->bytesperline, src->width, dst->levels);
+    }
+
+    return 1;
+}
+
+// Etiquetagem de componentes ligados por segmentos (runs): cada linha  reduzida aos seus
+// segmentos de pixels de objeto (!= 0) e a union-find opera sobre segmentos, no sobre pixels.
+// As bandas de linhas so etiquetadas em paralelo e depois unidas pelas linhas de fronteira.
+typedef struct {
+    int y;
+    int xs, xe;             // Pixels [xs, xe)
+    int parent;             // Union-find (o pai tem sempre ndice menor ou igual)
+} VC_RUN;
+
+typedef struct {
+    int y0, y1;
+    int nruns, capacity;
+    VC_RUN *runs;
+    int *rowstart;          // Primeiro segmento de cada linha (y1 - y0 + 1 entradas)
+} VC_LABEL_BAND;
+
+typedef struct {
+    IVC *src;
+    IVC *dst;
+    int connectivity;
+    VC_LABEL_BAND **bands;  // Indexado pela primeira linha da banda
+    VC_RUN *runs;           // Todos os segmentos, por ordem de varrimento
+    int *rowstart;          // Primeiro segmento de cada linha (height + 1 entradas)
+    int *labels;            // Etiqueta final de cada segmento
+    int error;
+} VC_LABEL_CTX;
+
+static int vc_run_find(VC_RUN *runs, int i) {
+    int root = i, next;
+
+    while (runs[root].parent != root) root = runs[root].parent;
+    // Compresso do caminho
+    while (runs[i].parent != root) {
+        next = runs[i].parent;
+        runs[i].parent = root;
+        i = next;
+    }
+
+    return root;
+}
+
+static void vc_run_union(VC_RUN *runs, int a, int b) {
+    a = vc_run_find(runs, a);
+    b = vc_run_find(runs, b);
+    if (a < b) runs[b].parent = a;
+    else if (b < a) runs[a].parent = b;
+}
+
+// Une os segmentos [a0, a1) da linha anterior com os segmentos [b0, b1) da linha atual.
+// Com conectividade 8 os segmentos que s se tocam na diagonal tambm so vizinhos.
+static void vc_run_merge_rows(VC_RUN *runs, int a0, int a1, int b0, int b1, int connectivity) {
+    int d = (connectivity == VC_CONNECTIVITY_8) ? 1 : 0;
+    int a = a0, b = b0;
+
+    while ((a < a1) && (b < b1)) {
+        if ((runs[a].xs < runs[b].xe + d) && (runs[b].xs < runs[a].xe + d)) vc_run_union(runs, a, b);
+        // Avana o segmento que acaba primeiro
+        if (runs[a].xe < runs[b].xe) a++;
+        else b++;
+    }
+}
+
+static void vc_label_band_rows(IVC *image, VC_BAND *band, void *ctx) {
+    VC_LABEL_CTX *c = (VC_LABEL_CTX *) ctx;
+    IVC *src = c->src;
+    int width = src->width;
+    VC_LABEL_BAND *lb = (VC_LABEL_BAND *) calloc(1, sizeof(VC_LABEL_BAND));
+    unsigned char *row = NULL, *data;
+    VC_RUN *grown;
+    int x, y, xs;
+
+    c->bands[band->y0] = lb;
+    if (lb == NULL) {
+        c->error = 1;
+        return;
+    }
+    lb->y0 = band->y0;
+    lb->y1 = band->y1;
+    lb->capacity = 1024;
+    lb->runs = (VC_RUN *) malloc(lb->capacity * sizeof(VC_RUN));
+    lb->rowstart = (int *) malloc((band->y1 - band->y0 + 1) * sizeof(int));
+    if (src->packed) row = (unsigned char *) malloc(width);
+    if ((lb->runs == NULL) || (lb->rowstart == NULL) || (src->packed && (row == NULL))) {
+        c->error = 1;
+        free(row);
+        return;
+    }
+
+    for (y = band->y0; y < band->y1; y++) {
+        data = src->data + y * src->bytesperline;
+        // Numa imagem empacotada os pixels brancos (bit a 0) so o objeto
+        if (src->packed) {
+            vc_pbm_unpack_row(data, row, width, 255);
+            data = row;
+        }
+
+        lb->rowstart[y - band->y0] = lb->nruns;
+        x = 0;
+        while (x < width) {
+            while ((x < width) && (data[x] == 0)) x++;
+            if (x >= width) break;
+            xs = x;
+            while ((x < width) && (data[x] != 0)) x++;
+
+            if (lb->nruns == lb->capacity) {
+                grown = (VC_RUN *) realloc(lb->runs, 2 * lb->capacity * sizeof(VC_RUN));
+                if (grown == NULL) {
+                    c->error = 1;
+                    free(row);
+                    return;
+                }
+                lb->runs = grown;
+                lb->capacity *= 2;
+            }
+            lb->runs[lb->nruns].y = y;
+            lb->runs[lb->nruns].xs = xs;
+            lb->runs[lb->nruns].xe = x;
+            lb->runs[lb->nruns].parent = lb->nruns;
+            lb->nruns++;
+        }
+
+        if (y > band->y0) {
+            vc_run_merge_rows(lb->runs, lb->rowstart[y - 1 - band->y0], lb->rowstart[y - band->y0],
+                              lb->rowstart[y - band->y0], lb->nruns, c->connectivity);
+        }
+    }
+    lb->rowstart[band->y1 - band->y0] = lb->nruns;
+
+    free(row);
+}
+
+// Escreve as etiquetas de cada linha a partir dos seus segmentos (fundo = 0)
+static void vc_label_write_rows(IVC *image, VC_BAND *band, void *ctx) {
+    VC_LABEL_CTX *c = (VC_LABEL_CTX *) ctx;
+    IVC *dst = c->dst;
+    unsigned char *data;
+    int y, i, x, label;
+
+    for (y = band->y0; y < band->y1; y++) {
+        data = dst->data + y * dst->bytesperline;
+        memset(data, 0, dst->width * dst->channels);
+
+        for (i = c->rowstart[y]; i < c->rowstart[y + 1]; i++) {
+            label = c->labels[i];
+            if (dst->channels == 1) {
+                memset(data + c->runs[i].xs, label, c->runs[i].xe - c->runs[i].xs);
+            } else {
+                // Etiquetas de 16 bits (byte menos significativo primeiro)
+                for (x = c->runs[i].xs; x < c->runs[i].xe; x++) {
+                    data[x * 2] = (unsigned char) (label & 0xFF);
+                    data[x * 2 + 1] = (unsigned char) (label >> 8);
+                }
+            }
+        }
+    }
+}
+
+// Permetro pelas janelas 2x2 entre duas linhas de etiquetas (bit-quads de Gray/Duda), para as
+// janelas x em [x0, x1] (a janela x tem os pixels x - 1 e x; fora de [0, width)  fundo).
+// Para cada etiqueta, uma janela com 2 pixels lado a lado conta 1 em edges, com 1 ou 3 pixels
+// conta 1 em corners e com 2 pixels na diagonal conta 2 em corners (vc_bit_quads_perimeter).
+static void vc_bit_quads(int *prev, int *cur, int width, int x0, int x1, int *edges, int *corners) {
+    int q[4], l, m, k, j, x;
+
+    for (x = x0; x <= x1; x++) {
+        q[0] = (x > 0) ? prev[x - 1] : 0;
+        q[1] = (x < width) ? prev[x] : 0;
+        q[2] = (x > 0) ? cur[x - 1] : 0;
+        q[3] = (x < width) ? cur[x] : 0;
+        // Janela toda dentro do mesmo blob (ou do fundo): no  fronteira
+        if ((q[0] == q[1]) && (q[0] == q[2]) && (q[0] == q[3])) continue;
+
+        for (k = 0; k < 4; k++) {
+            l = q[k];
+            if (l == 0) continue;
+            // S trata cada etiqueta na sua primeira posio da janela
+            for (j = 0; (j < k) && (q[j] != l); j++);
+            if (j < k) continue;
+
+            m = (q[0] == l) | ((q[1] == l) << 1) | ((q[2] == l) << 2) | ((q[3] == l) << 3);
+            if ((m == 0x9) || (m == 0x6)) corners[l - 1] += 2;
+            else if ((m == 0x3) || (m == 0xC) || (m == 0x5) || (m == 0xA)) edges[l - 1]++;
+            else corners[l - 1]++;
+        }
+    }
+}
+
+static double vc_bit_quads_perimeter(int edges, int corners) {
+    return edges + corners * 0.70710678118654752;
+}
+
+// Permetro de cada blob, pelas mesmas janelas 2x2 de vc_blob_features() (arredondado).
+// As etiquetas de cada par de linhas s so escritas onde h segmentos, e s se contam as
+// janelas sobre a unio dos segmentos das duas linhas: as outras so todas de fundo.
+static int vc_label_perimeter(VC_LABEL_CTX *ctx, int width, int height, int nlabels, OVC *blobs) {
+    VC_RUN *runs = ctx->runs;
+    int *rowstart = ctx->rowstart;
+    int *prev = (int *) calloc(width, sizeof(int));
+    int *cur = (int *) calloc(width, sizeof(int));
+    int *edges = (int *) calloc(nlabels, sizeof(int));
+    int *corners = (int *) calloc(nlabels, sizeof(int));
+    int *tmp, y, r, i, i1, j, j1, x0, x1, ok = 0;
+
+    if ((prev == NULL) || (cur == NULL) || (edges == NULL) || (corners == NULL)) goto cleanup;
+
+    // prev tem a linha y - 1 e cur a linha y; a linha height  o fundo abaixo da imagem
+    for (y = 0; y <= height; y++) {
+        i = (y > 0) ? rowstart[y - 1] : 0;
+        i1 = (y > 0) ? rowstart[y] : 0;
+        j = (y < height) ? rowstart[y] : 0;
+        j1 = (y < height) ? rowstart[y + 1] : 0;
+        for (r = j; r < j1; r++) {
+            for (x0 = runs[r].xs; x0 < runs[r].xe; x0++) cur[x0] = ctx->labels[r];
+        }
+
+        // Segmentos das duas linhas por ordem de x, unidos quando se sobrepem ou tocam
+        // (a janela xe de um segmento  a janela xs do seguinte)
+        while ((i < i1) || (j < j1)) {
+            if ((j >= j1) || ((i < i1) && (runs[i].xs < runs[j].xs))) r = i++;
+            else r = j++;
+            x0 = runs[r].xs;
+            x1 = runs[r].xe;
+            for (;;) {
+                if ((i < i1) && (runs[i].xs <= x1)) r = i++;
+                else if ((j < j1) && (runs[j].xs <= x1)) r = j++;
+                else break;
+                if (runs[r].xe > x1) x1 = runs[r].xe;
+            }
+            vc_bit_quads(prev, cur, width, x0, x1, edges, corners);
+        }
+
+        if (y > 0) {
+            for (r = rowstart[y - 1]; r < rowstart[y]; r++) memset(prev + runs[r].xs, 0, (runs[r].xe - runs[r].xs) * sizeof(int));
+        }
+        tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+
+    for (i = 0; i < nlabels; i++) blobs[i].perimeter = (int) (vc_bit_quads_perimeter(edges[i], corners[i]) + 0.5);
+    ok = 1;
+
+cleanup:
+    free(prev);
+    free(cur);
+    free(edges);
+    free(corners);
+
+    return ok;
+}
+
+// Resolve as etiquetas dos segmentos j unidos, escreve a imagem de etiquetas (se ctx->dst != NULL)
+// e constri a tabela de blobs. Comum  etiquetagem de imagens e de mscaras RLE.
+static OVC *vc_label_finish(VC_LABEL_CTX *ctx, int width, int height, int nruns, int maxlabel, int *nlabels) {
+    OVC *blobs = NULL, *blob;
+    long long *sumx = NULL, *sumy = NULL;
+    int i, n, label, len;
+
+    // Etiquetas finais: como o pai tem sempre ndice menor, uma passagem em ordem resolve as razes
+    for (i = 0, label = 0; i < nruns; i++) {
+        n = vc_run_find(ctx->runs, i);
+        ctx->labels[i] = (n == i) ? ++label : ctx->labels[n];
+    }
+    if (label > maxlabel) {
+#ifdef VC_DEBUG
+        printf("ERROR -> vc_binary_blob_labelling():\n\tToo many labels (%d) for the destination image.\n", label);
+#endif
+        return NULL;
+    }
+
+    // 2 passagem (sobre os segmentos): imagem de etiquetas e tabela de blobs
+    if ((ctx->dst != NULL) && !vc_parallel_rows(ctx->dst, vc_label_write_rows, ctx)) return NULL;
+
+    if (label > 0) {
+        blobs = (OVC *) calloc(label, sizeof(OVC));
+        sumx = (long long *) calloc(label, sizeof(long long));
+        sumy = (long long *) calloc(label, sizeof(long long));
+        if ((blobs == NULL) || (sumx == NULL) || (sumy == NULL)) {
+            free(blobs);
+            free(sumx);
+            free(sumy);
+            return NULL;
+        }
+
+        for (i = 0; i < label; i++) {
+            blobs[i].label = i + 1;
+            blobs[i].x = width;
+            blobs[i].y = height;
+        }
+        for (i = 0; i < nruns; i++) {
+            VC_RUN *run = &ctx->runs[i];
+            blob = &blobs[ctx->labels[i] - 1];
+            len = run->xe - run->xs;
+            blob->area += len;
+            sumx[ctx->labels[i] - 1] += (long long) (run->xs + run->xe - 1) * len / 2;
+            sumy[ctx->labels[i] - 1] += (long long) run->y * len;
+            if (run->xs < blob->x) blob->x = run->xs;
+            if (run->y < blob->y) blob->y = run->y;
+            // width/height guardam provisoriamente o limite direito/inferior
+            if (run->xe > blob->width) blob->width = run->xe;
+            if (run->y + 1 > blob->height) blob->height = run->y + 1;
+        }
+        for (i = 0; i < label; i++) {
+            blobs[i].width -= blobs[i].x;
+            blobs[i].height -= blobs[i].y;
+            blobs[i].xc = (int) (sumx[i] / blobs[i].area);
+            blobs[i].yc = (int) (sumy[i] / blobs[i].area);
+        }
+        if (!vc_label_perimeter(ctx, width, height, label, blobs)) {
+            free(blobs);
+            blobs = NULL;
+        }
+    }
+    *nlabels = label;
+
+    free(sumx);
+    free(sumy);
+
+    return blobs;
+}
+
+// Etiqueta os objetos (pixels != 0, ou brancos numa imagem empacotada) de uma imagem binria.
+// dst com 1 canal guarda at 255 etiquetas; com 2 canais guarda etiquetas de 16 bits.
+// As etiquetas so numeradas pela ordem de varrimento, independentemente do nmero de threads.
+// Devolve a tabela de blobs (rea, caixa, centro-de-massa e permetro) e o nmero de etiquetas em nlabels;
+// sem objetos devolve NULL com nlabels = 0, e em caso de erro NULL com nlabels = -1.
+OVC *vc_binary_blob_labelling(IVC *src, IVC *dst, int *nlabels, int connectivity) {
+    VC_LABEL_CTX ctx;
+    VC_LABEL_BAND *lb;
+    OVC *blobs = NULL;
+    int height = src->height;
+    int y, i, n, nruns, prevlast, maxlabel;
+    VC_PROFILE_OP(src, dst);
+
+    *nlabels = -1;
+
+    // Verificao de erros
+    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return NULL;
+    if ((src->width != dst->width) || (src->height != dst->height)) return NULL;
+    if ((src->channels != 1) || dst->packed || ((dst->channels != 1) && (dst->channels != 2))) return NULL;
+    if ((connectivity != VC_CONNECTIVITY_4) && (connectivity != VC_CONNECTIVITY_8)) return NULL;
+    maxlabel = (dst->channels == 1) ? 255 : 65535;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.src = src;
+    ctx.dst = dst;
+    ctx.connectivity = connectivity;
+    ctx.bands = (VC_LABEL_BAND **) calloc(height, sizeof(VC_LABEL_BAND *));
+    ctx.rowstart = (int *) malloc((height + 1) * sizeof(int));
+    if ((ctx.bands == NULL) || (ctx.rowstart == NULL)) goto cleanup;
+    vc_pbm_tables_init();
+
+    // 1 passagem: segmentos e union-find local de cada banda
+    if (!vc_parallel_rows(src, vc_label_band_rows, &ctx) || ctx.error) goto cleanup;
+
+    // Junta as bandas (por ordem de linhas) num nico vetor de segmentos
+    for (y = 0, nruns = 0; y < height; y = lb->y1) {
+        lb = ctx.bands[y];
+        nruns += lb->nruns;
+    }
+    ctx.runs = (VC_RUN *) malloc((nruns > 0 ? nruns : 1) * sizeof(VC_RUN));
+    ctx.labels = (int *) malloc((nruns > 0 ? nruns : 1) * sizeof(int));
+    if ((ctx.runs == NULL) || (ctx.labels == NULL)) goto cleanup;
+
+    for (y = 0, n = 0; y < height; y = lb->y1) {
+        lb = ctx.bands[y];
+        for (i = 0; i < lb->nruns; i++) {
+            ctx.runs[n + i] = lb->runs[i];
+            ctx.runs[n + i].parent += n;
+        }
+        for (i = lb->y0; i < lb->y1; i++) ctx.rowstart[i] = lb->rowstart[i - lb->y0] + n;
+        n += lb->nruns;
+
+        // Une a primeira linha da banda com a ltima linha da banda anterior
+        if (lb->y0 > 0) {
+            prevlast = lb->y0 - 1;
+            vc_run_merge_rows(ctx.runs, ctx.rowstart[prevlast], ctx.rowstart[lb->y0],
+                              ctx.rowstart[lb->y0], ctx.rowstart[lb->y0] + (lb->rowstart[1] - lb->rowstart[0]), connectivity);
+        }
+    }
+    ctx.rowstart[height] = nruns;
+
+    blobs = vc_label_finish(&ctx, src->width, height, nruns, maxlabel, nlabels);
+
+cleanup:
+    if (ctx.bands != NULL) {
+        for (y = 0; y < height; y++) {
+            if (ctx.bands[y] != NULL) {
+                free(ctx.bands[y]->runs);
+                free(ctx.bands[y]->rowstart);
+                free(ctx.bands[y]);
+            }
+        }
+        free(ctx.bands);
+    }
+    free(ctx.runs);
+    free(ctx.labels);
+    free(ctx.rowstart);
+
+    return blobs;
+}
+
+// Garante espao para as etiquetas 1..n em todos os vetores (as posies novas ficam a 0)
+static int vc_blob_features_reserve(VC_BLOB_FEATURES *f, int n) {
+    void *grown;
+
+    if (n <= f->capacity) return 1;
+    if (n < 2 * f->capacity) n = 2 * f->capacity;
+
+#define VC_FEATURES_GROW(field, type) \
+    if ((grown = realloc(f->field, n * sizeof(type))) == NULL) return 0; \
+    f->field = (type *) grown; \
+    memset(f->field + f->capacity, 0, (n - f->capacity) * sizeof(type));
+
+    VC_FEATURES_GROW(area, int)
+    VC_FEATURES_GROW(xmin, int)
+    VC_FEATURES_GROW(ymin, int)
+    VC_FEATURES_GROW(xmax, int)
+    VC_FEATURES_GROW(ymax, int)
+    VC_FEATURES_GROW(edges, int)
+    VC_FEATURES_GROW(corners, int)
+    VC_FEATURES_GROW(m10, long long)
+    VC_FEATURES_GROW(m01, long long)
+    VC_FEATURES_GROW(m20, long long)
+    VC_FEATURES_GROW(m02, long long)
+    VC_FEATURES_GROW(m11, long long)
+    VC_FEATURES_GROW(xc, float)
+    VC_FEATURES_GROW(yc, float)
+    VC_FEATURES_GROW(perimeter, float)
+    VC_FEATURES_GROW(mu20, double)
+    VC_FEATURES_GROW(mu02, double)
+    VC_FEATURES_GROW(mu11, double)
+    VC_FEATURES_GROW(circularity, float)
+#undef VC_FEATURES_GROW
+
+    f->capacity = n;
+
+    return 1;
+}
+
+// nlabels  s uma estimativa: a tabela cresce se aparecerem etiquetas maiores
+VC_BLOB_FEATURES *vc_blob_features_new(int nlabels) {
+    VC_BLOB_FEATURES *f = (VC_BLOB_FEATURES *) calloc(1, sizeof(VC_BLOB_FEATURES));
+
+    if (f == NULL) return NULL;
+    if (!vc_blob_features_reserve(f, (nlabels > 0) ? nlabels : 16)) return vc_blob_features_free(f);
+
+    return f;
+}
+
+VC_BLOB_FEATURES *vc_blob_features_free(VC_BLOB_FEATURES *f) {
+    if (f != NULL) {
+        free(f->area);
+        free(f->xmin);
+        free(f->ymin);
+        free(f->xmax);
+        free(f->ymax);
+        free(f->edges);
+        free(f->corners);
+        free(f->perimeter);
+        free(f->m10);
+        free(f->m01);
+        free(f->m20);
+        free(f->m02);
+        free(f->m11);
+        free(f->xc);
+        free(f->yc);
+        free(f->mu20);
+        free(f->mu02);
+        free(f->mu11);
+        free(f->circularity);
+        free(f->prevrow);
+        free(f);
+    }
+
+    return NULL;
+}
+
+// Acumula uma faixa da imagem de etiquetas (1 canal, ou 2 canais com etiquetas de 16 bits),
+// cuja primeira linha  a linha y0 da imagem. As faixas tm de chegar por ordem; s 
+// guardada a ltima linha da faixa anterior (para as janelas 2x2 do permetro).
+int vc_blob_features_accumulate(VC_BLOB_FEATURES *f, IVC *labels, int y0) {
+    int width = labels->width;
+    int *cur;
+    unsigned char *data;
+    long long len, sx, sx2, xs1;
+    int x, y, xs, l, i, maxlabel;
+    VC_PROFILE_OP(labels, NULL);
+
+    // Verificao de erros
+    if ((f == NULL) || (labels->width <= 0) || (labels->height <= 0) || (labels->data == NULL)) return 0;
+    if (labels->packed || ((labels->channels != 1) && (labels->channels != 2))) return 0;
+    if (f->nextrow < 0) return 0;   // J terminado
+
+    if (f->prevrow == NULL) {
+        if ((f->prevrow = (int *) calloc(width, sizeof(int))) == NULL) return 0;
+        f->width = width;
+        f->nextrow = y0;
+    }
+    if ((width != f->width) || (y0 != f->nextrow)) return 0;
+    if ((cur = (int *) malloc(width * sizeof(int))) == NULL) return 0;
+
+    for (y = y0; y < y0 + labels->height; y++) {
+        data = labels->data + (y - y0) * labels->bytesperline;
+        maxlabel = 0;
+        if (labels->channels == 1) {
+            for (x = 0; x < width; x++) cur[x] = data[x];
+        } else {
+            for (x = 0; x < width; x++) cur[x] = data[x * 2] | (data[x * 2 + 1] << 8);
+        }
+        for (x = 0; x < width; x++) {
+            if (cur[x] > maxlabel) maxlabel = cur[x];
+        }
+        if (!vc_blob_features_reserve(f, maxlabel)) goto fail;
+
+        // Janelas 2x2 do permetro entre a linha anterior e esta
+        vc_bit_quads(f->prevrow, cur, width, 0, width, f->edges, f->corners);
+
+        // Segmentos de pixels com a mesma etiqueta
+        for (x = 0; x < width; ) {
+            l = cur[x];
+            xs = x;
+            while ((x < width) && (cur[x] == l)) x++;
+            if (l == 0) continue;
+
+            i = l - 1;
+            len = x - xs;
+            xs1 = (long long) xs - 1;
+            sx = (long long) (xs + x - 1) * len / 2;
+            sx2 = ((long long) (x - 1) * x * (2 * x - 1) - xs1 * xs * (2 * xs1 + 1)) / 6;
+
+            if (f->area[i] == 0) {
+                f->xmin[i] = xs;
+                f->ymin[i] = y;
+                f->xmax[i] = x - 1;
+                f->ymax[i] = y;
+            } else {
+                if (xs < f->xmin[i]) f->xmin[i] = xs;
+                if (x - 1 > f->xmax[i]) f->xmax[i] = x - 1;
+                f->ymax[i] = y;
+            }
+            f->area[i] += (int) len;
+            f->m10[i] += sx;
+            f->m01[i] += y * len;
+            f->m20[i] += sx2;
+            f->m02[i] += (long long) y * y * len;
+            f->m11[i] += y * sx;
+            if (l > f->count) f->count = l;
+        }
+
+        memcpy(f->prevrow, cur, width * sizeof(int));
+    }
+
+    f->nextrow = y0 + labels->height;
+    free(cur);
+
+    return 1;
+
+fail:
+    free(cur);
+    return 0;
+}
+
+// Fecha a acumulao (janelas abaixo da ltima linha) e calcula as caractersticas derivadas
+int vc_blob_features_finish(VC_BLOB_FEATURES *f) {
+    int *zeros;
+    double a, p;
+    int i;
+
+    if ((f == NULL) || (f->nextrow < 0)) return 0;
+
+    if (f->prevrow != NULL) {
+        if ((zeros = (int *) calloc(f->width, sizeof(int))) == NULL) return 0;
+        vc_bit_quads(f->prevrow, zeros, f->width, 0, f->width, f->edges, f->corners);
+        free(zeros);
+    }
+    f->nextrow = -1;
+
+    for (i = 0; i < f->count; i++) {
+        if (f->area[i] == 0) continue;
+        a = f->area[i];
+        f->xc[i] = (float) (f->m10[i] / a);
+        f->yc[i] = (float) (f->m01[i] / a);
+        f->mu20[i] = f->m20[i] - (double) f->m10[i] * f->m10[i] / a;
+        f->mu02[i] = f->m02[i] - (double) f->m01[i] * f->m01[i] / a;
+        f->mu11[i] = f->m11[i] - (double) f->m10[i] * f->m01[i] / a;
+        p = vc_bit_quads_perimeter(f->edges[i], f->corners[i]);
+        f->perimeter[i] = (float) p;
+        // 1 num crculo, pi / 4 num quadrado
+        f->circularity[i] = (float) (4.0 * 3.14159265358979 * a / (p * p));
+    }
+
+    return 1;
+}
+
+// Caractersticas de todos os blobs de uma imagem de etiquetas, numa s passagem
+VC_BLOB_FEATURES *vc_blob_features(IVC *labels, int nlabels) {
+    VC_BLOB_FEATURES *f = vc_blob_features_new(nlabels);
+
+    if (f == NULL) return NULL;
+    if (!vc_blob_features_accumulate(f, labels, 0) || !vc_blob_features_finish(f)) return vc_blob_features_free(f);
+
+    return f;
+}
+
+// Guarda em keep as etiquetas dos blobs com rea em [minarea, maxarea] (maxarea <= 0: sem limite)
+// e circularidade >= mincircularity. Devolve quantas foram guardadas.
+int vc_blob_features_filter(VC_BLOB_FEATURES *f, int minarea, int maxarea, float mincircularity, int *keep) {
+    int i, n = 0;
+
+    if ((f == NULL) || (f->nextrow >= 0)) return 0;     // vc_blob_features_finish() por chamar
+
+    for (i = 0; i < f->count; i++) {
+        if ((f->area[i] == 0) || (f->area[i] < minarea)) continue;
+        if ((maxarea > 0) && (f->area[i] > maxarea)) continue;
+        if (f->circularity[i] < mincircularity) continue;
+        keep[n++] = i + 1;
+    }
+
+    return n;
+}
+
+// Morfologia matemtica (eroso, dilatao, abertura e fecho). Os pixels fora da imagem
+// no contam (janela recortada aos limites), como em vc_gray_window_minmax(), pelo que
+// numa imagem binria 0/255 a verso em cinzentos e a verso empacotada do o mesmo resultado.
+// Nas imagens empacotadas cada linha  tratada como palavras de 64 pixels (bit 1 = branco,
+// o objeto); o pixel x fica no bit 63 - x % 64 da palavra x / 64.
+typedef struct {
+    IVC *src;
+    IVC *dst;
+    int rx, ry;
+    int shape;
+    int dilate;             // 0 = eroso (mnimo / AND); 1 = dilatao (mximo / OR)
+    int error;
+} VC_MORPH_CTX;
+
+// L uma linha PBM para palavras (invertida: 1 = branco); os bits alm de width ficam com fill
+static void vc_words_load(unsigned char *src, unsigned long long *dst, int width, int nwords, unsigned long long fill) {
+    int nbytes = (width + 7) / 8;
+    int valid = width - 64 * (nwords - 1);
+    unsigned long long word;
+    int w, b, i;
+
+    for (w = 0; w < nwords; w++) {
+        word = 0;
+        for (b = 0; b < 8; b++) {
+            i = w * 8 + b;
+            word = (word << 8) | ((i < nbytes) ? src[i] : 0);
+        }
+        dst[w] = ~word;
+    }
+    if (valid < 64) {
+        word = (1ULL << (64 - valid)) - 1;
+        dst[nwords - 1] = (dst[nwords - 1] & ~word) | (fill & word);
+    }
+}
+
+static void vc_words_store(unsigned long long *src, unsigned char *dst, int width) {
+    int nbytes = (width + 7) / 8;
+    int i;
+
+    for (i = 0; i < nbytes; i++) dst[i] = (unsigned char) ~(src[i / 8] >> (56 - 8 * (i % 8)));
+    // Bits de enchimento do ltimo byte a 0, como no PBM
+    if (width % 8) dst[nbytes - 1] &= (unsigned char) (0xFF << (8 - width % 8));
+}
+
+// dst[x] = src[x + d], com fill fora da linha
+static void vc_words_shift(unsigned long long *src, unsigned long long *dst, int nwords, int d, unsigned long long fill) {
+    int e = (d >= 0) ? d : -d;
+    int q = e >> 6, r = e & 63;
+    unsigned long long a, b;
+    int i, j;
+
+    for (i = 0; i < nwords; i++) {
+        if (d >= 0) {
+            j = i + q;
+            a = (j < nwords) ? src[j] : fill;
+            b = (j + 1 < nwords) ? src[j + 1] : fill;
+            dst[i] = r ? ((a << r) | (b >> (64 - r))) : a;
+        } else {
+            j = i - q;
+            a = (j >= 0) ? src[j] : fill;
+            b = (j - 1 >= 0) ? src[j - 1] : fill;
+            dst[i] = r ? ((a >> r) | (b << (64 - r))) : a;
+        }
+    }
+}
+
+// AND (ou OR) dos len pixels a partir de x, no sentido dir (+1 ou -1), por duplicao:
+// A_2m(x) = A_m(x) & A_m(x + m), e A_len(x) = A_m(x) & A_m(x + len - m) para m <= len < 2m.
+// So log2(len) deslocamentos por palavra, ou seja, por cada 64 pixels.
+static void vc_words_run(unsigned long long *out, unsigned long long *tmp, int nwords, int len, int dir, int dilate) {
+    unsigned long long fill = dilate ? 0 : ~0ULL;
+    int m, i;
+
+    for (m = 1; 2 * m <= len; m *= 2) {
+        vc_words_shift(out, tmp, nwords, dir * m, fill);
+        for (i = 0; i < nwords; i++) out[i] = dilate ? (out[i] | tmp[i]) : (out[i] & tmp[i]);
+    }
+    if (m < len) {
+        vc_words_shift(out, tmp, nwords, dir * (len - m), fill);
+        for (i = 0; i < nwords; i++) out[i] = dilate ? (out[i] | tmp[i]) : (out[i] & tmp[i]);
+    }
+}
+
+// AND (ou OR) da janela [x - r, x + r] de uma linha de palavras: [x, x + r] combinado com
+// [x - r, x] (assim nenhuma janela depende de posies fora da linha)
+static void vc_words_window_row(unsigned long long *row, unsigned long long *out, unsigned long long *tmp, unsigned long long *back,
+                                int nwords, int r, int dilate) {
+    int i;
+
+    memcpy(out, row, nwords * sizeof(unsigned long long));
+    if (r == 0) return;
+    memcpy(back, row, nwords * sizeof(unsigned long long));
+    vc_words_run(out, tmp, nwords, r + 1, 1, dilate);
+    vc_words_run(back, tmp, nwords, r + 1, -1, dilate);
+    for (i = 0; i < nwords; i++) out[i] = dilate ? (out[i] | back[i]) : (out[i] & back[i]);
+}
+
+// Van Herk/Gil-Werman na vertical sobre linhas de palavras (rows tem n + 2r linhas):
+// 3 operaes por palavra, qualquer que seja r
+static void vc_words_window_columns(unsigned long long **rows, int n, int nwords, int r, unsigned long long **out,
+                                    unsigned long long *h, unsigned long long *g, int dilate) {
+    int w = 2 * r + 1;
+    int s, k, x;
+    unsigned long long *hk, *hn, *p, *o;
+
+    for (s = 0; s < n; s += w) {
+        // Sufixos do bloco [s, s+w-1]
+        memcpy(h + (w - 1) * nwords, rows[s + w - 1], nwords * sizeof(unsigned long long));
+        for (k = w - 2; k >= 0; k--) {
+            hk = h + k * nwords;
+            hn = hk + nwords;
+            p = rows[s + k];
+            for (x = 0; x < nwords; x++) hk[x] = dilate ? (p[x] | hn[x]) : (p[x] & hn[x]);
+        }
+        memcpy(out[s], h, nwords * sizeof(unsigned long long));
+
+        // Prefixos do bloco seguinte, combinados com os sufixos
+        for (k = 1; (k < w) && (s + k < n); k++) {
+            p = rows[s + w + k - 1];
+            if (k == 1) {
+                memcpy(g, p, nwords * sizeof(unsigned long long));
+            } else {
+                for (x = 0; x < nwords; x++) g[x] = dilate ? (g[x] | p[x]) : (g[x] & p[x]);
+            }
+            hk = h + k * nwords;
+            o = out[s + k];
+            for (x = 0; x < nwords; x++) o[x] = dilate ? (hk[x] | g[x]) : (hk[x] & g[x]);
+        }
+    }
+}
+
+static void vc_binary_morph_packed_rows(IVC *image, VC_BAND *band, void *ctx) {
+    VC_MORPH_CTX *c = (VC_MORPH_CTX *) ctx;
+    IVC *src = c->src;
+    IVC *dst = c->dst;
+    int width = src->width;
+    int height = src->height;
+    int nwords = (width + 63) / 64;
+    int n = band->y1 - band->y0;
+    int hy0 = (band->y0 - c->ry < 0) ? 0 : band->y0 - c->ry;
+    int hy1 = (band->y1 + c->ry > height) ? height : band->y1 + c->ry;
+    unsigned long long fill = c->dilate ? 0 : ~0ULL;
+    unsigned long long *orig, *horiz, *outbuf, *identity, *h, *g, *tmp1, *tmp2, *tmp3, *o;
+    unsigned long long **rows, **out;
+    unsigned long long *block;
+    size_t total;
+    int y, j, x;
+
+    // Um s bloco para todos os buffers de palavras
+    total = (size_t) nwords * (2 * (hy1 - hy0) + n + 1 + (2 * c->ry + 1) + 4);
+    block = (unsigned long long *) malloc(total * sizeof(unsigned long long));
+    rows = (unsigned long long **) malloc((n + 2 * c->ry) * sizeof(unsigned long long *));
+    out = (unsigned long long **) malloc(n * sizeof(unsigned long long *));
+    if ((block == NULL) || (rows == NULL) || (out == NULL)) {
+        c->error = 1;
+        goto cleanup;
+    }
+    orig = block;
+    horiz = orig + (size_t) nwords * (hy1 - hy0);
+    outbuf = horiz + (size_t) nwords * (hy1 - hy0);
+    identity = outbuf + (size_t) nwords * n;
+    h = identity + nwords;
+    g = h + (size_t) nwords * (2 * c->ry + 1);
+    tmp1 = g + nwords;
+    tmp2 = tmp1 + nwords;
+    tmp3 = tmp2 + nwords;
+
+    for (x = 0; x < nwords; x++) identity[x] = fill;
+    for (y = hy0; y < hy1; y++) {
+        vc_words_load(src->data + y * src->bytesperline, orig + (size_t) (y - hy0) * nwords, width, nwords, fill);
+    }
+    for (j = 0; j < n; j++) out[j] = outbuf + (size_t) j * nwords;
+
+    // Retngulo: horizontal e depois vertical. Cruz: vertical AND/OR horizontal da linha original.
+    if (c->shape == VC_SE_RECT) {
+        for (y = hy0; y < hy1; y++) {
+            vc_words_window_row(orig + (size_t) (y - hy0) * nwords, horiz + (size_t) (y - hy0) * nwords, tmp1, tmp3, nwords, c->rx, c->dilate);
+        }
+    }
+    // As linhas fora da imagem so neutras (no contam para a janela)
+    for (j = 0; j < n + 2 * c->ry; j++) {
+        y = band->y0 + j - c->ry;
+        if ((y < 0) || (y >= height)) rows[j] = identity;
+        else rows[j] = ((c->shape == VC_SE_RECT) ? horiz : orig) + (size_t) (y - hy0) * nwords;
+    }
+    vc_words_window_columns(rows, n, nwords, c->ry, out, h, g, c->dilate);
+
+    for (y = band->y0; y < band->y1; y++) {
+        o = out[y - band->y0];
+        if (c->shape == VC_SE_CROSS) {
+            vc_words_window_row(orig + (size_t) (y - hy0) * nwords, tmp2, tmp1, tmp3, nwords, c->rx, c->dilate);
+            for (x = 0; x < nwords; x++) o[x] = c->dilate ? (o[x] | tmp2[x]) : (o[x] & tmp2[x]);
+        }
+        vc_words_store(o, dst->data + y * dst->bytesperline, width);
+    }
+
+cleanup:
+    free(block);
+    free(rows);
+    free(out);
+}
+
+static void vc_gray_morph_rows(IVC *image, VC_BAND *band, void *ctx) {
+    VC_MORPH_CTX *c = (VC_MORPH_CTX *) ctx;
+    IVC *dst = c->dst;
+    int width = dst->width;
+    int n = band->y1 - band->y0;
+    unsigned char **out = (unsigned char **) malloc(n * sizeof(unsigned char *));
+    unsigned char **vert = (unsigned char **) malloc(n * sizeof(unsigned char *));
+    unsigned char **none = (unsigned char **) calloc(n, sizeof(unsigned char *));
+    unsigned char *vbuf = NULL;
+    unsigned char *o, *v;
+    int i, x;
+
+    if ((out == NULL) || (vert == NULL) || (none == NULL)) {
+        c->error = 1;
+        goto cleanup;
+    }
+    for (i = 0; i < n; i++) out[i] = dst->data + (band->y0 + i) * dst->bytesperline;
+
+    if (c->shape == VC_SE_RECT) {
+        if (!vc_window_minmax_band(c->src, c->rx, c->ry, band->y0, band->y1, c->dilate ? none : out, c->dilate ? out : none)) c->error = 1;
+        goto cleanup;
+    }
+
+    // Cruz: mnimo (mximo) entre o brao horizontal e o brao vertical
+    if ((vbuf = (unsigned char *) malloc((size_t) n * width)) == NULL) {
+        c->error = 1;
+        goto cleanup;
+    }
+    for (i = 0; i < n; i++) vert[i] = vbuf + (size_t) i * width;
+    if (!vc_window_minmax_band(c->src, c->rx, 0, band->y0, band->y1, c->dilate ? none : out, c->dilate ? out : none) ||
+        !vc_window_minmax_band(c->src, 0, c->ry, band->y0, band->y1, c->dilate ? none : vert, c->dilate ? vert : none)) {
+        c->error = 1;
+        goto cleanup;
+    }
+    for (i = 0; i < n; i++) {
+        o = out[i];
+        v = vert[i];
+        if (c->dilate) {
+            for (x = 0; x < width; x++) o[x] = (v[x] > o[x]) ? v[x] : o[x];
+        } else {
+            for (x = 0; x < width; x++) o[x] = (v[x] < o[x]) ? v[x] : o[x];
+        }
+    }
+
+cleanup:
+    free(out);
+    free(vert);
+    free(none);
+    free(vbuf);
+}
+
+// Eroso ou dilatao de src para dst com um elemento estruturante kwidth x kheight
+// (VC_SE_RECT) ou em cruz com braos kwidth e kheight (VC_SE_CROSS)
+static int vc_morphology(IVC *src, IVC *dst, int kwidth, int kheight, int shape, int dilate) {
+    VC_MORPH_CTX ctx;
+    IVC *copy = NULL;
+    int ok;
+
+    // Verificao de erros
+    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
+    if ((src->width != dst->width) || (src->height != dst->height)) return 0;
+    if ((src->channels != 1) || (dst->channels != 1) || (src->packed != dst->packed)) return 0;
+    if ((shape != VC_SE_RECT) && (shape != VC_SE_CROSS)) return 0;
+
+    // Um kernel de 0 corresponde a uma janela de 1 pixel
+    if (kwidth < 1) kwidth = 1;
+    if (kheight < 1) kheight = 1;
+
+    // As bandas leem linhas de halo de src: se src e dst se sobrepem trabalha-se sobre uma cpia
+    if (vc_image_overlaps(src, dst)) {
+        if ((copy = vc_image_copy(src)) == NULL) return 0;
+        src = copy;
+    }
+
+    ctx.src = src;
+    ctx.dst = dst;
+    ctx.rx = kwidth / 2;
+    ctx.ry = kheight / 2;
+    ctx.shape = shape;
+    ctx.dilate = dilate;
+    ctx.error = 0;
+
+    ok = vc_parallel_rows_halo(dst, ctx.ry, src->packed ? vc_binary_morph_packed_rows : vc_gray_morph_rows, &ctx) && !ctx.error;
+
+    vc_image_free(copy);
+
+    return ok;
+}
+
+// Abertura (eroso seguida de dilatao) ou fecho (dilatao seguida de eroso)
+static int vc_morphology_pair(IVC *src, IVC *dst, int kwidth, int kheight, int shape, int dilatefirst) {
+    IVC *tmp;
+    int ok;
+
+    if ((src->width <= 0) || (src->height <= 0)) return 0;
+
+    tmp = src->packed ? vc_image_new_packed(src->width, src->height) : vc_image_new(src->width, src->height, 1, src->levels);
+    if (tmp == NULL) return 0;
+
+    ok = vc_morphology(src, tmp, kwidth, kheight, shape, dilatefirst) &&
+         vc_morphology(tmp, dst, kwidth, kheight, shape, !dilatefirst);
+
+    vc_image_free(tmp);
+
+    return ok;
+}
+
+// Morfologia binria: imagens empacotadas (objeto = branco) ou com 1 byte por pixel (objeto != 0)
+int vc_binary_erode(IVC *src, IVC *dst, int kwidth, int kheight, int shape) {
+    VC_PROFILE_OP(src, dst);
+    return vc_morphology(src, dst, kwidth, kheight, shape, 0);
+}
+
+int vc_binary_dilate(IVC *src, IVC *dst, int kwidth, int kheight, int shape) {
+    VC_PROFILE_OP(src, dst);
+    return vc_morphology(src, dst, kwidth, kheight, shape, 1);
+}
+
+int vc_binary_open(IVC *src, IVC *dst, int kwidth, int kheight, int shape) {
+    VC_PROFILE_OP(src, dst);
+    return vc_morphology_pair(src, dst, kwidth, kheight, shape, 0);
+}
+
+int vc_binary_close(IVC *src, IVC *dst, int kwidth, int kheight, int shape) {
+    VC_PROFILE_OP(src, dst);
+    return vc_morphology_pair(src, dst, kwidth, kheight, shape, 1);
+}
+
+// Morfologia em cinzentos: mnimo (eroso) e mximo (dilatao) deslizantes
+int vc_gray_erode(IVC *src, IVC *dst, int kwidth, int kheight, int shape) {
+    VC_PROFILE_OP(src, dst);
+    if (src->packed) return 0;
+    return vc_morphology(src, dst, kwidth, kheight, shape, 0);
+}
+
+int vc_gray_dilate(IVC *src, IVC *dst, int kwidth, int kheight, int shape) {
+    VC_PROFILE_OP(src, dst);
+    if (src->packed) return 0;
+    return vc_morphology(src, dst, kwidth, kheight, shape, 1);
+}
+
+int vc_gray_open(IVC *src, IVC *dst, int kwidth, int kheight, int shape) {
+    VC_PROFILE_OP(src, dst);
+    if (src->packed) return 0;
+    return vc_morphology_pair(src, dst, kwidth, kheight, shape, 0);
+}
+
+int vc_gray_close(IVC *src, IVC *dst, int kwidth, int kheight, int shape) {
+    VC_PROFILE_OP(src, dst);
+    if (src->packed) return 0;
+    return vc_morphology_pair(src, dst, kwidth, kheight, shape, 1);
+}
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    FUNES: FILTROS DE SUAVIZAO SEPARVEIS (CAIXA E GAUSSIANO)
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Os dois filtros so separveis: uma passagem vertical para uma linha auxiliar e uma
+// passagem horizontal dessa linha para o destino. No h imagem intermdia, pelo que
+// cada linha de sada s l as linhas de src de que precisa (halo = raio).
+// Bordas: replica o pixel da margem. Imagens de 1 ou 3 canais (os canais so filtrados  parte).
+//
+// Caixa: somas por coluna (16 bits) atualizadas a cada linha (+ linha que entra, - linha que sai)
+// e soma deslizante na horizontal: custo por pixel constante, qualquer que seja o kernel.
+// Gaussiano: pesos em vrgula fixa Q8 (soma exatamente 256), pelo que uma soma ponderada de
+// pixels cabe em 16 bits e o kernel  vetorizado com multiplicaes de 16 bits.
+
+// Mximo de linhas/colunas do kernel: (2r + 1) * 255 tem de caber nas somas de 16 bits
+#define VC_FILTER_MAX_KERNEL 255
+#define VC_GAUSS_SHIFT 8
+// Diviso da caixa por multiplicao: (s * VC_BOX_MUL(area)) >> VC_BOX_SHIFT  exato para s < 2^24
+#define VC_BOX_SHIFT 40
+
+typedef struct {
+    int type;                       // VC_STAGE_BOX ou VC_STAGE_GAUSSIAN
+    int r;                          // Raio (o kernel tem 2r + 1 linhas e colunas)
+    unsigned int half;              // Caixa: metade da rea (arredondamento)
+    unsigned long long mul;         // Caixa: 2^40 / rea + 1
+    unsigned short weights[VC_FILTER_MAX_KERNEL];  // Gaussiano: pesos Q8 simtricos
+} VC_FILTER;
+
+typedef struct {
+    IVC *src;
+    IVC *dst;
+    VC_FILTER *filter;
+    int error;
+} VC_FILTER_CTX;
+
+
+// Pesos gaussianos em Q8. Os pesos so arredondados por baixo e as unidades que faltam para
+// 256 so dadas aos pares simtricos com maior resto (e ao centro, se forem em nmero mpar).
+// As pontas com peso 0 so cortadas, o que reduz o raio. Devolve o raio final.
+static int vc_gaussian_weights(int r, float sigma, unsigned short *weights) {
+    double g[VC_FILTER_MAX_KERNEL], rest[VC_FILTER_MAX_KERNEL];
+    double total = 0.0, best;
+    int i, j, deficit, first;
+
+    for (i = 0; i <= 2 * r; i++) {
+        g[i] = exp(-(double) ((i - r) * (i - r)) / (2.0 * sigma * sigma));
+        total += g[i];
+    }
+
+    deficit = 1 << VC_GAUSS_SHIFT;
+    for (i = 0; i <= 2 * r; i++) {
+        g[i] = g[i] * (1 << VC_GAUSS_SHIFT) / total;
+        weights[i] = (unsigned short) g[i];
+        rest[i] = g[i] - weights[i];
+        deficit -= weights[i];
+    }
+
+    if (deficit & 1) {
+        weights[r]++;
+        deficit--;
+    }
+    while (deficit > 0) {
+        for (i = 0, j = -1, best = -1.0; i < r; i++) {
+            if (rest[i] > best) {
+                best = rest[i];
+                j = i;
+            }
+        }
+        if (j < 0) {
+            weights[r] += (unsigned short) deficit;
+            break;
+        }
+        weights[j]++;
+        weights[2 * r - j]++;
+        rest[j] = -2.0;
+        deficit -= 2;
+    }
+
+    for (first = 0; (first < r) && (weights[first] == 0); first++);
+    if (first > 0) memmove(weights, weights + first, (2 * (r - first) + 1) * sizeof(unsigned short));
+
+    return r - first;
+}
+
+// kernel < 1 no gaussiano: calculado a partir de sigma (3 sigma para cada lado).
+// sigma <= 0: calculado a partir do kernel (como no OpenCV).
+static int vc_filter_init(VC_FILTER *f, int type, int kernel, float sigma) {
+    unsigned int area;
+
+    memset(f, 0, sizeof(VC_FILTER));
+    f->type = type;
+
+    if (type == VC_STAGE_BOX) {
+        // Um kernel de 0 corresponde a uma janela de 1 pixel
+        if (kernel < 1) kernel = 1;
+        if (kernel > VC_FILTER_MAX_KERNEL) return 0;
+        f->r = kernel / 2;
+        area = (unsigned int) (2 * f->r + 1) * (2 * f->r + 1);
+        f->half = area / 2;
+        f->mul = (1ULL << VC_BOX_SHIFT) / area + 1;
+        return 1;
+    }
+
+    if (type != VC_STAGE_GAUSSIAN) return 0;
+    if (kernel < 1) {
+        if (sigma <= 0.0f) return 0;
+        kernel = 2 * (int) ceil(3.0 * sigma) + 1;
+        if ((sigma > 42.0f) || (kernel > VC_FILTER_MAX_KERNEL)) kernel = VC_FILTER_MAX_KERNEL;
+    }
+    if (kernel > VC_FILTER_MAX_KERNEL) return 0;
+    if (sigma <= 0.0f) sigma = 0.3f * ((float) (kernel / 2) - 1.0f) + 0.8f;
+    f->r = vc_gaussian_weights(kernel / 2, sigma, f->weights);
+
+    return 1;
+}
+
+
+// Somas por coluna: sum[i] += add[i] - sub[i] (sub pode ser NULL)
+static void vc_box_update_row_c(unsigned short *sum, unsigned char *add, unsigned char *sub, int x0, int n) {
+    int i;
+
+    if (sub == NULL) {
+        for (i = x0; i < n; i++) sum[i] += add[i];
+    } else {
+        for (i = x0; i < n; i++) sum[i] += add[i] - sub[i];
+    }
+}
+
+// dst[i] = soma de weights[j] * rows[j][i], arredondada e em Q8 (os pesos so simtricos)
+static void vc_gauss_row_c(unsigned char **rows, int r, unsigned short *weights, unsigned char *dst, int x0, int n) {
+    unsigned int acc;
+    int i, j;
+
+    for (i = x0; i < n; i++) {
+        acc = (1 << (VC_GAUSS_SHIFT - 1)) + weights[r] * rows[r][i];
+        for (j = 0; j < r; j++) acc += weights[j] * (rows[j][i] + rows[2 * r - j][i]);
+        dst[i] = (unsigned char) (acc >> VC_GAUSS_SHIFT);
+    }
+}
+
+#ifdef VC_SIMD_X86
+__attribute__((target("sse2")))
+static void vc_box_update_row_sse2(unsigned short *sum, unsigned char *add, unsigned char *sub, int n) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i a, b, lo, hi;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        a = _mm_loadu_si128((__m128i *) (add + i));
+        lo = _mm_add_epi16(_mm_loadu_si128((__m128i *) (sum + i)), _mm_unpacklo_epi8(a, zero));
+        hi = _mm_add_epi16(_mm_loadu_si128((__m128i *) (sum + i + 8)), _mm_unpackhi_epi8(a, zero));
+        if (sub != NULL) {
+            b = _mm_loadu_si128((__m128i *) (sub + i));
+            lo = _mm_sub_epi16(lo, _mm_unpacklo_epi8(b, zero));
+            hi = _mm_sub_epi16(hi, _mm_unpackhi_epi8(b, zero));
+        }
+        _mm_storeu_si128((__m128i *) (sum + i), lo);
+        _mm_storeu_si128((__m128i *) (sum + i + 8), hi);
+    }
+    vc_box_update_row_c(sum, add, sub, i, n);
+}
+
+__attribute__((target("avx2")))
+static void vc_box_update_row_avx2(unsigned short *sum, unsigned char *add, unsigned char *sub, int n) {
+    __m256i s;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        s = _mm256_add_epi16(_mm256_loadu_si256((__m256i *) (sum + i)), _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (add + i))));
+        if (sub != NULL) s = _mm256_sub_epi16(s, _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (sub + i))));
+        _mm256_storeu_si256((__m256i *) (sum + i), s);
+    }
+    vc_box_update_row_c(sum, add, sub, i, n);
+}
+
+// As somas ponderadas no passam de 255 * 256, pelo que as contas em 16 bits sem sinal no transbordam
+__attribute__((target("sse2")))
+static void vc_gauss_row_sse2(unsigned char **rows, int r, unsigned short *weights, unsigned char *dst, int n) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i round = _mm_set1_epi16(1 << (VC_GAUSS_SHIFT - 1));
+    __m128i w, a, b, lo, hi;
+    int i, j;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        w = _mm_set1_epi16((short) weights[r]);
+        a = _mm_loadu_si128((__m128i *) (rows[r] + i));
+        lo = _mm_add_epi16(round, _mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), w));
+        hi = _mm_add_epi16(round, _mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), w));
+        for (j = 0; j < r; j++) {
+            w = _mm_set1_epi16((short) weights[j]);
+            a = _mm_loadu_si128((__m128i *) (rows[j] + i));
+            b = _mm_loadu_si128((__m128i *) (rows[2 * r - j] + i));
+            lo = _mm_add_epi16(lo, _mm_mullo_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)), w));
+            hi = _mm_add_epi16(hi, _mm_mullo_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)), w));
+        }
+        lo = _mm_srli_epi16(lo, VC_GAUSS_SHIFT);
+        hi = _mm_srli_epi16(hi, VC_GAUSS_SHIFT);
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(lo, hi));
+    }
+    vc_gauss_row_c(rows, r, weights, dst, i, n);
+}
+
+__attribute__((target("avx2")))
+static void vc_gauss_row_avx2(unsigned char **rows, int r, unsigned short *weights, unsigned char *dst, int n) {
+    __m256i round = _mm256_set1_epi16(1 << (VC_GAUSS_SHIFT - 1));
+    __m256i w, lo, hi;
+    int i, j;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        w = _mm256_set1_epi16((short) weights[r]);
+        lo = _mm256_add_epi16(round, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (rows[r] + i))), w));
+        hi = _mm256_add_epi16(round, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (rows[r] + i + 16))), w));
+        for (j = 0; j < r; j++) {
+            w = _mm256_set1_epi16((short) weights[j]);
+            lo = _mm256_add_epi16(lo, _mm256_mullo_epi16(_mm256_add_epi16(
+                     _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (rows[j] + i))),
+                     _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (rows[2 * r - j] + i)))), w));
+            hi = _mm256_add_epi16(hi, _mm256_mullo_epi16(_mm256_add_epi16(
+                     _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (rows[j] + i + 16))),
+                     _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (rows[2 * r - j] + i + 16)))), w));
+        }
+        lo = _mm256_srli_epi16(lo, VC_GAUSS_SHIFT);
+        hi = _mm256_srli_epi16(hi, VC_GAUSS_SHIFT);
+        // packus junta as metades de 128 bits alternadas: permute repe a ordem dos pixels
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8));
+    }
+    vc_gauss_row_c(rows, r, weights, dst, i, n);
+}
+#endif
+
+static void vc_box_update_row(unsigned short *sum, unsigned char *add, unsigned char *sub, int n) {
+#ifdef VC_SIMD_X86
+    int level = vc_get_simd_level();
+
+    if (level >= VC_SIMD_AVX2) { vc_box_update_row_avx2(sum, add, sub, n); return; }
+    if (level >= VC_SIMD_SSE2) { vc_box_update_row_sse2(sum, add, sub, n); return; }
+#endif
+    vc_box_update_row_c(sum, add, sub, 0, n);
+}
+
+static void vc_gauss_row(unsigned char **rows, int r, unsigned short *weights, unsigned char *dst, int n) {
+#ifdef VC_SIMD_X86
+    int level = vc_get_simd_level();
+
+    if (level >= VC_SIMD_AVX2) { vc_gauss_row_avx2(rows, r, weights, dst, n); return; }
+    if (level >= VC_SIMD_SSE2) { vc_gauss_row_sse2(rows, r, weights, dst, n); return; }
+#endif
+    vc_gauss_row_c(rows, r, weights, dst, 0, n);
+}
+
+// Soma deslizante horizontal das somas por coluna (p tem pad valores replicados de cada lado)
+static void vc_box_row(VC_FILTER *f, unsigned short *p, unsigned char *dst, int width, int channels) {
+    int r = f->r;
+    int front = (r + 1) * channels;
+    int back = r * channels;
+    unsigned int sums[3];
+    int x, c, i, j;
+
+    for (c = 0; c < channels; c++) {
+        for (j = -r, sums[c] = 0; j <= r; j++) sums[c] += p[j * channels + c];
+    }
+
+    if (channels == 1) {
+        for (i = 0; i < width; i++) {
+            dst[i] = (unsigned char) (((sums[0] + f->half) * f->mul) >> VC_BOX_SHIFT);
+            sums[0] += p[i + front] - p[i - back];
+        }
+        return;
+    }
+
+    for (x = 0, i = 0; x < width; x++) {
+        for (c = 0; c < channels; c++, i++) {
+            dst[i] = (unsigned char) (((sums[c] + f->half) * f->mul) >> VC_BOX_SHIFT);
+            sums[c] += p[i + front] - p[i - back];
+        }
+    }
+}
+
+// Replica o primeiro e o ltimo pixel da linha nas pad posies de cada lado
+static void vc_pad_row_u8(unsigned char *row, int width, int channels, int pad) {
+    int i, n = width * channels;
+
+    for (i = 1; i <= pad; i++) {
+        memcpy(row - i * channels, row, channels);
+        memcpy(row + n - channels + i * channels, row + n - channels, channels);
+    }
+}
+
+static void vc_pad_row_u16(unsigned short *row, int width, int channels, int pad) {
+    int i, n = width * channels;
+
+    for (i = 1; i <= pad; i++) {
+        memcpy(row - i * channels, row, channels * sizeof(unsigned short));
+        memcpy(row + n - channels + i * channels, row + n - channels, channels * sizeof(unsigned short));
+    }
+}
+
+// Filtra as linhas [y0, y1) de src para dst. As linhas lidas fora de src so as da margem.
+// Um dst empacotado recebe os bits da linha filtrada (como o kernel pontual do pipeline).
+static int vc_filter_rows(VC_FILTER *f, IVC *src, IVC *dst, int y0, int y1) {
+    int width = src->width;
+    int channels = src->channels;
+    int n = width * channels;
+    int r = f->r;
+    int pad = (r + 1) * channels;
+    unsigned short *sums = NULL;
+    unsigned char *line = NULL, *out = NULL;
+    unsigned char **rows = NULL, **hrows = NULL;
+    unsigned char *target;
+    int y, j, ok = 0;
+
+#define VC_FILTER_SRC_ROW(yy) (src->data + (size_t) ((yy) < 0 ? 0 : ((yy) >= src->height ? src->height - 1 : (yy))) * src->bytesperline)
+
+    if (dst->packed && ((out = vc_buffer_alloc(VC_ALIGN_UP(n))) == NULL)) goto cleanup;
+
+    if (f->type == VC_STAGE_BOX) {
+        if ((sums = (unsigned short *) vc_buffer_alloc(VC_ALIGN_UP((n + 2 * pad) * sizeof(unsigned short)))) == NULL) goto cleanup;
+    } else {
+        line = vc_buffer_alloc(VC_ALIGN_UP(n + 2 * pad));
+        rows = (unsigned char **) malloc((2 * r + 1) * sizeof(unsigned char *));
+        hrows = (unsigned char **) malloc((2 * r + 1) * sizeof(unsigned char *));
+        if ((line == NULL) || (rows == NULL) || (hrows == NULL)) goto cleanup;
+        // Na passagem horizontal as "linhas" so a linha auxiliar deslocada de um pixel de cada vez
+        for (j = 0; j <= 2 * r; j++) hrows[j] = line + pad + (j - r) * channels;
+    }
+
+    for (y = y0; y < y1; y++) {
+        target = dst->packed ? out : dst->data + (size_t) y * dst->bytesperline;
+
+        if (f->type == VC_STAGE_BOX) {
+            if (y == y0) {
+                memset(sums + pad, 0, n * sizeof(unsigned short));
+                for (j = -r; j <= r; j++) vc_box_update_row(sums + pad, VC_FILTER_SRC_ROW(y + j), NULL, n);
+            } else {
+                vc_box_update_row(sums + pad, VC_FILTER_SRC_ROW(y + r), VC_FILTER_SRC_ROW(y - r - 1), n);
+            }
+            vc_pad_row_u16(sums + pad, width, channels, r + 1);
+            vc_box_row(f, sums + pad, target, width, channels);
+        } else {
+            for (j = 0; j <= 2 * r; j++) rows[j] = VC_FILTER_SRC_ROW(y - r + j);
+            vc_gauss_row(rows, r, f->weights, line + pad, n);
+            vc_pad_row_u8(line + pad, width, channels, r);
+            vc_gauss_row(hrows, r, f->weights, target, n);
+        }
+
+        if (dst->packed) vc_pbm_pack_row(out, dst->data + (size_t) y * dst->bytesperline, width);
+    }
+    ok = 1;
+
+#undef VC_FILTER_SRC_ROW
+
+cleanup:
+    vc_buffer_free((unsigned char *) sums);
+    vc_buffer_free(line);
+    vc_buffer_free(out);
+    free(rows);
+    free(hrows);
+
+    return ok;
+}
+
+static void vc_filter_band(IVC *image, VC_BAND *band, void *ctx) {
+    VC_FILTER_CTX *c = (VC_FILTER_CTX *) ctx;
+
+    if (!vc_filter_rows(c->filter, c->src, c->dst, band->y0, band->y1)) c->error = 1;
+}
+
+static int vc_filter(IVC *src, IVC *dst, VC_FILTER *f) {
+    VC_FILTER_CTX ctx;
+    IVC *copy = NULL;
+    int ok;
+
+    // Verificao de erros
+    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
+    if ((src->width != dst->width) || (src->height != dst->height)) return 0;
+    if ((src->channels != 1) && (src->channels != 3)) return 0;
+    if ((src->channels != dst->channels) || src->packed || dst->packed) return 0;
+
+    // As bandas leem linhas de halo de src: se src e dst se sobrepem trabalha-se sobre uma cpia
+    if (vc_image_overlaps(src, dst)) {
+        if ((copy = vc_image_copy(src)) == NULL) return 0;
+        src = copy;
+    }
+
+    ctx.src = src;
+    ctx.dst = dst;
+    ctx.filter = f;
+    ctx.error = 0;
+    vc_get_simd_level();
+
+    ok = vc_parallel_rows_halo(dst, f->r, vc_filter_band, &ctx) && !ctx.error;
+
+    vc_image_free(copy);
+
+    return ok;
+}
+
+// Mdia numa janela kernel x kernel (kernel par conta como kernel + 1, como no midpoint)
+int vc_box_filter(IVC *src, IVC *dst, int kernel) {
+    VC_FILTER f;
+    VC_PROFILE_OP(src, dst);
+
+    if (!vc_filter_init(&f, VC_STAGE_BOX, kernel, 0.0f)) return 0;
+
+    return vc_filter(src, dst, &f);
+}
+
+// Gaussiano de desvio padro sigma numa janela kernel x kernel.
+// kernel < 1: calculado a partir de sigma; sigma <= 0: calculado a partir do kernel.
+int vc_gaussian_filter(IVC *src, IVC *dst, int kernel, float sigma) {
+    VC_FILTER f;
+    VC_PROFILE_OP(src, dst);
+
+    if (!vc_filter_init(&f, VC_STAGE_GAUSSIAN, kernel, sigma)) return 0;
+
+    return vc_filter(src, dst, &f);
+}
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    FUNES: GRADIENTES E DETEO DE ARESTAS (SOBEL, PREWITT)
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Os dois gradientes (gx, gy), a magnitude e a direo saem da mesma passagem 3x3 por cada linha,
+// em 16 bits com sinal (Sobel: |g| <= 1020, Prewitt: |g| <= 765). A magnitude L1 ou L2  guardada
+// em 16 bits para a supresso de no-mximos e s  saturada a 255 quando  escrita em dst.
+// Bordas: replica o pixel da margem. Na supresso, a magnitude fora da imagem conta como 0.
+//
+// Direo do gradiente (segundo canal de dst), em 4 setores de 45 graus:
+// 0 = horizontal, 1 = diagonal com gx e gy do mesmo sinal, 2 = vertical, 3 = a outra diagonal.
+
+// tan(22.5 graus) em Q16: |gy| <= |gx| * tan(22.5)  um gradiente horizontal
+#define VC_TAN22_Q16 27146
+
+typedef struct {
+    IVC *src;
+    IVC *dst;
+    int op;
+    int norm;
+    int nms;
+    int error;
+} VC_GRADIENT_CTX;
+
+
+static void vc_gradient_row_c(unsigned char *r0, unsigned char *r1, unsigned char *r2, int x0, int x1, int width,
+                              int op, int norm, unsigned short *mag, unsigned char *dir) {
+    int c = (op == VC_GRADIENT_SOBEL) ? 2 : 1;      // Peso da linha/coluna central
+    int x, xl, xr, gx, gy, ax, ay;
+
+    for (x = x0; x < x1; x++) {
+        xl = (x > 0) ? x - 1 : 0;
+        xr = (x < width - 1) ? x + 1 : width - 1;
+
+        gx = (r0[xr] + c * r1[xr] + r2[xr]) - (r0[xl] + c * r1[xl] + r2[xl]);
+        gy = (r2[xl] + c * r2[x] + r2[xr]) - (r0[xl] + c * r0[x] + r0[xr]);
+        ax = (gx < 0) ? -gx : gx;
+        ay = (gy < 0) ? -gy : gy;
+
+        if (norm == VC_NORM_L2) mag[x] = (unsigned short) (sqrtf((float) (gx * gx + gy * gy)) + 0.5f);
+        else mag[x] = (unsigned short) (ax + ay);
+
+        if (ay <= ((ax * VC_TAN22_Q16) >> 16)) dir[x] = 0;
+        else if (ax <= ((ay * VC_TAN22_Q16) >> 16)) dir[x] = 2;
+        else dir[x] = ((gx ^ gy) < 0) ? 3 : 1;
+    }
+}
+
+// Supresso de no-mximos: fica o pixel cuja magnitude  maior do que a do vizinho anterior
+// e no menor do que a do seguinte, na direo do gradiente (up, cur e down tm 1 zero de cada lado)
+static void vc_nms_row_c(unsigned short *up, unsigned short *cur, unsigned short *down, unsigned char *dir,
+                         int x0, int x1, unsigned short *out) {
+    int x, a, b;
+
+    for (x = x0; x < x1; x++) {
+        switch (dir[x]) {
+            case 0: a = cur[x - 1]; b = cur[x + 1]; break;
+            case 1: a = up[x - 1]; b = down[x + 1]; break;
+            case 2: a = up[x]; b = down[x]; break;
+            default: a = up[x + 1]; b = down[x - 1]; break;
+        }
+        out[x] = ((cur[x] > a) && (cur[x] >= b)) ? cur[x] : 0;
+    }
+}
+
+#ifdef VC_SIMD_X86
+// Setores da direo a partir de |gx|, |gy| e do sinal de gx ^ gy (comparaes em 16 bits com sinal)
+#define VC_GRADIENT_DIR(PFX, SFX, ax, ay, sign, dir) do { \
+        __m##SFX##i tan = PFX##_set1_epi16(VC_TAN22_Q16); \
+        __m##SFX##i horizontal = PFX##_cmpgt_epi16(ay, PFX##_mulhi_epu16(ax, tan));  /* 0 se horizontal */ \
+        __m##SFX##i vertical = PFX##_cmpgt_epi16(ax, PFX##_mulhi_epu16(ay, tan));    /* 0 se vertical */ \
+        dir = PFX##_or_si##SFX(PFX##_and_si##SFX(sign, PFX##_set1_epi16(3)), PFX##_andnot_si##SFX(sign, PFX##_set1_epi16(1))); \
+        dir = PFX##_or_si##SFX(PFX##_and_si##SFX(vertical, dir), PFX##_andnot_si##SFX(vertical, PFX##_set1_epi16(2))); \
+        dir = PFX##_and_si##SFX(horizontal, dir); \
+    } while (0)
+
+__attribute__((target("sse2")))
+static void vc_gradient_row_sse2(unsigned char *r0, unsigned char *r1, unsigned char *r2, int width,
+                                 int op, int norm, unsigned short *mag, unsigned char *dir) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i l0, l1, l2, c0, c2, h0, h1, h2, gx, gy, ax, ay, sign, m, d;
+    __m128 flo, fhi, half = _mm_set1_ps(0.5f);
+    int x = 1;
+
+#define VC_LOAD8(p) _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (p)), zero)
+    // O primeiro e os ltimos pixels (que replicam a margem) ficam para a verso escalar
+    for (; x + 9 <= width; x += 8) {
+        l0 = VC_LOAD8(r0 + x - 1); c0 = VC_LOAD8(r0 + x); h0 = VC_LOAD8(r0 + x + 1);
+        l1 = VC_LOAD8(r1 + x - 1); h1 = VC_LOAD8(r1 + x + 1);
+        l2 = VC_LOAD8(r2 + x - 1); c2 = VC_LOAD8(r2 + x); h2 = VC_LOAD8(r2 + x + 1);
+
+        if (op == VC_GRADIENT_SOBEL) {
+            l1 = _mm_adds_epi16(l1, l1);
+            h1 = _mm_adds_epi16(h1, h1);
+            c0 = _mm_adds_epi16(c0, c0);
+            c2 = _mm_adds_epi16(c2, c2);
+        }
+        gx = _mm_subs_epi16(_mm_adds_epi16(_mm_adds_epi16(h0, h1), h2), _mm_adds_epi16(_mm_adds_epi16(l0, l1), l2));
+        gy = _mm_subs_epi16(_mm_adds_epi16(_mm_adds_epi16(l2, c2), h2), _mm_adds_epi16(_mm_adds_epi16(l0, c0), h0));
+        ax = _mm_max_epi16(gx, _mm_subs_epi16(zero, gx));
+        ay = _mm_max_epi16(gy, _mm_subs_epi16(zero, gy));
+
+        if (norm == VC_NORM_L2) {
+            // gx + gy < 2^24: exato em float, tal como na verso escalar
+            flo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(gx, gx), 16));
+            fhi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(gx, gx), 16));
+            flo = _mm_mul_ps(flo, flo);
+            fhi = _mm_mul_ps(fhi, fhi);
+            m = _mm_srai_epi32(_mm_unpacklo_epi16(gy, gy), 16);
+            flo = _mm_add_ps(flo, _mm_mul_ps(_mm_cvtepi32_ps(m), _mm_cvtepi32_ps(m)));
+            m = _mm_srai_epi32(_mm_unpackhi_epi16(gy, gy), 16);
+            fhi = _mm_add_ps(fhi, _mm_mul_ps(_mm_cvtepi32_ps(m), _mm_cvtepi32_ps(m)));
+            m = _mm_packs_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_sqrt_ps(flo), half)),
+                                _mm_cvttps_epi32(_mm_add_ps(_mm_sqrt_ps(fhi), half)));
+        } else {
+            m = _mm_adds_epu16(ax, ay);
+        }
+        _mm_storeu_si128((__m128i *) (mag + x), m);
+
+        sign = _mm_srai_epi16(_mm_xor_si128(gx, gy), 15);
+        VC_GRADIENT_DIR(_mm, 128, ax, ay, sign, d);
+        _mm_storel_epi64((__m128i *) (dir + x), _mm_packus_epi16(d, d));
+    }
+#undef VC_LOAD8
+
+    vc_gradient_row_c(r0, r1, r2, 0, 1, width, op, norm, mag, dir);
+    vc_gradient_row_c(r0, r1, r2, x, width, width, op, norm, mag, dir);
+}
+
+__attribute__((target("avx2")))
+static void vc_gradient_row_avx2(unsigned char *r0, unsigned char *r1, unsigned char *r2, int width,
+                                 int op, int norm, unsigned short *mag, unsigned char *dir) {
+    __m256i l0, l1, l2, c0, c2, h0, h1, h2, gx, gy, ax, ay, sign, m, d, lo, hi;
+    __m256 flo, fhi, half = _mm256_set1_ps(0.5f);
+    int x = 1;
+
+#define VC_LOAD16(p) _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (p)))
+    for (; x + 17 <= width; x += 16) {
+        l0 = VC_LOAD16(r0 + x - 1); c0 = VC_LOAD16(r0 + x); h0 = VC_LOAD16(r0 + x + 1);
+        l1 = VC_LOAD16(r1 + x - 1); h1 = VC_LOAD16(r1 + x + 1);
+        l2 = VC_LOAD16(r2 + x - 1); c2 = VC_LOAD16(r2 + x); h2 = VC_LOAD16(r2 + x + 1);
+
+        if (op == VC_GRADIENT_SOBEL) {
+            l1 = _mm256_adds_epi16(l1, l1);
+            h1 = _mm256_adds_epi16(h1, h1);
+            c0 = _mm256_adds_epi16(c0, c0);
+            c2 = _mm256_adds_epi16(c2, c2);
+        }
+        gx = _mm256_subs_epi16(_mm256_adds_epi16(_mm256_adds_epi16(h0, h1), h2), _mm256_adds_epi16(_mm256_adds_epi16(l0, l1), l2));
+        gy = _mm256_subs_epi16(_mm256_adds_epi16(_mm256_adds_epi16(l2, c2), h2), _mm256_adds_epi16(_mm256_adds_epi16(l0, c0), h0));
+        ax = _mm256_abs_epi16(gx);
+        ay = _mm256_abs_epi16(gy);
+
+        if (norm == VC_NORM_L2) {
+            lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(gx));
+            hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(gx, 1));
+            flo = _mm256_cvtepi32_ps(lo);
+            fhi = _mm256_cvtepi32_ps(hi);
+            flo = _mm256_mul_ps(flo, flo);
+            fhi = _mm256_mul_ps(fhi, fhi);
+            lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(gy));
+            hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(gy, 1));
+            flo = _mm256_add_ps(flo, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), _mm256_cvtepi32_ps(lo)));
+            fhi = _mm256_add_ps(fhi, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), _mm256_cvtepi32_ps(hi)));
+            lo = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_sqrt_ps(flo), half));
+            hi = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_sqrt_ps(fhi), half));
+            // packs junta as metades de 128 bits alternadas: permute repe a ordem dos pixels
+            m = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+        } else {
+            m = _mm256_adds_epu16(ax, ay);
+        }
+        _mm256_storeu_si256((__m256i *) (mag + x), m);
+
+        sign = _mm256_srai_epi16(_mm256_xor_si256(gx, gy), 15);
+        VC_GRADIENT_DIR(_mm256, 256, ax, ay, sign, d);
+        d = _mm256_permute4x64_epi64(_mm256_packus_epi16(d, d), 0xD8);
+        _mm_storeu_si128((__m128i *) (dir + x), _mm256_castsi256_si128(d));
+    }
+#undef VC_LOAD16
+
+    vc_gradient_row_c(r0, r1, r2, 0, 1, width, op, norm, mag, dir);
+    vc_gradient_row_c(r0, r1, r2, x, width, width, op, norm, mag, dir);
+}
+
+__attribute__((target("sse2")))
+static void vc_nms_row_sse2(unsigned short *up, unsigned short *cur, unsigned short *down, unsigned char *dir,
+                            int width, unsigned short *out) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i m, a, b, d, eq, keep;
+    int x;
+
+#define VC_LOAD(p) _mm_loadu_si128((__m128i *) (p))
+#define VC_SELECT(mask, v, w) _mm_or_si128(_mm_and_si128(mask, v), _mm_andnot_si128(mask, w))
+    for (x = 0; x + 8 <= width; x += 8) {
+        m = VC_LOAD(cur + x);
+        d = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (dir + x)), zero);
+        a = VC_LOAD(up + x + 1);
+        b = VC_LOAD(down + x - 1);
+        eq = _mm_cmpeq_epi16(d, _mm_set1_epi16(2));
+        a = VC_SELECT(eq, VC_LOAD(up + x), a);
+        b = VC_SELECT(eq, VC_LOAD(down + x), b);
+        eq = _mm_cmpeq_epi16(d, _mm_set1_epi16(1));
+        a = VC_SELECT(eq, VC_LOAD(up + x - 1), a);
+        b = VC_SELECT(eq, VC_LOAD(down + x + 1), b);
+        eq = _mm_cmpeq_epi16(d, zero);
+        a = VC_SELECT(eq, VC_LOAD(cur + x - 1), a);
+        b = VC_SELECT(eq, VC_LOAD(cur + x + 1), b);
+        keep = _mm_andnot_si128(_mm_cmpgt_epi16(b, m), _mm_cmpgt_epi16(m, a));
+        _mm_storeu_si128((__m128i *) (out + x), _mm_and_si128(keep, m));
+    }
+#undef VC_LOAD
+#undef VC_SELECT
+
+    vc_nms_row_c(up, cur, down, dir, x, width, out);
+}
+
+__attribute__((target("avx2")))
+static void vc_nms_row_avx2(unsigned short *up, unsigned short *cur, unsigned short *down, unsigned char *dir,
+                            int width, unsigned short *out) {
+    __m256i m, a, b, d, keep;
+    int x;
+
+#define VC_LOAD(p) _mm256_loadu_si256((__m256i *) (p))
+#define VC_SELECT(mask, v, w) _mm256_blendv_epi8(w, v, mask)
+    // As magnitudes no passam de 2040: comparaes com sinal
+    for (x = 0; x + 16 <= width; x += 16) {
+        m = VC_LOAD(cur + x);
+        d = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (dir + x)));
+        a = VC_LOAD(up + x + 1);
+        b = VC_LOAD(down + x - 1);
+        a = VC_SELECT(_mm256_cmpeq_epi16(d, _mm256_set1_epi16(2)), VC_LOAD(up + x), a);
+        b = VC_SELECT(_mm256_cmpeq_epi16(d, _mm256_set1_epi16(2)), VC_LOAD(down + x), b);
+        a = VC_SELECT(_mm256_cmpeq_epi16(d, _mm256_set1_epi16(1)), VC_LOAD(up + x - 1), a);
+        b = VC_SELECT(_mm256_cmpeq_epi16(d, _mm256_set1_epi16(1)), VC_LOAD(down + x + 1), b);
+        a = VC_SELECT(_mm256_cmpeq_epi16(d, _mm256_setzero_si256()), VC_LOAD(cur + x - 1), a);
+        b = VC_SELECT(_mm256_cmpeq_epi16(d, _mm256_setzero_si256()), VC_LOAD(cur + x + 1), b);
+        keep = _mm256_andnot_si256(_mm256_cmpgt_epi16(b, m), _mm256_cmpgt_epi16(m, a));
+        _mm256_storeu_si256((__m256i *) (out + x), _mm256_and_si256(keep, m));
+    }
+#undef VC_LOAD
+#undef VC_SELECT
+
+    vc_nms_row_c(up, cur, down, dir, x, width, out);
+}
+#endif
+
+static void vc_gradient_row(unsigned char *r0, unsigned char *r1, unsigned char *r2, int width,
+                            int op, int norm, unsigned short *mag, unsigned char *dir) {
+#ifdef VC_SIMD_X86
+    int level = vc_get_simd_level();
+
+    if (level >= VC_SIMD_AVX2) { vc_gradient_row_avx2(r0, r1, r2, width, op, norm, mag, dir); return; }
+    if (level >= VC_SIMD_SSE2) { vc_gradient_row_sse2(r0, r1, r2, width, op, norm, mag, dir); return; }
+#endif
+    vc_gradient_row_c(r0, r1, r2, 0, width, width, op, norm, mag, dir);
+}
+
+static void vc_nms_row(unsigned short *up, unsigned short *cur, unsigned short *down, unsigned char *dir,
+                       int width, unsigned short *out) {
+#ifdef VC_SIMD_X86
+    int level = vc_get_simd_level();
+
+    if (level >= VC_SIMD_AVX2) { vc_nms_row_avx2(up, cur, down, dir, width, out); return; }
+    if (level >= VC_SIMD_SSE2) { vc_nms_row_sse2(up, cur, down, dir, width, out); return; }
+#endif
+    vc_nms_row_c(up, cur, down, dir, 0, width, out);
+}
+
+// Cada banda calcula a magnitude das linhas [y0 - 1, y1 + 1) uma s vez, num anel de 3 linhas
+// (a supresso de no-mximos precisa da linha de cima e da de baixo)
+static void vc_gray_gradient_rows(IVC *image, VC_BAND *band, void *ctx) {
+    VC_GRADIENT_CTX *c = (VC_GRADIENT_CTX *) ctx;
+    IVC *src = c->src;
+    IVC *dst = c->dst;
+    int width = src->width;
+    int height = src->height;
+    int stride = VC_ALIGN_UP((width + 2) * sizeof(unsigned short)) / sizeof(unsigned short);
+    unsigned short *buf = (unsigned short *) vc_buffer_alloc(5 * stride * sizeof(unsigned short));
+    unsigned char *dirbuf = vc_buffer_alloc(3 * VC_ALIGN_UP(width));
+    unsigned short *mag[3], *zero, *out, *res, *tmp;
+    unsigned char *dir[3], *dirtmp, *data_dst;
+    int x, y, k, v;
+
+#define VC_GRADIENT_SRC_ROW(yy) (src->data + (size_t) ((yy) < 0 ? 0 : ((yy) >= height ? height - 1 : (yy))) * src->bytesperline)
+
+    if ((buf == NULL) || (dirbuf == NULL)) {
+        c->error = 1;
+        goto cleanup;
+    }
+
+    // Linhas de magnitude com um zero de cada lado; zero = linha fora da imagem
+    memset(buf, 0, 5 * stride * sizeof(unsigned short));
+    for (k = 0; k < 3; k++) {
+        mag[k] = buf + k * stride + 1;
+        dir[k] = dirbuf + k * VC_ALIGN_UP(width);
+    }
+    zero = buf + 3 * stride + 1;
+    out = buf + 4 * stride + 1;
+
+    for (y = band->y0 - 1; y <= band->y1; y++) {
+        // Sem supresso s  preciso calcular as linhas da banda
+        if (!c->nms && ((y < band->y0) || (y >= band->y1))) continue;
+
+        // Roda o anel: mag[1] passa a ser a linha y - 1 e mag[2] a linha y
+        tmp = mag[0]; mag[0] = mag[1]; mag[1] = mag[2]; mag[2] = tmp;
+        dirtmp = dir[0]; dir[0] = dir[1]; dir[1] = dir[2]; dir[2] = dirtmp;
+        if ((y >= 0) && (y < height)) {
+            vc_gradient_row(VC_GRADIENT_SRC_ROW(y - 1), VC_GRADIENT_SRC_ROW(y), VC_GRADIENT_SRC_ROW(y + 1), width, c->op, c->norm, mag[2], dir[2]);
+        }
+
+        // Linha a escrever: y - 1 com supresso (precisa da linha y), y sem supresso
+        k = c->nms ? 1 : 2;
+        v = c->nms ? y - 1 : y;
+        if (v < band->y0) continue;
+
+        if (c->nms) {
+            vc_nms_row((v > 0) ? mag[0] : zero, mag[1], (v < height - 1) ? mag[2] : zero, dir[1], width, out);
+            res = out;
+        } else {
+            res = mag[2];
+        }
+
+        data_dst = dst->data + (size_t) v * dst->bytesperline;
+        if (dst->channels == 1) {
+            for (x = 0; x < width; x++) data_dst[x] = (unsigned char) ((res[x] > 255) ? 255 : res[x]);
+        } else {
+            for (x = 0; x < width; x++) {
+                data_dst[2 * x] = (unsigned char) ((res[x] > 255) ? 255 : res[x]);
+                data_dst[2 * x + 1] = dir[k][x];
+            }
+        }
+    }
+
+#undef VC_GRADIENT_SRC_ROW
+
+cleanup:
+    vc_buffer_free((unsigned char *) buf);
+    vc_buffer_free(dirbuf);
+}
+
+// Gradiente 3x3 (VC_GRADIENT_SOBEL ou VC_GRADIENT_PREWITT) com magnitude VC_NORM_L1 ou VC_NORM_L2,
+// saturada a 255. nms != 0: s ficam os mximos locais na direo do gradiente (arestas de 1 pixel).
+// dst de 1 canal: magnitude; de 2 canais: magnitude e direo (setor 0 a 3).
+int vc_gray_gradient(IVC *src, IVC *dst, int op, int norm, int nms) {
+    VC_GRADIENT_CTX ctx;
+    IVC *copy = NULL;
+    int ok;
+    VC_PROFILE_OP(src, dst);
+
+    // Verificao de erros
+    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
+    if ((src->width != dst->width) || (src->height != dst->height)) return 0;
+    if ((src->channels != 1) || src->packed || dst->packed) return 0;
+    if ((dst->channels != 1) && (dst->channels != 2)) return 0;
+    if ((op != VC_GRADIENT_SOBEL) && (op != VC_GRADIENT_PREWITT)) return 0;
+    if ((norm != VC_NORM_L1) && (norm != VC_NORM_L2)) return 0;
+
+    // As bandas leem linhas de halo de src: se src e dst se sobrepem trabalha-se sobre uma cpia
+    if (vc_image_overlaps(src, dst)) {
+        if ((copy = vc_image_copy(src)) == NULL) return 0;
+        src = copy;
+    }
+
+    ctx.src = src;
+    ctx.dst = dst;
+    ctx.op = op;
+    ctx.norm = norm;
+    ctx.nms = nms;
+    ctx.error = 0;
+    vc_get_simd_level();
+
+    ok = vc_parallel_rows_halo(dst, nms ? 2 : 1, vc_gray_gradient_rows, &ctx) && !ctx.error;
+
+    vc_image_free(copy);
+
+    return ok;
+}
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    FUNES: MSCARAS BINRIAS CODIFICADAS POR SEGMENTOS (RLE)
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Cada linha da mscara  a lista dos seus segmentos de objeto [xs, xe), por ordem crescente
+// de x e sem segmentos encostados. Os operadores trabalham sobre os segmentos, sem passar
+// pelos pixels: o custo depende do nmero de segmentos e no da rea da imagem.
+//
+// Ficheiro: header "VCRLE <width> <height>\n" seguido, por linha, do nmero de segmentos e dos
+// pares (distncia ao fim do segmento anterior, comprimento), em inteiros de comprimento varivel
+// (7 bits por byte; o bit mais significativo indica que h mais bytes). Uma linha vazia ocupa 1 byte.
+
+VC_RLE *vc_rle_new(int width, int height) {
+    VC_RLE *rle;
+
+    if ((width <= 0) || (height <= 0)) return NULL;
+
+    rle = (VC_RLE *) calloc(1, sizeof(VC_RLE));
+    if (rle == NULL) return NULL;
+
+    rle->width = width;
+    rle->height = height;
+    rle->capacity = 1024;
+    rle->spans = (VC_SPAN *) malloc(rle->capacity * sizeof(VC_SPAN));
+    rle->rowstart = (int *) calloc(height + 1, sizeof(int));
+    if ((rle->spans == NULL) || (rle->rowstart == NULL)) return vc_rle_free(rle);
+
+    return rle;
+}
+
+VC_RLE *vc_rle_free(VC_RLE *rle) {
+    if (rle != NULL) {
+        free(rle->spans);
+        free(rle->rowstart);
+        free(rle);
+    }
+
+    return NULL;
+}
+
+// Garante espao para mais n segmentos
+static int vc_rle_reserve(VC_RLE *rle, int n) {
+    VC_SPAN *grown;
+    int capacity = rle->capacity;
+
+    if (rle->nspans + n <= capacity) return 1;
+    while (capacity < rle->nspans + n) capacity *= 2;
+
+    grown = (VC_SPAN *) realloc(rle->spans, capacity * sizeof(VC_SPAN));
+    if (grown == NULL) return 0;
+    rle->spans = grown;
+    rle->capacity = capacity;
+
+    return 1;
+}
+
+static int vc_clz64(unsigned long long v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(v);
+#else
+    int n = 0;
+
+    while (!(v & 0x8000000000000000ULL)) {
+        v <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// Primeira posio >= x com o bit pedido numa linha de palavras (64 * nwords se no houver)
+static int vc_words_next(unsigned long long *words, int nwords, int x, int bit) {
+    int w = x >> 6;
+    unsigned long long m;
+
+    if (w >= nwords) return 64 * nwords;
+    m = (bit ? words[w] : ~words[w]) & (~0ULL >> (x & 63));
+    while (m == 0) {
+        if (++w >= nwords) return 64 * nwords;
+        m = bit ? words[w] : ~words[w];
+    }
+
+    return 64 * w + vc_clz64(m);
+}
+
+// Converte uma imagem binria em segmentos: pixels != 0 (1 canal) ou brancos (imagem empacotada)
+VC_RLE *vc_rle_encode(IVC *src) {
+    VC_RLE *rle;
+    unsigned long long *words = NULL;
+    unsigned long long chunk;
+    unsigned char *data;
+    int width, nwords, x, xs, y;
+    VC_PROFILE_OP(src, NULL);
+
+    // Verificao de erros
+    if ((src == NULL) || (src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return NULL;
+    if (src->channels != 1) return NULL;
+
+    width = src->width;
+    nwords = (width + 63) / 64;
+    if ((rle = vc_rle_new(width, src->height)) == NULL) return NULL;
+    if (src->packed && ((words = (unsigned long long *) malloc(nwords * sizeof(unsigned long long))) == NULL)) return vc_rle_free(rle);
+
+    for (y = 0; y < src->height; y++) {
+        data = src->data + y * src->bytesperline;
+        rle->rowstart[y] = rle->nspans;
+        // No mximo um segmento por cada 2 pixels
+        if (!vc_rle_reserve(rle, (width + 1) / 2)) {
+            free(words);
+            return vc_rle_free(rle);
+        }
+
+        if (src->packed) {
+            // Numa palavra o bit 1  branco (objeto): procura as transies com clz
+            vc_words_load(data, words, width, nwords, 0);
+            for (x = 0; (x = vc_words_next(words, nwords, x, 1)) < width; ) {
+                xs = x;
+                x = vc_words_next(words, nwords, x, 0);
+                if (x > width) x = width;
+                rle->spans[rle->nspans].xs = xs;
+                rle->spans[rle->nspans].xe = x;
+                rle->nspans++;
+            }
+        } else {
+            x = 0;
+            while (x < width) {
+                // Salta o fundo 8 pixels de cada vez (mscaras quase vazias)
+                while (x + 8 <= width) {
+                    memcpy(&chunk, data + x, 8);
+                    if (chunk != 0) break;
+                    x += 8;
+                }
+                while ((x < width) && (data[x] == 0)) x++;
+                if (x >= width) break;
+                xs = x;
+                while ((x < width) && (data[x] != 0)) x++;
+                rle->spans[rle->nspans].xs = xs;
+                rle->spans[rle->nspans].xe = x;
+                rle->nspans++;
+            }
+        }
+    }
+    rle->rowstart[src->height] = rle->nspans;
+
+    free(words);
+
+    return rle;
+}
+
+// Pe a 0 (branco) os bits [xs, xe) de uma linha PBM
+static void vc_pbm_clear_bits(unsigned char *row, int xs, int xe) {
+    int b0 = xs >> 3, b1 = (xe - 1) >> 3;
+    unsigned char m0 = (unsigned char) (0xFF >> (xs & 7));
+    unsigned char m1 = (unsigned char) (0xFF << (7 - ((xe - 1) & 7)));
+
+    if (b0 == b1) {
+        row[b0] &= (unsigned char) ~(m0 & m1);
+        return;
+    }
+    row[b0] &= (unsigned char) ~m0;
+    memset(row + b0 + 1, 0, b1 - b0 - 1);
+    row[b1] &= (unsigned char) ~m1;
+}
+
+// Converte os segmentos numa imagem binria: 1 canal (objeto = 1 ou 255, conforme levels,
+// fundo = 0) ou empacotada (objeto = branco)
+int vc_rle_decode(VC_RLE *rle, IVC *dst) {
+    unsigned char *data;
+    int nbytes, white, y, i;
+    VC_PROFILE_OP(NULL, dst);
+
+    // Verificao de erros
+    if ((rle == NULL) || (dst == NULL) || (dst->data == NULL)) return 0;
+    if ((rle->width != dst->width) || (rle->height != dst->height) || (dst->channels != 1)) return 0;
+
+    nbytes = (dst->width + 7) / 8;
+    white = (dst->levels > 1) ? 255 : 1;
+
+    for (y = 0; y < dst->height; y++) {
+        data = dst->data + y * dst->bytesperline;
+
+        if (dst->packed) {
+            // Linha toda preta (bits de enchimento a 0, como no PBM)
+            memset(data, 0xFF, nbytes);
+            if (dst->width % 8) data[nbytes - 1] = (unsigned char) (0xFF << (8 - dst->width % 8));
+            for (i = rle->rowstart[y]; i < rle->rowstart[y + 1]; i++) vc_pbm_clear_bits(data, rle->spans[i].xs, rle->spans[i].xe);
+        } else {
+            memset(data, 0, dst->width);
+            for (i = rle->rowstart[y]; i < rle->rowstart[y + 1]; i++) {
+                memset(data + rle->spans[i].xs, white, rle->spans[i].xe - rle->spans[i].xs);
+            }
+        }
+    }
+
+    return 1;
+}
+
+// Unio (dilate = 1) ou interseo (dilate = 0) de duas linhas de segmentos
+static int vc_spans_combine(VC_SPAN *a, int na, VC_SPAN *b, int nb, VC_SPAN *out, int dilate) {
+    VC_SPAN s;
+    int i = 0, j = 0, n = 0;
+
+    if (dilate) {
+        while ((i < na) || (j < nb)) {
+            // Prximo segmento por ordem de incio; junta-o ao anterior se se tocarem
+            s = ((j >= nb) || ((i < na) && (a[i].xs <= b[j].xs))) ? a[i++] : b[j++];
+            if ((n > 0) && (s.xs <= out[n - 1].xe)) {
+                if (s.xe > out[n - 1].xe) out[n - 1].xe = s.xe;
+            } else {
+                out[n++] = s;
+            }
+        }
+    } else {
+        while ((i < na) && (j < nb)) {
+            s.xs = (a[i].xs > b[j].xs) ? a[i].xs : b[j].xs;
+            s.xe = (a[i].xe < b[j].xe) ? a[i].xe : b[j].xe;
+            if (s.xs < s.xe) out[n++] = s;
+            // Avana o segmento que acaba primeiro
+            if (a[i].xe < b[j].xe) i++;
+            else j++;
+        }
+    }
+
+    return n;
+}
+
+// Dilatao (eroso) horizontal de uma linha de segmentos com a janela [x - r, x + r].
+// Na eroso os pixels fora da imagem no contam, como em vc_binary_erode().
+static int vc_spans_grow(VC_SPAN *a, int na, int r, int width, VC_SPAN *out, int dilate) {
+    VC_SPAN s;
+    int i, n = 0;
+
+    for (i = 0; i < na; i++) {
+        s = a[i];
+        if (dilate) {
+            s.xs = (s.xs - r < 0) ? 0 : s.xs - r;
+            s.xe = (s.xe + r > width) ? width : s.xe + r;
+            if ((n > 0) && (s.xs <= out[n - 1].xe)) out[n - 1].xe = s.xe;
+            else out[n++] = s;
+        } else {
+            if (s.xs > 0) s.xs += r;
+            if (s.xe < width) s.xe -= r;
+            if (s.xs < s.xe) out[n++] = s;
+        }
+    }
+
+    return n;
+}
+
+// Eroso ou dilatao de src para dst, com os mesmos elementos estruturantes e o mesmo
+// tratamento dos limites de vc_morphology(). dst pode ser src.
+static int vc_rle_morphology(VC_RLE *src, VC_RLE *dst, int kwidth, int kheight, int shape, int dilate) {
+    VC_RLE *horiz, *out, *vsrc;
+    VC_SPAN *acc, *tmp, *swap;
+    int width, height, rx, ry, maxspans, n, y, yy, y0, y1, ok = 0;
+
+    // Verificao de erros
+    if ((src == NULL) || (dst == NULL)) return 0;
+    if ((shape != VC_SE_RECT) && (shape != VC_SE_CROSS)) return 0;
+
+    // Um kernel de 0 corresponde a uma janela de 1 pixel
+    if (kwidth < 1) kwidth = 1;
+    if (kheight < 1) kheight = 1;
+    rx = kwidth / 2;
+    ry = kheight / 2;
+    width = src->width;
+    height = src->height;
+    // Segmentos que no se tocam: no mximo um por cada 2 pixels
+    maxspans = (width + 1) / 2;
+
+    horiz = vc_rle_new(width, height);
+    out = vc_rle_new(width, height);
+    acc = (VC_SPAN *) malloc((maxspans + 1) * sizeof(VC_SPAN));
+    tmp = (VC_SPAN *) malloc((maxspans + 1) * sizeof(VC_SPAN));
+    if ((horiz == NULL) || (out == NULL) || (acc == NULL) || (tmp == NULL)) goto cleanup;
+
+    // Janela horizontal de cada linha
+    for (y = 0; y < height; y++) {
+        horiz->rowstart[y] = horiz->nspans;
+        if (!vc_rle_reserve(horiz, src->rowstart[y + 1] - src->rowstart[y])) goto cleanup;
+        horiz->nspans += vc_spans_grow(src->spans + src->rowstart[y], src->rowstart[y + 1] - src->rowstart[y], rx, width,
+                                       horiz->spans + horiz->nspans, dilate);
+    }
+    horiz->rowstart[height] = horiz->nspans;
+
+    // Retngulo: janela vertical sobre as linhas j processadas na horizontal.
+    // Cruz: janela vertical sobre as linhas originais, combinada com a horizontal da prpria linha.
+    vsrc = (shape == VC_SE_RECT) ? horiz : src;
+
+    for (y = 0; y < height; y++) {
+        // As linhas fora da imagem no contam para a janela
+        y0 = (y - ry < 0) ? 0 : y - ry;
+        y1 = (y + ry >= height) ? height - 1 : y + ry;
+
+        n = vsrc->rowstart[y0 + 1] - vsrc->rowstart[y0];
+        memcpy(acc, vsrc->spans + vsrc->rowstart[y0], n * sizeof(VC_SPAN));
+        for (yy = y0 + 1; (yy <= y1) && (dilate || (n > 0)); yy++) {
+            n = vc_spans_combine(acc, n, vsrc->spans + vsrc->rowstart[yy], vsrc->rowstart[yy + 1] - vsrc->rowstart[yy], tmp, dilate);
+            swap = acc;
+            acc = tmp;
+            tmp = swap;
+        }
+        if (shape == VC_SE_CROSS) {
+            n = vc_spans_combine(acc, n, horiz->spans + horiz->rowstart[y], horiz->rowstart[y + 1] - horiz->rowstart[y], tmp, dilate);
+            swap = acc;
+            acc = tmp;
+            tmp = swap;
+        }
+
+        out->rowstart[y] = out->nspans;
+        if (!vc_rle_reserve(out, n)) goto cleanup;
+        memcpy(out->spans + out->nspans, acc, n * sizeof(VC_SPAN));
+        out->nspans += n;
+    }
+    out->rowstart[height] = out->nspans;
+
+    // O resultado passa para dst (os segmentos antigos de dst so libertados)
+    free(dst->spans);
+    free(dst->rowstart);
+    *dst = *out;
+    free(out);
+    out = NULL;
+    ok = 1;
+
+cleanup:
+    vc_rle_free(horiz);
+    vc_rle_free(out);
+    free(acc);
+    free(tmp);
+
+    return ok;
+}
+
+int vc_rle_erode(VC_RLE *src, VC_RLE *dst, int kwidth, int kheight, int shape) {
+    VC_PROFILE_OP(NULL, NULL);
+    return vc_rle_morphology(src, dst, kwidth, kheight, shape, 0);
+}
+
+int vc_rle_dilate(VC_RLE *src, VC_RLE *dst, int kwidth, int kheight, int shape) {
+    VC_PROFILE_OP(NULL, NULL);
+    return vc_rle_morphology(src, dst, kwidth, kheight, shape, 1);
+}
+
+// Etiquetagem diretamente sobre os segmentos (mesmas regras e resultado de vc_binary_blob_labelling).
+// dst pode ser NULL quando s interessa a tabela de blobs.
+OVC *vc_rle_blob_labelling(VC_RLE *src, IVC *dst, int *nlabels, int connectivity) {
+    VC_LABEL_CTX ctx;
+    OVC *blobs = NULL;
+    int nruns, maxlabel, y, i;
+    VC_PROFILE_OP(NULL, dst);
+
+    *nlabels = -1;
+
+    // Verificao de erros
+    if (src == NULL) return NULL;
+    if ((dst != NULL) && ((src->width != dst->width) || (src->height != dst->height))) return NULL;
+    if ((dst != NULL) && (dst->packed || ((dst->channels != 1) && (dst->channels != 2)))) return NULL;
+    if ((connectivity != VC_CONNECTIVITY_4) && (connectivity != VC_CONNECTIVITY_8)) return NULL;
+    maxlabel = (dst == NULL) ? 0x7FFFFFFF : ((dst->channels == 1) ? 255 : 65535);
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.dst = dst;
+    ctx.connectivity = connectivity;
+    // Os segmentos de cada linha j esto no formato da etiquetagem
+    ctx.rowstart = src->rowstart;
+    nruns = src->nspans;
+    ctx.runs = (VC_RUN *) malloc((nruns > 0 ? nruns : 1) * sizeof(VC_RUN));
+    ctx.labels = (int *) malloc((nruns > 0 ? nruns : 1) * sizeof(int));
+    if ((ctx.runs == NULL) || (ctx.labels == NULL)) goto cleanup;
+
+    for (y = 0; y < src->height; y++) {
+        for (i = src->rowstart[y]; i < src->rowstart[y + 1]; i++) {
+            ctx.runs[i].y = y;
+            ctx.runs[i].xs = src->spans[i].xs;
+            ctx.runs[i].xe = src->spans[i].xe;
+            ctx.runs[i].parent = i;
+        }
+        if (y > 0) vc_run_merge_rows(ctx.runs, src->rowstart[y - 1], src->rowstart[y], src->rowstart[y], src->rowstart[y + 1], connectivity);
+    }
+
+    blobs = vc_label_finish(&ctx, src->width, src->height, nruns, maxlabel, nlabels);
+
+cleanup:
+    free(ctx.runs);
+    free(ctx.labels);
+
+    return blobs;
+}
+
+// Escreve um inteiro de comprimento varivel em buf; devolve o nmero de bytes
+static int vc_varint_put(unsigned char *buf, unsigned int v) {
+    int n = 0;
+
+    while (v >= 0x80) {
+        buf[n++] = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (unsigned char) v;
+
+    return n;
+}
+
+// L um inteiro de comprimento varivel (-1 no fim do ficheiro ou se no couber num int).
+// O 5 byte s tem 4 bits teis: com mais, o valor passaria de 32 bits e seria truncado.
+static int vc_reader_varint(VC_READER *reader) {
+    unsigned int v = 0;
+    int shift = 0, c;
+
+    do {
+        if (((c = vc_reader_getc(reader)) == EOF) || (shift > 28) || ((shift == 28) && (c & 0x70))) return -1;
+        v |= (unsigned int) (c & 0x7F) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    return (v > 0x7FFFFFFF) ? -1 : (int) v;
+}
+
+int vc_rle_write(char *filename, VC_RLE *rle) {
+    FILE *file;
+    unsigned char *buf;
+    int maxspans = 0, y, i, n, prev, ok = 1;
+    VC_PROFILE_OP(NULL, NULL);
+
+    if (rle == NULL) return 0;
+
+    for (y = 0; y < rle->height; y++) {
+        n = rle->rowstart[y + 1] - rle->rowstart[y];
+        if (n > maxspans) maxspans = n;
+    }
+    // Cada inteiro ocupa no mximo 5 bytes
+    if ((buf = (unsigned char *) malloc(5 * (1 + 2 * (size_t) maxspans))) == NULL) return 0;
+    if ((file = fopen(filename, "wb")) == NULL) {
+        free(buf);
+        return 0;
+    }
+
+    fprintf(file, "VCRLE %d %d\n", rle->width, rle->height);
+
+    for (y = 0; (y < rle->height) && ok; y++) {
+        n = vc_varint_put(buf, rle->rowstart[y + 1] - rle->rowstart[y]);
+        for (i = rle->rowstart[y], prev = 0; i < rle->rowstart[y + 1]; i++) {
+            n += vc_varint_put(buf + n, rle->spans[i].xs - prev);
+            n += vc_varint_put(buf + n, rle->spans[i].xe - rle->spans[i].xs);
+            prev = rle->spans[i].xe;
+        }
+        ok = (fwrite(buf, 1, n, file) == (size_t) n);
+    }
+
+    if (fclose(file) != 0) ok = 0;
+    free(buf);
+
+#ifdef VC_DEBUG
+    if (!ok) printf("ERROR -> vc_rle_write():\n\tError writing RLE file.\n");
+#endif
+
+    return ok;
+}
+
+VC_RLE *vc_rle_read(char *filename) {
+    VC_READER reader;
+    VC_RLE *rle = NULL;
+    char *magic = "VCRLE";
+    char *error = NULL;
+    int width, height, n, gap, len, prev, y, i, c;
+    VC_PROFILE_OP(NULL, NULL);
+
+    if (!vc_reader_open(&reader, filename)) {
+        error = "File not found.";
+        goto cleanup;
+    }
+
+    // Header
+    c = vc_reader_skip(&reader);
+    for (i = 0; (magic[i] != 0) && (c == magic[i]); i++) c = vc_reader_getc(&reader);
+    if ((magic[i] != 0) || !VC_IS_SPACE(c) || !vc_reader_int(&reader, &width) || !vc_reader_int(&reader, &height) ||
+        ((rle = vc_rle_new(width, height)) == NULL)) {
+        error = "File is not a valid RLE file.\n\tBad magic number or size!";
+        goto cleanup;
+    }
+
+    for (y = 0; y < height; y++) {
+        rle->rowstart[y] = rle->nspans;
+        n = vc_reader_varint(&reader);
+        if ((n < 0) || (n > (width + 1) / 2) || !vc_rle_reserve(rle, n)) break;
+
+        for (i = 0, prev = 0; i < n; i++) {
+            gap = vc_reader_varint(&reader);
+            len = vc_reader_varint(&reader);
+            // Segmentos no vazios, dentro da linha e sem se tocarem
+            if ((gap < 0) || (len <= 0) || ((i > 0) && (gap == 0)) || (gap > width - prev) || (len > width - prev - gap)) break;
+            rle->spans[rle->nspans].xs = prev + gap;
+            rle->spans[rle->nspans].xe = prev + gap + len;
+            rle->nspans++;
+            prev += gap + len;
+        }
+        if (i < n) break;
+    }
+    if (y < height) error = "Premature EOF or bad segment on file.";
+    else rle->rowstart[height] = rle->nspans;
+
+cleanup:
+#ifdef VC_DEBUG
+    if (error != NULL) printf("ERROR -> vc_rle_read():\n\t%s\n", error);
+#endif
+
+    if (error != NULL) rle = vc_rle_free(rle);
+    vc_reader_close(&reader);
+
+    return rle;
+}
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    FUNES: PIPELINE DE OPERADORES
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Bytes de buffers intermdios por tile (pensado para caber na cache L2)
+#define VC_PIPELINE_TILE_BYTES (256 * 1024)
+#define VC_PIPELINE_MIN_TILE_ROWS 8
+
+// Etapa depois da fuso: um kernel pontual (RGB -> cinzentos opcional + tabela) ou uma etapa de vizinhana
+typedef struct {
+    int type;                       // VC_STAGE_MIDPOINT, BOX ou GAUSSIAN, ou VC_STAGE_LUT para um kernel pontual fundido
+    int kernel;
+    int radius;                     // Linhas de halo que a etapa l acima e abaixo
+    VC_FILTER filter;               // VC_STAGE_BOX e VC_STAGE_GAUSSIAN
+    int from_rgb;                   // O kernel comea por converter RGB para cinzentos
+    int identity;                   // A tabela no altera os valores
+    int inchannels, outchannels;
+    unsigned char lut[256 * 3];     // Cinzentos -> 1 ou 3 canais
+    unsigned int words[256];        // Sada de 3 canais: lut em palavras (vc_gray_to_color_row)
+} VC_PIPE_STEP;
+
+typedef struct {
+    VC_PIPE_STEP steps[VC_PIPELINE_MAX_STAGES];
+    int nsteps;
+    int halo;                       // Soma dos raios das etapas de vizinhana
+    int tilerows;
+    IVC *src;
+    IVC *dst;
+    int error;
+} VC_PIPE_CTX;
+
+
+VC_PIPELINE *vc_pipeline_new(void) {
+    VC_PIPELINE *p = (VC_PIPELINE *) calloc(1, sizeof(VC_PIPELINE));
+
+    return p;
+}
+
+VC_PIPELINE *vc_pipeline_free(VC_PIPELINE *p) {
+    if (p != NULL) free(p);
+
+    return NULL;
+}
+
+static VC_STAGE *vc_pipeline_add(VC_PIPELINE *p, int type) {
+    VC_STAGE *stage;
+
+    if ((p == NULL) || (p->nstages >= VC_PIPELINE_MAX_STAGES)) return NULL;
+
+    stage = &p->stages[p->nstages++];
+    memset(stage, 0, sizeof(VC_STAGE));
+    stage->type = type;
+
+    return stage;
+}
+
+int vc_pipeline_add_rgb_to_gray(VC_PIPELINE *p) {
+    return vc_pipeline_add(p, VC_STAGE_RGB_TO_GRAY) != NULL;
+}
+
+// Tabela de 256 entradas aplicada a uma imagem em cinzentos
+int vc_pipeline_add_lut(VC_PIPELINE *p, unsigned char *lut) {
+    VC_STAGE *stage;
+
+    if (lut == NULL) return 0;
+    if ((stage = vc_pipeline_add(p, VC_STAGE_LUT)) == NULL) return 0;
+    memcpy(stage->lut, lut, 256);
+
+    return 1;
+}
+
+// Igual a vc_gray_to_binary(): acima do threshold fica 255, no ou abaixo fica 0
+int vc_pipeline_add_threshold(VC_PIPELINE *p, int threshold) {
+    unsigned char ramp[256], lut[256];
+    int i;
+
+    for (i = 0; i < 256; i++) ramp[i] = (unsigned char) i;
+    vc_gray_to_binary_row_c(ramp, lut, 256, threshold);
+
+    return vc_pipeline_add_lut(p, lut);
+}
+
+int vc_pipeline_add_invert(VC_PIPELINE *p) {
+    unsigned char lut[256];
+    int i;
+
+    for (i = 0; i < 256; i++) lut[i] = (unsigned char) (255 - i);
+
+    return vc_pipeline_add_lut(p, lut);
+}
+
+// Paleta de 256 x 3 bytes (RGB por nvel de cinzento) aplicada a uma imagem em cinzentos
+int vc_pipeline_add_color_lut(VC_PIPELINE *p, unsigned char *lut) {
+    VC_STAGE *stage;
+
+    if (lut == NULL) return 0;
+    if ((stage = vc_pipeline_add(p, VC_STAGE_PALETTE)) == NULL) return 0;
+    memcpy(stage->lut, lut, 256 * 3);
+
+    return 1;
+}
+
+int vc_pipeline_add_colormap(VC_PIPELINE *p, int colormap) {
+    unsigned char lut[256 * 3];
+
+    if (!vc_colormap(colormap, lut)) return 0;
+
+    return vc_pipeline_add_color_lut(p, lut);
+}
+
+int vc_pipeline_add_palette(VC_PIPELINE *p) {
+    return vc_pipeline_add_colormap(p, VC_COLORMAP_DEFAULT);
+}
+
+int vc_pipeline_add_midpoint_threshold(VC_PIPELINE *p, int kernel) {
+    VC_STAGE *stage;
+
+    if ((stage = vc_pipeline_add(p, VC_STAGE_MIDPOINT)) == NULL) return 0;
+    // Um kernel de 0 corresponde a uma janela de 1 pixel
+    stage->kernel = (kernel < 1) ? 1 : kernel;
+
+    return 1;
+}
+
+// Filtros de suavizao antes de um threshold: a imagem filtrada nunca  escrita por inteiro
+int vc_pipeline_add_box_filter(VC_PIPELINE *p, int kernel) {
+    VC_STAGE *stage;
+    VC_FILTER f;
+
+    if (!vc_filter_init(&f, VC_STAGE_BOX, kernel, 0.0f)) return 0;
+    if ((stage = vc_pipeline_add(p, VC_STAGE_BOX)) == NULL) return 0;
+    stage->kernel = kernel;
+
+    return 1;
+}
+
+int vc_pipeline_add_gaussian_filter(VC_PIPELINE *p, int kernel, float sigma) {
+    VC_STAGE *stage;
+    VC_FILTER f;
+
+    if (!vc_filter_init(&f, VC_STAGE_GAUSSIAN, kernel, sigma)) return 0;
+    if ((stage = vc_pipeline_add(p, VC_STAGE_GAUSSIAN)) == NULL) return 0;
+    stage->kernel = kernel;
+    stage->sigma = sigma;
+
+    return 1;
+}
+
+
+// Funde as etapas pontuais consecutivas num nico kernel. Devolve o nmero de canais
+//  sada, ou 0 se a sequncia de etapas no for compatvel com a imagem de entrada.
+static int vc_pipeline_compile(VC_PIPELINE *p, int channels, VC_PIPE_CTX *c) {
+    VC_PIPE_STEP *step = NULL;
+    unsigned char ramp[256], tmp[256 * 3];
+    int i, v, nstages = 0;      // Etapas fundidas no kernel pontual atual
+
+    for (v = 0; v < 256; v++) ramp[v] = (unsigned char) v;
+
+    c->nsteps = 0;
+    c->halo = 0;
+
+    for (i = 0; i < p->nstages; i++) {
+        VC_STAGE *stage = &p->stages[i];
+
+        if (stage->type == VC_STAGE_MIDPOINT) {
+            if (channels != 1) return 0;
+            step = &c->steps[c->nsteps++];
+            step->type = VC_STAGE_MIDPOINT;
+            step->kernel = stage->kernel;
+            step->radius = stage->kernel / 2;
+            step->inchannels = step->outchannels = 1;
+            c->halo += step->radius;
+            nstages = 0;
+            continue;
+        }
+
+        if ((stage->type == VC_STAGE_BOX) || (stage->type == VC_STAGE_GAUSSIAN)) {
+            if ((channels != 1) && (channels != 3)) return 0;
+            step = &c->steps[c->nsteps++];
+            if (!vc_filter_init(&step->filter, stage->type, stage->kernel, stage->sigma)) return 0;
+            step->type = stage->type;
+            step->kernel = stage->kernel;
+            step->radius = step->filter.r;
+            step->inchannels = step->outchannels = channels;
+            c->halo += step->radius;
+            nstages = 0;
+            continue;
+        }
+
+        // Abre um novo kernel pontual (identidade em cinzentos)
+        if (nstages == 0) {
+            step = &c->steps[c->nsteps++];
+            step->type = VC_STAGE_LUT;
+            step->radius = 0;
+            step->from_rgb = 0;
+            step->inchannels = channels;
+            step->outchannels = 1;
+            memcpy(step->lut, ramp, 256);
+        }
+        nstages++;
+
+        switch (stage->type) {
+            case VC_STAGE_RGB_TO_GRAY:
+                if (channels != 3) return 0;
+                if (nstages == 1) {
+                    step->from_rgb = 1;
+                } else {
+                    // Paleta seguida de RGB -> cinzentos: continua a ser uma tabela de cinzentos
+                    vc_rgb_to_gray_row_c(step->lut, tmp, 256);
+                    memcpy(step->lut, tmp, 256);
+                    step->outchannels = 1;
+                }
+                channels = 1;
+                break;
+            case VC_STAGE_LUT:
+                if (channels != 1) return 0;
+                for (v = 0; v < 256; v++) tmp[v] = stage->lut[step->lut[v]];
+                memcpy(step->lut, tmp, 256);
+                break;
+            case VC_STAGE_PALETTE:
+                if (channels != 1) return 0;
+                for (v = 0; v < 256; v++) memcpy(&tmp[v * 3], &stage->lut[step->lut[v] * 3], 3);
+                memcpy(step->lut, tmp, 256 * 3);
+                step->outchannels = 3;
+                channels = 3;
+                break;
+            default:
+                return 0;
+        }
+    }
+
+    for (i = 0; i < c->nsteps; i++) {
+        step = &c->steps[i];
+        step->identity = (step->type == VC_STAGE_LUT) && (step->outchannels == 1) && (memcmp(step->lut, ramp, 256) == 0);
+        if ((step->type == VC_STAGE_LUT) && (step->outchannels == 3)) vc_color_lut_words(step->lut, step->words);
+    }
+
+    return channels;
+}
+
+
+static void vc_pipeline_point_rows(VC_PIPE_STEP *step, IVC *in, IVC *out, int y0, int y1, unsigned char *tmp) {
+    int width = in->width;
+    unsigned char *lut = step->lut;
+    unsigned char *datain, *dataout, *target;
+    int x, y;
+
+    for (y = y0; y < y1; y++) {
+        datain = in->data + y * in->bytesperline;
+        dataout = out->data + y * out->bytesperline;
+
+        if (step->from_rgb) {
+            vc_rgb_to_gray_row(datain, tmp, width);
+            datain = tmp;
+        }
+
+        if (step->outchannels == 3) {
+            vc_gray_to_color_row(datain, dataout, width, step->words);
+            continue;
+        }
+
+        // Numa sada empacotada a linha  calculada em bytes e depois convertida em bits
+        target = out->packed ? tmp : dataout;
+        if (!step->identity) {
+            for (x = 0; x < width; x++) target[x] = lut[datain[x]];
+        } else if (datain != target) {
+            memcpy(target, datain, width);
+        }
+        if (out->packed) vc_pbm_pack_row(target, dataout, width);
+    }
+}
+
+
+// Cada banda  processada em tiles de linhas. Para cada tile, as linhas necessrias a cada
+// etapa so calculadas de trs para a frente (as etapas de vizinhana alargam-nas pelo seu raio)
+// e os resultados intermdios ficam em dois buffers alternados, pequenos o suficiente para a cache.
+static void vc_pipeline_rows(IVC *image, VC_BAND *band, void *ctx) {
+    VC_PIPE_CTX *c = (VC_PIPE_CTX *) ctx;
+    IVC *src = c->src;
+    IVC *dst = c->dst;
+    int width = src->width;
+    int height = src->height;
+    int m = c->nsteps;
+    int bufbpl = VC_ALIGN_UP(width * 3);
+    int caprows = c->tilerows + 2 * c->halo;
+    int lo[VC_PIPELINE_MAX_STAGES + 1], hi[VC_PIPELINE_MAX_STAGES + 1];
+    unsigned char *buf[2] = { NULL, NULL };
+    unsigned char *tmp = NULL;
+    IVC in, out;
+    VC_BAND b;
+    VC_TILE t;
+    VC_OP_CTX mctx;
+    int t0, j, r;
+
+    if (caprows > height) caprows = height;
+    if (m > 1) {
+        buf[0] = vc_buffer_alloc((size_t) caprows * bufbpl);
+        buf[1] = vc_buffer_alloc((size_t) caprows * bufbpl);
+    }
+    tmp = vc_buffer_alloc(VC_ALIGN_UP(width));
+    if ((tmp == NULL) || ((m > 1) && ((buf[0] == NULL) || (buf[1] == NULL)))) {
+        c->error = 1;
+        goto cleanup;
+    }
+
+    for (t0 = band->y0; t0 < band->y1; t0 += c->tilerows) {
+        lo[m] = t0;
+        hi[m] = (t0 + c->tilerows < band->y1) ? t0 + c->tilerows : band->y1;
+        for (j = m - 1; j >= 0; j--) {
+            r = c->steps[j].radius;
+            lo[j] = (lo[j + 1] - r < 0) ? 0 : lo[j + 1] - r;
+            hi[j] = (hi[j + 1] + r > height) ? height : hi[j + 1] + r;
+        }
+
+        for (j = 0; j < m; j++) {
+            // A entrada e a sada de cada etapa partilham a origem lo[j]
+            in = *src;
+            in.height = hi[j] - lo[j];
+            in.channels = c->steps[j].inchannels;
+            if (j == 0) {
+                in.data = src->data + (size_t) lo[j] * src->bytesperline;
+            } else {
+                in.data = buf[(j - 1) & 1] + (size_t) (lo[j] - lo[0]) * bufbpl;
+                in.bytesperline = bufbpl;
+                in.packed = 0;
+            }
+
+            out = *dst;
+            out.height = in.height;
+            out.channels = c->steps[j].outchannels;
+            if (j == m - 1) {
+                out.data = dst->data + (size_t) lo[j] * dst->bytesperline;
+            } else {
+                out.data = buf[j & 1] + (size_t) (lo[j] - lo[0]) * bufbpl;
+                out.bytesperline = bufbpl;
+                out.packed = 0;
+            }
+
+            b.y0 = b.hy0 = lo[j + 1] - lo[j];
+            b.y1 = b.hy1 = hi[j + 1] - lo[j];
+            b.thread = band->thread;
+
+            if (c->steps[j].type == VC_STAGE_MIDPOINT) {
+                mctx.src = &in;
+                mctx.dst = &out;
+                mctx.kernel = c->steps[j].kernel;
+                mctx.error = 0;
+                t.x0 = t.hx0 = 0;
+                t.x1 = t.hx1 = in.width;
+                t.y0 = t.hy0 = b.y0;
+                t.y1 = t.hy1 = b.y1;
+                t.thread = b.thread;
+                vc_gray_midpoint_threshold_tile(NULL, &t, &mctx);
+                if (mctx.error) {
+                    c->error = 1;
+                    goto cleanup;
+                }
+            } else if (c->steps[j].type != VC_STAGE_LUT) {
+                if (!vc_filter_rows(&c->steps[j].filter, &in, &out, b.y0, b.y1)) {
+                    c->error = 1;
+                    goto cleanup;
+                }
+            } else {
+                vc_pipeline_point_rows(&c->steps[j], &in, &out, b.y0, b.y1, tmp);
+            }
+        }
+    }
+
+cleanup:
+    vc_buffer_free(buf[0]);
+    vc_buffer_free(buf[1]);
+    vc_buffer_free(tmp);
+}
+
+
+// Executa um pipeline j compilado para src->channels (vc_pipeline_compile) de src para dst,
+// numa nica passagem pela imagem (tile a tile). O contexto pode ser reutilizado de imagem para
+// imagem. Atualiza as estatsticas do pipeline: kernels, passagens e bytes poupados.
+static int vc_pipeline_execute(VC_PIPELINE *p, VC_PIPE_CTX *c, IVC *src, IVC *dst) {
+    IVC *copy = NULL;
+    int channels, i, ok;
+    long long pixels;
+
+    if (p->tilerows > 0) {
+        c->tilerows = p->tilerows;
+    } else {
+        c->tilerows = VC_PIPELINE_TILE_BYTES / (2 * VC_ALIGN_UP(src->width * 3)) - 2 * c->halo;
+        if (c->tilerows < VC_PIPELINE_MIN_TILE_ROWS) c->tilerows = VC_PIPELINE_MIN_TILE_ROWS;
+    }
+    // Sem etapas de vizinhana cada linha s l a linha que escreve: src == dst  possvel, desde
+    // que as linhas de src e de dst coincidam (mesmo bytesperline e mesmo nmero de canais; um
+    // kernel 3 -> 1 ou 1 -> 3 canais escreveria sobre pixels de src ainda por ler).
+    // Com halo, ou com vistas sobrepostas e desfasadas, trabalha-se sobre uma cpia de src.
+    if (vc_image_overlaps(src, dst) && ((c->halo > 0) || (src->data != dst->data) || (src->bytesperline != dst->bytesperline) ||
+                                        (src->channels != dst->channels) || dst->packed)) {
+        if ((copy = vc_image_copy(src)) == NULL) return 0;
+        src = copy;
+    }
+    c->src = src;
+    c->dst = dst;
+    c->error = 0;
+    vc_pbm_tables_init();
+    vc_get_simd_level();
+
+    ok = vc_parallel_rows_halo(dst, c->halo, vc_pipeline_rows, c) && !c->error;
+
+    // Executadas uma a uma, cada etapa seria uma passagem completa e cada imagem intermdia
+    // seria escrita e depois lida da memria
+    pixels = (long long) src->width * src->height;
+    p->kernels = c->nsteps;
+    p->passes = 1;
+    p->passes_saved = p->nstages - 1;
+    p->bytes_saved = 0;
+    channels = src->channels;
+    for (i = 0; i < p->nstages - 1; i++) {
+        if (p->stages[i].type == VC_STAGE_RGB_TO_GRAY) channels = 1;
+        else if (p->stages[i].type == VC_STAGE_PALETTE) channels = 3;
+        p->bytes_saved += 2 * pixels * channels;
+    }
+
+    vc_image_free(copy);
+
+    return ok;
+}
+
+// Executa o pipeline de src para dst numa nica passagem pela imagem (tile a tile).
+// Atualiza as estatsticas do pipeline: kernels, passagens e bytes poupados.
+int vc_pipeline_run(VC_PIPELINE *p, IVC *src, IVC *dst) {
+    VC_PIPE_CTX *c;
+    int channels, ok;
+    VC_PROFILE_OP(src, dst);
+
+    // Verificao de erros
+    if ((p == NULL) || (p->nstages <= 0)) return 0;
+    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
+    if ((src->width != dst->width) || (src->height != dst->height)) return 0;
+    if (src->packed) return 0;
+
+    if ((c = (VC_PIPE_CTX *) malloc(sizeof(VC_PIPE_CTX))) == NULL) return 0;
+
+    channels = vc_pipeline_compile(p, src->channels, c);
+    ok = (channels != 0) && (channels == dst->channels) && !(dst->packed && (channels != 1)) && vc_pipeline_execute(p, c, src, dst);
+    free(c);
+
+    return ok;
+}
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    FUNES: PROCESSAMENTO EM LOTE DE SEQUNCIAS DE IMAGENS
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Imagens em trnsito por cada worker (leituras antecipadas e escritas pendentes)
+#define VC_BATCH_FRAMES_PER_WORKER 2
+
+typedef struct {
+    char *name;             // Caminho do ficheiro de entrada
+    IVC *src;
+    IVC *dst;
+} VC_FRAME;
+
+// Fila limitada entre threads (bloqueia quando est cheia ou vazia)
+typedef struct {
+    VC_FRAME **items;
+    int capacity, head, count;
+    int closed;
+    pthread_mutex_t mutex;
+    pthread_cond_t notempty, notfull;
+} VC_QUEUE;
+
+typedef struct {
+    char **files;
+    int nfiles;
+    char *outdir;
+    VC_PIPELINE *pipeline;
+    VC_QUEUE input;         // Leitor -> workers
+    VC_QUEUE output;        // Workers -> escritor
+    int activeworkers;      // O ltimo worker a sair fecha a fila de sada
+    int written, failed;
+    pthread_mutex_t mutex;
+} VC_BATCH;
+
+
+static int vc_queue_init(VC_QUEUE *q, int capacity) {
+    q->items = (VC_FRAME **) malloc(capacity * sizeof(VC_FRAME *));
+    if (q->items == NULL) return 0;
+    q->capacity = capacity;
+    q->head = q->count = q->closed = 0;
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->notempty, NULL);
+    pthread_cond_init(&q->notfull, NULL);
+
+    return 1;
+}
+
+static void vc_queue_destroy(VC_QUEUE *q) {
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->notempty);
+    pthread_cond_destroy(&q->notfull);
+    free(q->items);
+}
+
+static void vc_queue_push(VC_QUEUE *q, VC_FRAME *frame) {
+    pthread_mutex_lock(&q->mutex);
+    while (q->count == q->capacity) pthread_cond_wait(&q->notfull, &q->mutex);
+    q->items[(q->head + q->count) % q->capacity] = frame;
+    q->count++;
+    pthread_cond_signal(&q->notempty);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+// Devolve NULL quando a fila est fechada e vazia
+static VC_FRAME *vc_queue_pop(VC_QUEUE *q) {
+    VC_FRAME *frame = NULL;
+
+    pthread_mutex_lock(&q->mutex);
+    while ((q->count == 0) && !q->closed) pthread_cond_wait(&q->notempty, &q->mutex);
+    if (q->count > 0) {
+        frame = q->items[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+        pthread_cond_signal(&q->notfull);
+    }
+    pthread_mutex_unlock(&q->mutex);
+
+    return frame;
+}
+
+static void vc_queue_close(VC_QUEUE *q) {
+    pthread_mutex_lock(&q->mutex);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->notempty);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+
+static void vc_batch_fail(VC_BATCH *b, VC_FRAME *frame, char *what) {
+#ifdef VC_DEBUG
+    printf("ERROR -> vc_batch_process():\n\t%s: %s\n", what, frame->name);
+#endif
+    pthread_mutex_lock(&b->mutex);
+    b->failed++;
+    pthread_mutex_unlock(&b->mutex);
+
+    vc_image_free(frame->src);
+    vc_image_free(frame->dst);
+    free(frame);
+}
+
+// Thread de leitura: l as imagens por ordem,  frente dos workers (at a fila encher)
+static void *vc_batch_reader(void *arg) {
+    VC_BATCH *b = (VC_BATCH *) arg;
+    VC_FRAME *frame;
+    int i;
+
+    for (i = 0; i < b->nfiles; i++) {
+        if ((frame = (VC_FRAME *) calloc(1, sizeof(VC_FRAME))) == NULL) break;
+        frame->name = b->files[i];
+        if ((frame->src = vc_read_image(frame->name)) == NULL) {
+            vc_batch_fail(b, frame, "Can't read image");
+            continue;
+        }
+        vc_queue_push(&b->input, frame);
+    }
+    vc_queue_close(&b->input);
+
+    return NULL;
+}
+
+// Workers: cada imagem  processada inteira por um s worker (o paralelismo  entre imagens),
+// com os buffers a virem da pool de vc_image_new(), reaproveitados de imagem para imagem.
+// O pipeline  compilado uma vez por worker (para cada nmero de canais de entrada, 1 ou 3,
+// na primeira imagem que o tenha) e o contexto compilado serve para todas as imagens.
+static void *vc_batch_worker(void *arg) {
+    VC_BATCH *b = (VC_BATCH *) arg;
+    VC_PIPELINE pipeline = *b->pipeline;    // Cpia: as estatsticas de cada execuo so locais
+    VC_PIPE_CTX *compiled[2] = { NULL, NULL };
+    int outchannels[2] = { 0, 0 };
+    VC_FRAME *frame;
+    int channels, last, k;
+
+    vc_thread_busy = 1;
+
+    while ((frame = vc_queue_pop(&b->input)) != NULL) {
+        k = (frame->src->channels == 3);
+        if ((compiled[k] == NULL) && ((compiled[k] = (VC_PIPE_CTX *) malloc(sizeof(VC_PIPE_CTX))) != NULL)) {
+            outchannels[k] = vc_pipeline_compile(&pipeline, frame->src->channels, compiled[k]);
+        }
+        channels = (compiled[k] != NULL) ? outchannels[k] : 0;
+        if (channels > 0) frame->dst = vc_image_new(frame->src->width, frame->src->height, channels, 255);
+        if ((frame->dst == NULL) || !vc_pipeline_execute(&pipeline, compiled[k], frame->src, frame->dst)) {
+            vc_batch_fail(b, frame, "Pipeline failed");
+            continue;
+        }
+        frame->src = vc_image_free(frame->src);
+        vc_queue_push(&b->output, frame);
+    }
+
+    free(compiled[0]);
+    free(compiled[1]);
+
+    pthread_mutex_lock(&b->mutex);
+    last = (--b->activeworkers == 0);
+    pthread_mutex_unlock(&b->mutex);
+    if (last) vc_queue_close(&b->output);
 
-	if(image == NULL) return NULL;
-	if((levels <= 0) || (levels > 255)) return NULL;
+    return NULL;
+}
 
-	image->width = width;
-	image->height = height;
-	image->channels = channels;
-	image->levels = levels;
-	image->bytesperline = image->width * image->channels;
-	image->data = (unsigned char *) malloc(image->width * image->height * image->channels * sizeof(char));
+// Thread de escrita: escreve os resultados  medida que ficam prontos
+static void *vc_batch_writer(void *arg) {
+    VC_BATCH *b = (VC_BATCH *) arg;
+    VC_FRAME *frame;
+    char *base, path[FILENAME_MAX];
 
-	if(image->data == NULL)
-	{
-		return vc_image_free(image);
-	}
+    while ((frame = vc_queue_pop(&b->output)) != NULL) {
+        base = strrchr(frame->name, '/');
+#ifdef _WIN32
+        if (strrchr(frame->name, '\\') > base) base = strrchr(frame->name, '\\');
+#endif
+        base = (base != NULL) ? base + 1 : frame->name;
+        snprintf(path, sizeof(path), "%s/%s", b->outdir, base);
 
-	return image;
+        if (!vc_write_image(path, frame->dst)) {
+            vc_batch_fail(b, frame, "Can't write image");
+            continue;
+        }
+        pthread_mutex_lock(&b->mutex);
+        b->written++;
+        pthread_mutex_unlock(&b->mutex);
+
+        vc_image_free(frame->dst);
+        free(frame);
+    }
+
+    return NULL;
 }
 
+static int vc_batch_is_image(char *name) {
+    char *ext = strrchr(name, '.');
 
-// Libertar memria de uma imagem
-IVC *vc_image_free(IVC *image)
-{
-	if(image != NULL)
-	{
-		if(image->data != NULL)
-		{
-			free(image->data);
-			image->data = NULL;
-		}
+    if (ext == NULL) return 0;
+    return (strcmp(ext, ".pbm") == 0) || (strcmp(ext, ".pgm") == 0) || (strcmp(ext, ".ppm") == 0);
+}
 
-		free(image);
-		image = NULL;
-	}
+static int vc_batch_compare(const void *a, const void *b) {
+    return strcmp(*(char **) a, *(char **) b);
+}
 
-	return image;
+static int vc_batch_add_file(VC_BATCH *b, int *capacity, char *path) {
+    char **grown;
+
+    if (b->nfiles == *capacity) {
+        *capacity = (*capacity > 0) ? 2 * *capacity : 64;
+        if ((grown = (char **) realloc(b->files, *capacity * sizeof(char *))) == NULL) return 0;
+        b->files = grown;
+    }
+    if ((b->files[b->nfiles] = (char *) malloc(strlen(path) + 1)) == NULL) return 0;
+    strcpy(b->files[b->nfiles++], path);
+
+    return 1;
 }
 
+// Lista as imagens PBM/PGM/PPM de uma pasta, ou os ficheiros de um padro ("seq/flir-*.pgm"), por ordem
+static int vc_batch_list(VC_BATCH *b, char *input) {
+    char path[FILENAME_MAX];
+    int capacity = 0;
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find;
+    DWORD attributes = GetFileAttributesA(input);
+    char *dir, *sep;
+    int isdir = (attributes != INVALID_FILE_ATTRIBUTES) && (attributes & FILE_ATTRIBUTE_DIRECTORY);
 
-//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-//    FUNES: LEITURA E ESCRITA DE IMAGENS (PBM, PGM E PPM)
-//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+    snprintf(path, sizeof(path), isdir ? "%s\\*" : "%s", input);
+    if ((find = FindFirstFileA(path, &data)) == INVALID_HANDLE_VALUE) return 1;
+    // FindFirstFile devolve s o nome: junta-lhe a pasta do padro
+    dir = isdir ? input : NULL;
+    sep = isdir ? NULL : strrchr(input, '\\');
+    if ((sep == NULL) && !isdir) sep = strrchr(input, '/');
+    do {
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        if (isdir && !vc_batch_is_image(data.cFileName)) continue;
+        if (dir != NULL) snprintf(path, sizeof(path), "%s\\%s", dir, data.cFileName);
+        else if (sep != NULL) snprintf(path, sizeof(path), "%.*s%s", (int) (sep - input + 1), input, data.cFileName);
+        else snprintf(path, sizeof(path), "%s", data.cFileName);
+        if (!vc_batch_add_file(b, &capacity, path)) {
+            FindClose(find);
+            return 0;
+        }
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    struct stat st;
+    DIR *dir;
+    struct dirent *entry;
+    glob_t g;
+    size_t i;
 
+    if ((stat(input, &st) == 0) && S_ISDIR(st.st_mode)) {
+        if ((dir = opendir(input)) == NULL) return 0;
+        while ((entry = readdir(dir)) != NULL) {
+            if (!vc_batch_is_image(entry->d_name)) continue;
+            snprintf(path, sizeof(path), "%s/%s", input, entry->d_name);
+            if ((stat(path, &st) != 0) || !S_ISREG(st.st_mode)) continue;
+            if (!vc_batch_add_file(b, &capacity, path)) {
+                closedir(dir);
+                return 0;
+            }
+        }
+        closedir(dir);
+    } else if (glob(input, 0, NULL, &g) == 0) {
+        for (i = 0; i < g.gl_pathc; i++) {
+            if (!vc_batch_add_file(b, &capacity, g.gl_pathv[i])) {
+                globfree(&g);
+                return 0;
+            }
+        }
+        globfree(&g);
+    }
+#endif
 
-char *netpbm_get_token(FILE *file, char *tok, int len)
-{
-	char *t;
-	int c;
-	
-	for(;;)
-	{
-		while(isspace(c = getc(file)));
-		if(c != '#') break;
-		do c = getc(file);
-		while((c != '\n') && (c != EOF));
-		if(c == EOF) break;
-	}
-	
-	t = tok;
-	
-	if(c != EOF)
-	{
-		do
-		{
-			*t++ = c;
-			c = getc(file);
-		} while((!isspace(c)) && (c != '#') && (c != EOF) && (t - tok < len - 1));
-		
-		if(c == '#') ungetc(c, file);
-	}
-	
-	*t = 0;
-	
-	return tok;
+    if (b->nfiles > 1) qsort(b->files, b->nfiles, sizeof(char *), vc_batch_compare);
+
+    return 1;
 }
 
+// Aplica o pipeline a todas as imagens de input (pasta ou padro) e escreve os resultados
+// em outdir, com o mesmo nome. Uma thread l as imagens seguintes enquanto nworkers threads
+// (0 = vc_get_num_threads()) processam as atuais e outra thread escreve as j processadas.
+// Devolve o nmero de imagens escritas, ou -1 em caso de erro.
+int vc_batch_process(char *input, char *outdir, VC_PIPELINE *pipeline, int nworkers) {
+    VC_BATCH b;
+    pthread_t reader, writer, workers[VC_MAX_THREADS];
+    int i, started = 0, ok = 0;
+    VC_PROFILE_OP(NULL, NULL);
 
-long int unsigned_char_to_bit(unsigned char *datauchar, unsigned char *databit, int width, int height)
-{
-	int x, y;
-	int countbits;
-	long int pos, counttotalbytes;
-	unsigned char *p = databit;
+    // Verificao de erros
+    if ((input == NULL) || (outdir == NULL) || (pipeline == NULL) || (pipeline->nstages <= 0)) return -1;
 
-	*p = 0;
-	countbits = 1;
-	counttotalbytes = 0;
+    if (nworkers <= 0) nworkers = vc_get_num_threads();
+    if (nworkers > VC_MAX_THREADS) nworkers = VC_MAX_THREADS;
 
-	for(y=0; y<height; y++)
-	{
-		for(x=0; x<width; x++)
-		{
-			pos = width * y + x;
+    memset(&b, 0, sizeof(b));
+    b.outdir = outdir;
+    b.pipeline = pipeline;
+    b.activeworkers = nworkers;
+    pthread_mutex_init(&b.mutex, NULL);
 
-			if(countbits <= 8)
-			{
-				// Numa imagem PBM:
-				// 1 = Preto
-				// 0 = Branco
-				//*p |= (datauchar[pos] != 0) << (8 - countbits);
-				
-				// Na nossa imagem:
-				// 1 = Branco
-				// 0 = Preto
-				*p |= (datauchar[pos] == 0) << (8 - countbits);
-
-				countbits++;
-			}
-			if((countbits > 8) || (x == width - 1))
-			{
-				p++;
-				*p = 0;
-				countbits = 1;
-				counttotalbytes++;
-			}
-		}
-	}
+    if (!vc_batch_list(&b, input)) goto cleanup;
+    if (!vc_queue_init(&b.input, nworkers * VC_BATCH_FRAMES_PER_WORKER)) goto cleanup;
+    if (!vc_queue_init(&b.output, nworkers * VC_BATCH_FRAMES_PER_WORKER)) {
+        vc_queue_destroy(&b.input);
+        goto cleanup;
+    }
+    vc_pbm_tables_init();
+    vc_get_simd_level();
+
+    if (pthread_create(&reader, NULL, vc_batch_reader, &b) == 0) {
+        if (pthread_create(&writer, NULL, vc_batch_writer, &b) == 0) {
+            for (started = 0; started < nworkers; started++) {
+                if (pthread_create(&workers[started], NULL, vc_batch_worker, &b) != 0) break;
+            }
+            // Se faltarem workers, os que arrancaram fazem o trabalho todo
+            pthread_mutex_lock(&b.mutex);
+            b.activeworkers -= nworkers - started;
+            if (b.activeworkers == 0) vc_queue_close(&b.output);
+            pthread_mutex_unlock(&b.mutex);
+            if (started == 0) {
+                // Sem workers: esvazia a fila de entrada para o leitor poder terminar
+                VC_FRAME *frame;
+                while ((frame = vc_queue_pop(&b.input)) != NULL) vc_batch_fail(&b, frame, "No worker threads");
+            }
+
+            for (i = 0; i < started; i++) pthread_join(workers[i], NULL);
+            pthread_join(writer, NULL);
+            ok = 1;
+        } else {
+            VC_FRAME *frame;
+            while ((frame = vc_queue_pop(&b.input)) != NULL) vc_batch_fail(&b, frame, "No writer thread");
+        }
+        pthread_join(reader, NULL);
+    }
+
+    vc_queue_destroy(&b.input);
+    vc_queue_destroy(&b.output);
 
-	return counttotalbytes;
+cleanup:
+    for (i = 0; i < b.nfiles; i++) free(b.files[i]);
+    free(b.files);
+    pthread_mutex_destroy(&b.mutex);
+
+    return ok ? b.written : -1;
 }
 
 
-void bit_to_unsigned_char(unsigned char *databit, unsigned char *datauchar, int width, int height)
-{
-	int x, y;
-	int countbits;
-	long int pos;
-	unsigned char *p = databit;
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//    FUNES: LEITURA E ESCRITA ASSNCRONAS DE IMAGENS
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 
-	countbits = 1;
+// Enquanto se processa uma imagem, a leitura da seguinte e a escrita da anterior decorrem em
+// segundo plano. O backend s move bytes: uma leitura traz o ficheiro inteiro para um buffer
+// da pool e uma escrita leva para o ficheiro a imagem j serializada. A converso de/para IVC
+//  feita em memria pela thread que chama (vc_aio_wait_read e vc_aio_write), para imagens
+// de uma lista de imagens livres: em regime estvel no h alocaes nem I/O sncrono.
+//
+// Backends: io_uring (Linux; s as transferncias passam pelo anel, a abertura do ficheiro 
+// feita ao submeter) ou uma thread de I/O que executa os pedidos por ordem.
 
-	for(y=0; y<height; y++)
-	{
-		for(x=0; x<width; x++)
-		{
-			pos = width * y + x;
+#define VC_AIO_PATH 1024            // Comprimento mximo do nome de um ficheiro
+#define VC_AIO_MAX_IMAGES 16        // Imagens livres guardadas
 
-			if(countbits <= 8)
-			{
-				// Numa imagem PBM:
-				// 1 = Preto
-				// 0 = Branco
-				//datauchar[pos] = (*p & (1 << (8 - countbits))) ? 1 : 0;
-
-				// Na nossa imagem:
-				// 1 = Branco
-				// 0 = Preto
-				datauchar[pos] = (*p & (1 << (8 - countbits))) ? 0 : 1;
-				
-				countbits++;
-			}
-			if((countbits > 8) || (x == width - 1))
-			{
-				p++;
-				countbits = 1;
-			}
-		}
-	}
-}
+// Estado de um pedido
+#define VC_AIO_FREE 0
+#define VC_AIO_PENDING 1            // Submetido
+#define VC_AIO_ACTIVE 2             // A ser executado pela thread de I/O
+#define VC_AIO_DONE 3               // Leitura terminada,  espera de vc_aio_wait_read()
 
+typedef struct {
+    int state;
+    int write;                      // 0 = leitura; 1 = escrita
+    unsigned long seq;              // Ordem de submisso
+    char filename[VC_AIO_PATH];
+    unsigned char *buf;             // Contedo do ficheiro (buffer da pool)
+    size_t size;                    // Bytes do ficheiro
+    size_t done;                    // Bytes j transferidos (io_uring)
+    int fd;
+    int error;
+#ifdef VC_HAVE_IO_URING
+    struct iovec iov;
+#endif
+} VC_AIO_SLOT;
 
-IVC *vc_read_image(char *filename)
-{
-	FILE *file = NULL;
-	IVC *image = NULL;
-	unsigned char *tmp;
-	char tok[20];
-	long int size, sizeofbinarydata;
-	int width, height, channels;
-	int levels = 255;
-	int v;
-	
-	// Abre o ficheiro
-	if((file = fopen(filename, "rb")) != NULL)
-	{
-		// Efectua a leitura do header
-		netpbm_get_token(file, tok, sizeof(tok));
+struct VC_AIO {
+    int backend;
+    int depth;
+    VC_AIO_SLOT *slots;
+    unsigned long seq;
+    int errors;                     // Escritas falhadas desde o ltimo vc_aio_flush()
+    IVC *images[VC_AIO_MAX_IMAGES]; // Imagens livres
+    int nimages;
+    pthread_mutex_t mutex;
+    // Thread de I/O
+    pthread_t thread;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    int started;
+    int quit;
+#ifdef VC_HAVE_IO_URING
+    int ring;
+    unsigned char *sqring, *cqring;
+    size_t sqringsize, cqringsize;
+    struct io_uring_sqe *sqes;
+    size_t sqessize;
+    unsigned *sqtail, *sqmask, *sqarray;
+    unsigned *cqhead, *cqtail, *cqmask;
+    struct io_uring_cqe *cqes;
+#endif
+};
 
-		if(strcmp(tok, "P4") == 0) { channels = 1; levels = 1; }	// Se PBM (Binary [0,1])
-		else if(strcmp(tok, "P5") == 0) channels = 1;				// Se PGM (Gray [0,MAX(level,255)])
-		else if(strcmp(tok, "P6") == 0) channels = 3;				// Se PPM (RGB [0,MAX(level,255)])
-		else
-		{
-			#ifdef VC_DEBUG
-			printf("ERROR -> vc_read_image():\n\tFile is not a valid PBM, PGM or PPM file.\n\tBad magic number!\n");
-			#endif
 
-			fclose(file);
-			return NULL;
-		}
-		
-		if(levels == 1) // PBM
-		{
-			if(sscanf(netpbm_get_token(file, tok, sizeof(tok)), "%d", &width) != 1 || 
-			   sscanf(netpbm_get_token(file, tok, sizeof(tok)), "%d", &height) != 1)
-			{
-				#ifdef VC_DEBUG
-				printf("ERROR -> vc_read_image():\n\tFile is not a valid PBM file.\n\tBad size!\n");
-				#endif
+// Transferncia sncrona de um pedido (thread de I/O)
+static void vc_aio_transfer(VC_AIO_SLOT *slot) {
+    FILE *file;
+    long size;
 
-				fclose(file);
-				return NULL;
-			}
+    if (slot->write) {
+        if ((file = fopen(slot->filename, "wb")) == NULL) {
+            slot->error = 1;
+            return;
+        }
+        if (fwrite(slot->buf, 1, slot->size, file) != slot->size) slot->error = 1;
+        if (fclose(file) != 0) slot->error = 1;
+        return;
+    }
 
-			// Aloca memria para imagem
-			image = vc_image_new(width, height, channels, levels);
-			if(image == NULL) return NULL;
+    if ((file = fopen(slot->filename, "rb")) == NULL) {
+        slot->error = 1;
+        return;
+    }
+    if ((fseek(file, 0, SEEK_END) != 0) || ((size = ftell(file)) <= 0) || (fseek(file, 0, SEEK_SET) != 0) ||
+        ((slot->buf = vc_buffer_alloc((size_t) size)) == NULL) || (fread(slot->buf, 1, (size_t) size, file) != (size_t) size)) {
+        slot->error = 1;
+    } else {
+        slot->size = (size_t) size;
+    }
+    fclose(file);
+}
 
-			sizeofbinarydata = (image->width / 8 + ((image->width % 8) ? 1 : 0)) * image->height;
-			tmp = (unsigned char *) malloc(sizeofbinarydata);
-			if(tmp == NULL) return 0;
+// Termina um pedido: uma escrita liberta logo o pedido; uma leitura fica  espera de vc_aio_wait_read()
+// (chamar com aio->mutex bloqueado)
+static void vc_aio_complete(VC_AIO *aio, VC_AIO_SLOT *slot) {
+    if (slot->write) {
+        vc_buffer_free(slot->buf);
+        slot->buf = NULL;
+        aio->errors += slot->error;
+        slot->state = VC_AIO_FREE;
+    } else {
+        slot->state = VC_AIO_DONE;
+    }
+}
 
-			#ifdef VC_DEBUG
-			printf("\nchannels=%d w=%d h=%d levels=%d\n", image->channels, image->width, image->height, levels);
-			#endif
+static void *vc_aio_thread(void *arg) {
+    VC_AIO *aio = (VC_AIO *) arg;
+    VC_AIO_SLOT *slot;
+    int i, next;
 
-			if((v = fread(tmp, sizeof(unsigned char), sizeofbinarydata, file)) != sizeofbinarydata)
-			{
-				#ifdef VC_DEBUG
-				printf("ERROR -> vc_read_image():\n\tPremature EOF on file.\n");
-				#endif
-
-				vc_image_free(image);
-				fclose(file);
-				free(tmp);
-				return NULL;
-			}
+    pthread_mutex_lock(&aio->mutex);
+    for (;;) {
+        // Prximo pedido por ordem de submisso
+        for (i = 0, next = -1; i < aio->depth; i++) {
+            if ((aio->slots[i].state == VC_AIO_PENDING) && ((next < 0) || (aio->slots[i].seq < aio->slots[next].seq))) next = i;
+        }
+        if (next < 0) {
+            if (aio->quit) break;
+            pthread_cond_wait(&aio->work, &aio->mutex);
+            continue;
+        }
 
-			bit_to_unsigned_char(tmp, image->data, image->width, image->height);
+        slot = &aio->slots[next];
+        slot->state = VC_AIO_ACTIVE;
+        pthread_mutex_unlock(&aio->mutex);
 
-			free(tmp);
-		}
-		else // PGM ou PPM
-		{
-			if(sscanf(netpbm_get_token(file, tok, sizeof(tok)), "%d", &width) != 1 || 
-			   sscanf(netpbm_get_token(file, tok, sizeof(tok)), "%d", &height) != 1 || 
-			   sscanf(netpbm_get_token(file, tok, sizeof(tok)), "%d", &levels) != 1 || levels <= 0 || levels > 255)
-			{
-				#ifdef VC_DEBUG
-				printf("ERROR -> vc_read_image():\n\tFile is not a valid PGM or PPM file.\n\tBad size!\n");
-				#endif
+        vc_aio_transfer(slot);
 
-				fclose(file);
-				return NULL;
-			}
+        pthread_mutex_lock(&aio->mutex);
+        vc_aio_complete(aio, slot);
+        pthread_cond_broadcast(&aio->done);
+    }
+    pthread_mutex_unlock(&aio->mutex);
 
-			// Aloca memria para imagem
-			image = vc_image_new(width, height, channels, levels);
-			if(image == NULL) return NULL;
+    return NULL;
+}
 
-			#ifdef VC_DEBUG
-			printf("\nchannels=%d w=%d h=%d levels=%d\n", image->channels, image->width, image->height, levels);
-			#endif
 
-			size = image->width * image->height * image->channels;
+#ifdef VC_HAVE_IO_URING
+static int vc_uring_setup(VC_AIO *aio) {
+    struct io_uring_params params;
 
-			if((v = fread(image->data, sizeof(unsigned char), size, file)) != size)
-			{
-				#ifdef VC_DEBUG
-				printf("ERROR -> vc_read_image():\n\tPremature EOF on file.\n");
-				#endif
+    memset(&params, 0, sizeof(params));
+    aio->ring = (int) syscall(__NR_io_uring_setup, aio->depth, &params);
+    if (aio->ring < 0) return 0;
 
-				vc_image_free(image);
-				fclose(file);
-				return NULL;
-			}
-		}
-		
-		fclose(file);
-	}
-	else
-	{
-		#ifdef VC_DEBUG
-		printf("ERROR -> vc_read_image():\n\tFile not found.\n");
-		#endif
-	}
-	
-	return image;
+    aio->sqringsize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    aio->cqringsize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    aio->sqessize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    aio->sqring = (unsigned char *) mmap(NULL, aio->sqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring, IORING_OFF_SQ_RING);
+    aio->cqring = (unsigned char *) mmap(NULL, aio->cqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring, IORING_OFF_CQ_RING);
+    aio->sqes = (struct io_uring_sqe *) mmap(NULL, aio->sqessize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring, IORING_OFF_SQES);
+    if ((aio->sqring == MAP_FAILED) || (aio->cqring == MAP_FAILED) || (aio->sqes == MAP_FAILED)) return 0;
+
+    aio->sqtail = (unsigned *) (aio->sqring + params.sq_off.tail);
+    aio->sqmask = (unsigned *) (aio->sqring + params.sq_off.ring_mask);
+    aio->sqarray = (unsigned *) (aio->sqring + params.sq_off.array);
+    aio->cqhead = (unsigned *) (aio->cqring + params.cq_off.head);
+    aio->cqtail = (unsigned *) (aio->cqring + params.cq_off.tail);
+    aio->cqmask = (unsigned *) (aio->cqring + params.cq_off.ring_mask);
+    aio->cqes = (struct io_uring_cqe *) (aio->cqring + params.cq_off.cqes);
+
+    return 1;
 }
 
+static void vc_uring_teardown(VC_AIO *aio) {
+    if ((aio->sqes != NULL) && (aio->sqes != MAP_FAILED)) munmap(aio->sqes, aio->sqessize);
+    if ((aio->cqring != NULL) && (aio->cqring != MAP_FAILED)) munmap(aio->cqring, aio->cqringsize);
+    if ((aio->sqring != NULL) && (aio->sqring != MAP_FAILED)) munmap(aio->sqring, aio->sqringsize);
+    if (aio->ring >= 0) close(aio->ring);
+}
 
-int vc_write_image(char *filename, IVC *image)
-{
-	FILE *file = NULL;
-	unsigned char *tmp;
-	long int totalbytes, sizeofbinarydata;
-	
-	if(image == NULL) return 0;
+// Submete a transferncia do que falta do pedido (um readv/writev a partir de slot->done).
+// Se o SQE no for consumido,  retirado do anel: o pedido falha sem ficar meio submetido.
+static int vc_uring_submit(VC_AIO *aio, int index) {
+    VC_AIO_SLOT *slot = &aio->slots[index];
+    struct io_uring_sqe *sqe;
+    unsigned tail = *aio->sqtail;
+    unsigned i = tail & *aio->sqmask;
+    long ret;
 
-	if((file = fopen(filename, "wb")) != NULL)
-	{
-		if(image->levels == 1)
-		{
-			sizeofbinarydata = (image->width / 8 + ((image->width % 8) ? 1 : 0)) * image->height + 1;
-			tmp = (unsigned char *) malloc(sizeofbinarydata);
-			if(tmp == NULL) return 0;
-			
-			fprintf(file, "%s %d %d\n", "P4", image->width, image->height);
-			
-			totalbytes = unsigned_char_to_bit(image->data, tmp, image->width, image->height);
-			printf("Total = %ld\n", totalbytes);
-			if(fwrite(tmp, sizeof(unsigned char), totalbytes, file) != totalbytes)
-			{
-				#ifdef VC_DEBUG
-				fprintf(stderr, "ERROR -> vc_read_image():\n\tError writing PBM, PGM or PPM file.\n");
-				#endif
+    slot->iov.iov_base = slot->buf + slot->done;
+    slot->iov.iov_len = slot->size - slot->done;
 
-				fclose(file);
-				free(tmp);
-				return 0;
-			}
+    sqe = &aio->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = slot->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = slot->fd;
+    sqe->addr = (unsigned long) &slot->iov;
+    sqe->len = 1;
+    sqe->off = slot->done;
+    sqe->user_data = (unsigned long long) index;
+    aio->sqarray[i] = i;
+    __atomic_store_n(aio->sqtail, tail + 1, __ATOMIC_RELEASE);
 
-			free(tmp);
-		}
-		else
-		{
-			fprintf(file, "%s %d %d 255\n", (image->channels == 1) ? "P5" : "P6", image->width, image->height);
-		
-			if(fwrite(image->data, image->bytesperline, image->height, file) != image->height)
-			{
-				#ifdef VC_DEBUG
-				fprintf(stderr, "ERROR -> vc_read_image():\n\tError writing PBM, PGM or PPM file.\n");
-				#endif
+    do {
+        ret = syscall(__NR_io_uring_enter, aio->ring, 1, 0, 0, NULL, 0);
+    } while ((ret < 0) && (errno == EINTR));
+    if (ret == 1) return 1;
 
-				fclose(file);
-				return 0;
-			}
-		}
-		
-		fclose(file);
+    // Sem SQPOLL o kernel s l o anel dentro de io_uring_enter: repor a cauda  seguro
+    __atomic_store_n(aio->sqtail, tail, __ATOMIC_RELEASE);
 
-		return 1;
-	}
-	
-	return 0;
+    return 0;
 }
 
-//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-//    FUNES: ADICIONADAS
-//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Processa as concluses; com wait = 1 espera pela primeira (chamar com aio->mutex bloqueado)
+static void vc_uring_reap(VC_AIO *aio, int wait) {
+    struct io_uring_cqe *cqe;
+    VC_AIO_SLOT *slot;
+    unsigned head, tail;
 
-int vc_rgb_to_gray(IVC *src, IVC *dst){
-    unsigned char *datasrc = (unsigned char *) src->data;
-    int bytesperline_src = src->width * src->channels;
-    int channels_src = src->channels;
-    unsigned char *datadst = (unsigned  char *) dst->data;
-    int bytesperline_dst = dst->width * dst->channels;
-    int channels_dst = dst->channels;
-    int width = src->width;
-    int height = src->height;
-    int x,y;
-    long int pos_src, pos_dst;
-    float rf, gf, bf;
+    if (wait) syscall(__NR_io_uring_enter, aio->ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
 
-    //verificao de erros
-    if((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
-    if((src->width != dst->width) || (src->height != dst->height)) return 0;
-    if((src->channels != 3) || (dst->channels != 1)) return 0;
+    head = *aio->cqhead;
+    tail = __atomic_load_n(aio->cqtail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        cqe = &aio->cqes[head & *aio->cqmask];
+        slot = &aio->slots[cqe->user_data];
 
+        if (cqe->res > 0) slot->done += cqe->res;
+        // Transferncia parcial: submete o resto
+        if ((cqe->res > 0) && (slot->done < slot->size) && vc_uring_submit(aio, (int) cqe->user_data)) continue;
 
-    for (y=0; y<height; y++)
-    {
-        for (x=0; x<width; x++)
-        {
-            pos_src = y * bytesperline_src + x * channels_src;
-            pos_dst = y * bytesperline_dst + x * channels_dst;
-            rf = (float) datasrc[pos_src];
-            gf = (float) datasrc[pos_src + 1];
-            bf = (float) datasrc[pos_src + 2];
-            datadst[pos_dst] = (unsigned char) ((rf * 0.299) + (gf * 0.587) + (bf * 0.114));
+        if (slot->done < slot->size) slot->error = 1;
+        close(slot->fd);
+        slot->fd = -1;
+        vc_aio_complete(aio, slot);
+    }
+    __atomic_store_n(aio->cqhead, head, __ATOMIC_RELEASE);
+}
+
+// Abre o ficheiro e submete o pedido; um erro fica registado no pedido, que termina logo
+static void vc_uring_start(VC_AIO *aio, int index) {
+    VC_AIO_SLOT *slot = &aio->slots[index];
+    struct stat st;
+
+    if (slot->write) {
+        slot->fd = open(slot->filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    } else {
+        slot->fd = open(slot->filename, O_RDONLY);
+        if ((slot->fd >= 0) && ((fstat(slot->fd, &st) != 0) || (st.st_size <= 0) ||
+                                ((slot->buf = vc_buffer_alloc((size_t) st.st_size)) == NULL))) {
+            close(slot->fd);
+            slot->fd = -1;
+        } else if (slot->fd >= 0) {
+            slot->size = (size_t) st.st_size;
         }
     }
-    return 1;
+
+    if ((slot->fd >= 0) && vc_uring_submit(aio, index)) return;
+
+    if (slot->fd >= 0) close(slot->fd);
+    slot->fd = -1;
+    slot->error = 1;
+    vc_aio_complete(aio, slot);
 }
+#endif
 
-int vc_rgb_to_hsv(IVC *src, IVC *dst){
-    unsigned char *datasrc = (unsigned char *) src->data;
-    int bytesperline_src = src->width * src->channels;
-    int channels_src = src->channels;
-    unsigned char *datadst = (unsigned  char *) dst->data;
-    int bytesperline_dst = dst->width * dst->channels;
-    int channels_dst = dst->channels;
-    int width = src->width;
-    int height = src->height;
-    int x,y;
-    long int pos_src, pos_dst;
-    float rf, gf, bf;
-    int max3, min3;
-    float value, sat, hue;
+// Espera que termine pelo menos um pedido (chamar com aio->mutex bloqueado)
+static void vc_aio_progress(VC_AIO *aio) {
+#ifdef VC_HAVE_IO_URING
+    if (aio->backend == VC_AIO_IO_URING) {
+        vc_uring_reap(aio, 1);
+        return;
+    }
+#endif
+    pthread_cond_wait(&aio->done, &aio->mutex);
+}
 
-    //verificao de erros
-    if((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
-    if((src->width != dst->width) || (src->height != dst->height)) return 0;
-    if((src->channels != 3) || (dst->channels != 3)) return 0;
+// Reserva um pedido livre, esperando pelas escritas se for preciso; -1 se todos os pedidos
+// forem leituras por recolher (chamar com aio->mutex bloqueado)
+static int vc_aio_slot(VC_AIO *aio, char *filename, int write) {
+    VC_AIO_SLOT *slot;
+    int i, writes;
 
-    for (y=0; y<height; y++)
-    {
-        for (x=0; x<width; x++)
-        {
-            pos_src = y * bytesperline_src + x * channels_src;
-            pos_dst = y * bytesperline_dst + x * channels_dst;
-            rf = (float) datasrc[pos_src];
-            gf = (float) datasrc[pos_src + 1];
-            bf = (float) datasrc[pos_src + 2];
-            max3 = MAX3(rf,gf,bf);
-            min3 = MIN3(rf,gf,bf);
-
-            if(max3 == 0){
-                hue = 0;
-                sat = 0;
-            }else if (max3 == min3){
-                hue = 0;
-                sat = 0;
-            }else{
-                //----Value-----
-                value = max3;
-                //----Sat-----
-                sat = (max3 - min3) / value;
-                //----Hue------
-                if(rf == max3){
-                    if(gf >= bf ){
-                        hue = (60 * (gf - bf)) / (max3 - min3);
-                    }else if(bf > gf){
-                        hue = 360 + (60 * (gf - bf) / (max3 - min3));
-                    }
-                }else if (gf == max3){
-                    hue = 120 + (60 * (bf - rf) / (max3 -min3));
-                }else if (bf == max3){
-                    hue = 240 + (60 * (rf - gf) / (max3 - min3));
-                }
-            }
+    if (strlen(filename) >= VC_AIO_PATH) return -1;
 
-            datadst[pos_dst] = (hue / 360) * 255 ;
-            datadst[pos_dst + 1 ] = sat * 255 ;
-            datadst[pos_dst + 2] = value;
+    for (;;) {
+#ifdef VC_HAVE_IO_URING
+        if (aio->backend == VC_AIO_IO_URING) vc_uring_reap(aio, 0);
+#endif
+        for (i = 0, writes = 0; i < aio->depth; i++) {
+            if (aio->slots[i].state == VC_AIO_FREE) break;
+            if (aio->slots[i].write) writes++;
         }
+        if (i < aio->depth) break;
+        if (writes == 0) return -1;
+        vc_aio_progress(aio);
     }
-    
-    return 1;
 
+    slot = &aio->slots[i];
+    strcpy(slot->filename, filename);
+    slot->write = write;
+    slot->seq = aio->seq++;
+    slot->buf = NULL;
+    slot->size = slot->done = 0;
+    slot->fd = -1;
+    slot->error = 0;
+
+    return i;
 }
-int vc_scale_gray_to_color_palette(IVC *src, IVC *dst){
-    unsigned char *datasrc = (unsigned char *) src->data;
-    int bytesperline_src = src->width * src->channels;
-    int channels_src = src->channels;
-    unsigned char *datadst = (unsigned  char *) dst->data;
-    int bytesperline_dst = dst->width * dst->channels;
-    int channels_dst = dst->channels;
-    int width = src->width;
-    int height = src->height;
-    int x,y;
-    long int pos_src, pos_dst;
-    float bf, gf, rf;
 
-    //verificao de erros
-    if((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
-    if((src->width != dst->width) || (src->height != dst->height)) return 0;
-    if((src->channels != 1) || (dst->channels != 3)) return 0;
+// Submete um pedido reservado com vc_aio_slot() (chamar com aio->mutex bloqueado)
+static void vc_aio_submit(VC_AIO *aio, int index) {
+    aio->slots[index].state = VC_AIO_PENDING;
+
+#ifdef VC_HAVE_IO_URING
+    if (aio->backend == VC_AIO_IO_URING) {
+        vc_uring_start(aio, index);
+        return;
+    }
+#endif
+    pthread_cond_signal(&aio->work);
+}
 
 
-    for (y=0; y<height; y++)
-    {
-        for (x=0; x<width; x++)
-        {
-            pos_src = y * bytesperline_src + x * channels_src;
-            pos_dst = y * bytesperline_dst + x * channels_dst;
-
-            if( datasrc[pos_src] < 64 ){
-                datadst[pos_dst] = 0;
-                datadst[pos_dst + 1 ] = datasrc[pos_src] * 4 ;
-                datadst[pos_dst + 2 ] = 255;
-            }else if( datasrc[pos_src] < 128 ){
-                datadst[pos_dst] = 0;
-                datadst[pos_dst + 1 ] = 255;
-                datadst[pos_dst + 2 ] = 255 - (datasrc[pos_src] - 64 )  * 4;
-            }else if( datasrc[pos_src] < 192 ){
-                datadst[pos_dst] = 255 - (datasrc[pos_src] - 128 ) * 4 ;
-                datadst[pos_dst + 1 ] = 255;
-                datadst[pos_dst + 2 ] = 0;
-            }else{
-                datadst[pos_dst] = 255;
-                datadst[pos_dst + 1 ] = 255 - (datasrc[pos_src] - 192)  * 4;
-                datadst[pos_dst + 2 ] = 0;
-            }
+// Cria o contexto de I/O assncrono com depth pedidos em curso no mximo (leituras e escritas).
+// backend: VC_AIO_AUTO (io_uring, se existir, seno thread), VC_AIO_THREADS ou VC_AIO_IO_URING.
+VC_AIO *vc_aio_new(int depth, int backend) {
+    VC_AIO *aio;
+
+    if ((depth < 2) || (backend < VC_AIO_AUTO) || (backend > VC_AIO_IO_URING)) return NULL;
+
+    aio = (VC_AIO *) calloc(1, sizeof(VC_AIO));
+    if (aio == NULL) return NULL;
+    aio->depth = depth;
+    aio->slots = (VC_AIO_SLOT *) calloc(depth, sizeof(VC_AIO_SLOT));
+    pthread_mutex_init(&aio->mutex, NULL);
+    pthread_cond_init(&aio->work, NULL);
+    pthread_cond_init(&aio->done, NULL);
+#ifdef VC_HAVE_IO_URING
+    aio->ring = -1;
+#endif
+    if (aio->slots == NULL) return vc_aio_free(aio);
+
+#ifdef VC_HAVE_IO_URING
+    // O io_uring pode no estar disponvel (kernel antigo, ou bloqueado no contentor)
+    if (backend != VC_AIO_THREADS) {
+        if (vc_uring_setup(aio)) {
+            aio->backend = VC_AIO_IO_URING;
+            return aio;
         }
+        vc_uring_teardown(aio);
+        aio->sqring = aio->cqring = NULL;
+        aio->sqes = NULL;
+        aio->ring = -1;
     }
+#endif
+    if (backend == VC_AIO_IO_URING) return vc_aio_free(aio);
 
-    return 1;
-}
+    aio->backend = VC_AIO_THREADS;
+    if (pthread_create(&aio->thread, NULL, vc_aio_thread, aio) != 0) return vc_aio_free(aio);
+    aio->started = 1;
 
-int vc_gray_to_binary(IVC *src, IVC *dst, int threshold) {
-    int x, y;
-    int channels_src = src->channels;
-    int  bystersperline_src = src->width * src->channels;
-    long int pos;
-    unsigned char *data_src = (unsigned char *)src->data;
-    unsigned char *data_dst = (unsigned char *)dst->data;
+    return aio;
+}
 
-    // Verificao de erros
-    if ((src->width <= 0) || (src->height <= 0) || (src->data == NULL)) return 0;
-    if ((src->width != dst->width) || (src->height != dst->height)) return 0;
-    if ((src->channels != 1) || (dst->channels != 1)) return 0;
+// Espera por todas as escritas; devolve 0 se alguma falhou desde o ltimo vc_aio_flush()
+int vc_aio_flush(VC_AIO *aio) {
+    int i, errors;
 
-    for (y = 0; y < src->height; y++) {
-        for (x = 0; x < src->width; x++) {
-            pos = y * bystersperline_src + x * channels_src;
+    if (aio == NULL) return 0;
 
-            if (data_src[pos] > threshold) {
-                data_dst[pos] = 255; // Pixel acima do threshold, marcado como branco
-            } else {
-                data_dst[pos] = 0; // Pixel no ou abaixo do threshold, marcado como preto
-            }
-        }
+    pthread_mutex_lock(&aio->mutex);
+    for (;;) {
+        for (i = 0; (i < aio->depth) && !(aio->slots[i].write && (aio->slots[i].state != VC_AIO_FREE)); i++);
+        if (i == aio->depth) break;
+        vc_aio_progress(aio);
     }
+    errors = aio->errors;
+    aio->errors = 0;
+    pthread_mutex_unlock(&aio->mutex);
 
-    return 1; // Sucesso
+    return errors == 0;
 }
-int vc_gray_to_binary_mean_threshold(IVC *src, IVC *dst) {
-    unsigned char *data_src = (unsigned char *)src->data;
-    int width = src->width;
-    int height = src->height;
-    long int sum = 0, pos;
-    float mean_threshold;
 
-    // Calcula a soma das intensidades de todos os pixels
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            pos = y * width + x;
-            sum += data_src[pos];
+// Termina as escritas pendentes e liberta o contexto (as leituras por recolher so descartadas)
+VC_AIO *vc_aio_free(VC_AIO *aio) {
+    int i;
+
+    if (aio == NULL) return NULL;
+
+    if (aio->slots != NULL) {
+        pthread_mutex_lock(&aio->mutex);
+        for (;;) {
+            for (i = 0; (i < aio->depth) && ((aio->slots[i].state == VC_AIO_FREE) || (aio->slots[i].state == VC_AIO_DONE)); i++);
+            if (i == aio->depth) break;
+            vc_aio_progress(aio);
         }
+        for (i = 0; i < aio->depth; i++) vc_buffer_free(aio->slots[i].buf);
+        aio->quit = 1;
+        pthread_cond_signal(&aio->work);
+        pthread_mutex_unlock(&aio->mutex);
     }
+    if (aio->started) pthread_join(aio->thread, NULL);
+#ifdef VC_HAVE_IO_URING
+    if (aio->backend == VC_AIO_IO_URING) vc_uring_teardown(aio);
+#endif
 
-    // Calcula a mdia (threshold)
-    mean_threshold = (float)sum / (float)(width * height);
+    for (i = 0; i < aio->nimages; i++) vc_image_free(aio->images[i]);
+    pthread_mutex_destroy(&aio->mutex);
+    pthread_cond_destroy(&aio->work);
+    pthread_cond_destroy(&aio->done);
+    free(aio->slots);
+    free(aio);
 
-    // Aplica o threshold e segmenta a imagem em binrio
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            pos = y * width + x;
-            data_src[pos] = (data_src[pos] > mean_threshold) ? 255 : 0;
+    return NULL;
+}
+
+int vc_aio_backend(VC_AIO *aio) {
+    return (aio != NULL) ? aio->backend : -1;
+}
+
+// Imagem da lista de imagens livres (ou nova, se nenhuma tiver as dimenses pedidas)
+IVC *vc_aio_image(VC_AIO *aio, int width, int height, int channels, int levels) {
+    IVC *image;
+    int i;
+
+    pthread_mutex_lock(&aio->mutex);
+    for (i = aio->nimages - 1; i >= 0; i--) {
+        image = aio->images[i];
+        if ((image->width == width) && (image->height == height) && (image->channels == channels) && !image->packed) {
+            aio->images[i] = aio->images[--aio->nimages];
+            pthread_mutex_unlock(&aio->mutex);
+            image->levels = levels;
+            return image;
         }
     }
+    pthread_mutex_unlock(&aio->mutex);
+
+    return vc_image_new(width, height, channels, levels);
+}
+
+// Devolve uma imagem (de vc_aio_wait_read ou vc_aio_image)  lista de imagens livres
+void vc_aio_release(VC_AIO *aio, IVC *image) {
+    if (image == NULL) return;
 
-    // Se dst for diferente de src, copie os dados para dst
-    if (dst != src) {
-        if ((dst->width != src->width) || (dst->height != src->height) || (dst->channels != 1)) return 0;
-        memcpy(dst->data, src->data, width * height);
+    pthread_mutex_lock(&aio->mutex);
+    if ((aio->nimages < VC_AIO_MAX_IMAGES) && (image->ownership == VC_OWN_POOL)) {
+        aio->images[aio->nimages++] = image;
+        image = NULL;
     }
+    pthread_mutex_unlock(&aio->mutex);
 
-    return 1; // Sucesso
+    vc_image_free(image);
 }
 
-int vc_gray_midpoint_threshold(IVC *src, IVC *dst, int kernel) {
-    unsigned char *data_src = (unsigned char *)src->data;
-    int width = src->width;
-    int height = src->height;
-    int x, y, wx, wy;
-    int half_kernel = kernel / 2;
-    unsigned char min_val, max_val;
-    unsigned char pixel_val;
+// Submete a leitura de um ficheiro PBM, PGM ou PPM (binrio ou ASCII). As leituras so
+// recolhidas por vc_aio_wait_read() pela ordem de submisso.
+int vc_aio_read(VC_AIO *aio, char *filename) {
+    int i;
 
-    if (src->channels != 1 || dst->channels != 1) {
-        printf("ERROR: Both source and destination images must be grayscale.\n");
-        return 0;
-    }
+    if ((aio == NULL) || (filename == NULL)) return 0;
 
-    for (y = 0; y < height; y++) {
-        for (x = 0; x < width; x++) {
-            min_val = 255;
-            max_val = 0;
-
-            // Percorre a vizinhana do pixel
-            for (wy = -half_kernel; wy <= half_kernel; wy++) {
-                for (wx = -half_kernel; wx <= half_kernel; wx++) {
-                    int nx = x + wx;
-                    int ny = y + wy;
-
-                    // Verifica se est dentro dos limites da imagem
-                    if (nx >= 0 && nx < width && ny >= 0 && ny < height) {
-                        pixel_val = data_src[ny * width + nx];
-                        if (pixel_val < min_val) min_val = pixel_val;
-                        if (pixel_val > max_val) max_val = pixel_val;
-                    }
-                }
-            }
+    pthread_mutex_lock(&aio->mutex);
+    if ((i = vc_aio_slot(aio, filename, 0)) >= 0) vc_aio_submit(aio, i);
+    pthread_mutex_unlock(&aio->mutex);
 
-            // Calcula o limiar para o pixel atual e aplica o threshold
-            unsigned char threshold = (min_val + max_val) / 2;
-            if (data_src[y * width + x] > threshold) {
-                dst->data[y * width + x] = 0; // Branco
-            } else {
-                dst->data[y * width + x] = 255; // Preto
-            }
+    return i >= 0;
+}
+
+// Espera pela leitura submetida h mais tempo e devolve a imagem (NULL em caso de erro ou se
+// no houver leituras). A imagem  devolvida com vc_aio_release().
+IVC *vc_aio_wait_read(VC_AIO *aio) {
+    VC_AIO_SLOT *slot = NULL;
+    VC_READER reader;
+    IVC *image = NULL;
+    unsigned char *buf;
+    size_t size;
+    int format, width, height, channels, levels;
+    int i, error;
+    VC_PROFILE_OP(NULL, NULL);
+
+    if (aio == NULL) return NULL;
+
+    pthread_mutex_lock(&aio->mutex);
+    for (i = 0; i < aio->depth; i++) {
+        if (!aio->slots[i].write && (aio->slots[i].state != VC_AIO_FREE) && ((slot == NULL) || (aio->slots[i].seq < slot->seq))) slot = &aio->slots[i];
+    }
+    if (slot == NULL) {
+        pthread_mutex_unlock(&aio->mutex);
+        return NULL;
+    }
+    while (slot->state != VC_AIO_DONE) vc_aio_progress(aio);
+    buf = slot->buf;
+    size = slot->size;
+    error = slot->error;
+    slot->buf = NULL;
+    slot->state = VC_AIO_FREE;
+    pthread_mutex_unlock(&aio->mutex);
+
+    // Converso para IVC, em memria
+    if (!error) {
+        vc_reader_memory(&reader, buf, size);
+        if (vc_reader_header(&reader, &format, &width, &height, &channels, &levels) &&
+            ((image = vc_aio_image(aio, width, height, channels, levels)) != NULL) &&
+            !vc_reader_pixels(&reader, image, format, levels)) {
+            vc_aio_release(aio, image);
+            image = NULL;
         }
     }
+    vc_buffer_free(buf);
+
+#ifdef VC_DEBUG
+    if (image == NULL) printf("ERROR -> vc_aio_wait_read():\n\tFile not found or not a valid PBM, PGM or PPM file.\n");
+#endif
+    VC_PROFILE_IMAGES(NULL, image);
 
-    return 1; // Sucesso
+    return image;
 }
 
+// Serializa a imagem (no formato de vc_write_image) e submete a escrita. A imagem pode ser
+// alterada ou devolvida logo a seguir; os erros de escrita so reportados por vc_aio_flush().
+int vc_aio_write(VC_AIO *aio, char *filename, IVC *image) {
+    unsigned char *buf;
+    size_t size;
+    int i;
+    VC_PROFILE_OP(image, NULL);
 
+    if ((aio == NULL) || (filename == NULL) || (image == NULL) || (image->data == NULL)) return 0;
 
+    if ((buf = vc_buffer_alloc(vc_image_file_size(image))) == NULL) return 0;
+    size = vc_image_encode(image, buf);
 
+    pthread_mutex_lock(&aio->mutex);
+    if ((i = vc_aio_slot(aio, filename, 1)) >= 0) {
+        aio->slots[i].buf = buf;
+        aio->slots[i].size = size;
+        vc_aio_submit(aio, i);
+    }
+    pthread_mutex_unlock(&aio->mutex);
+
+    if (i < 0) vc_buffer_free(buf);
+
+    return i >= 0;
+}
@@ -8,9 +8,12 @@
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 
 
+#include <stdio.h>
+#include <stddef.h>
+
 #define VC_DEBUG
-#define MAX3(r,g,b) (r > g ? (r > b ? : b) : ( g > b ? g : b))
-#define MIN3(r,g,b) (r < g ? (r < b ? : b) : ( g < b ? g : b))
+#define MAX3(r,g,b) ((r) > (g) ? ((r) > (b) ? (r) : (b)) : ((g) > (b) ? (g) : (b)))
+#define MIN3(r,g,b) ((r) < (g) ? ((r) < (b) ? (r) : (b)) : ((g) < (b) ? (g) : (b)))
 
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //                   ESTRUTURA DE UMA IMAGEM
@@ -22,9 +25,227 @@ typedef struct {
 	int width, height;
 	int channels;			// Binrio/Cinzentos=1; RGB=3
 	int levels;				// Binrio=1; Cinzentos [1,255]; RGB [1,255]
-	int bytesperline;		// width * channels
+	int bytesperline;		// Bytes por linha: >= width * channels ((width + 7) / 8 se packed), com enchimento
+	int packed;				// 1 = binria com 1 bit por pixel, como no PBM (1 = Preto, 0 = Branco)
+	int ownership;			// Quem liberta data: VC_OWN_MALLOC, VC_OWN_MAP ou VC_OWN_POOL
+	void *mapbase;			// Incio e tamanho do mapeamento (VC_OWN_MAP)
+	size_t mapsize;
 } IVC;
 
+#define VC_OWN_MALLOC 0		// data alocado com malloc()
+#define VC_OWN_MAP 1		// data aponta para um ficheiro mapeado por vc_image_map()
+#define VC_OWN_POOL 2		// data alocado por vc_image_new() (volta  pool ao libertar)
+#define VC_OWN_VIEW 3		// data aponta para dentro de outra imagem (vc_image_view): no  libertado
+
+// Alinhamento dos buffers e das linhas das imagens
+#define VC_ALIGN 64
+#define VC_ALIGN_UP(n) (((n) + VC_ALIGN - 1) & ~(VC_ALIGN - 1))
+
+// Mapas de cores de vc_gray_to_colormap (cinzentos -> RGB)
+#define VC_COLORMAP_DEFAULT 0		// Azul -> ciano -> verde -> amarelo -> vermelho (vc_scale_gray_to_color_palette)
+#define VC_COLORMAP_IRONBOW 1		// Cmaras trmicas: preto -> roxo -> laranja -> amarelo -> branco
+#define VC_COLORMAP_RAINBOW 2		// Violeta -> azul -> ciano -> verde -> amarelo -> vermelho
+#define VC_COLORMAP_GRAYSCALE 3		// Cinzento replicado nos 3 canais
+
+// Operadores e normas de vc_gray_gradient
+#define VC_GRADIENT_SOBEL 0
+#define VC_GRADIENT_PREWITT 1
+#define VC_NORM_L1 0				// |gx| + |gy|
+#define VC_NORM_L2 1				// sqrt(gx + gy)
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//                   ESTRUTURA DE UM BLOB (OBJECTO)
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+
+typedef struct {
+	int x, y, width, height;	// Caixa Delimitadora (Bounding Box)
+	int area;					// rea
+	int xc, yc;					// Centro-de-massa
+	int perimeter;				// Permetro: o de VC_BLOB_FEATURES (bit-quads), arredondado
+	int label;					// Etiqueta
+} OVC;
+
+// Conectividade usada na etiquetagem
+#define VC_CONNECTIVITY_4 4
+#define VC_CONNECTIVITY_8 8
+
+// Elementos estruturantes da morfologia
+#define VC_SE_RECT 0			// Retngulo kwidth x kheight
+#define VC_SE_CROSS 1			// Cruz com braos de kwidth (horizontal) e kheight (vertical)
+
+// Caractersticas de todos os blobs, em vetores separados (um por caracterstica) indexados
+// por etiqueta - 1. Acumuladas numa s passagem pela imagem de etiquetas, inteira ou por faixas.
+typedef struct {
+	int count;						// Maior etiqueta encontrada
+	int capacity;
+	int *area;
+	int *xmin, *ymin, *xmax, *ymax;	// Caixa delimitadora (inclusiva)
+	int *edges, *corners;			// Janelas 2x2 de fronteira: retas / cantos e diagonais
+	long long *m10, *m01;			// Momentos de ordem 1 e 2 (somas de x, y, x, y, xy)
+	long long *m20, *m02, *m11;
+	float *xc, *yc;					// Centro-de-massa (vc_blob_features_finish)
+	float *perimeter;				// edges + corners / sqrt(2) (vc_blob_features_finish)
+	double *mu20, *mu02, *mu11;		// Momentos centrais (vc_blob_features_finish)
+	float *circularity;				// 4 * pi * rea / permetro (vc_blob_features_finish)
+	int width;						// Estado da acumulao por faixas
+	int nextrow;
+	int *prevrow;					// Etiquetas da ltima linha acumulada
+} VC_BLOB_FEATURES;
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//          LEITURA E ESCRITA POR FAIXAS DE LINHAS
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+
+typedef struct {
+	FILE *file;
+	int width, height;
+	int channels;
+	int levels;
+	int packed;				// Ficheiro PBM (P4)
+	int writing;			// 0 = leitura; 1 = escrita
+	int row;				// Prxima linha a ler ou escrever
+	int rowsize;			// Bytes de uma linha no ficheiro
+	unsigned char *rowbuf;	// Linha empacotada (converso de/para bytes no PBM)
+} VC_STREAM;
+
+// Operador aplicado a cada faixa por vc_stream_process()
+typedef int (*vc_stream_op)(IVC *src, IVC *dst, void *ctx);
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//           LEITURA E ESCRITA ASSNCRONAS DE IMAGENS
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+
+// Contexto de I/O assncrono (definido em vc.c)
+typedef struct VC_AIO VC_AIO;
+
+// Backends de vc_aio_new()
+#define VC_AIO_AUTO 0			// io_uring, se existir; seno uma thread de I/O
+#define VC_AIO_THREADS 1		// Thread de I/O
+#define VC_AIO_IO_URING 2		// io_uring (s Linux)
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//       MSCARAS BINRIAS CODIFICADAS POR SEGMENTOS (RLE)
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+
+typedef struct {
+	int xs, xe;				// Pixels [xs, xe) da linha
+} VC_SPAN;
+
+typedef struct {
+	int width, height;
+	int nspans, capacity;
+	VC_SPAN *spans;			// Segmentos de todas as linhas, por ordem de varrimento
+	int *rowstart;			// Segmentos da linha y: [rowstart[y], rowstart[y + 1]) (height + 1 entradas)
+} VC_RLE;
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//                INSTRUMENTAO DOS OPERADORES
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+
+// Com VC_PROFILE definido (ex.: make PROFILE=1) cada operador vc_* regista o tempo, os pixels e os
+// bytes de cada chamada, e cada banda de vc_parallel_rows o mesmo por thread (vc_profile_*).
+// Sem VC_PROFILE a instrumentao no  compilada.
+//#define VC_PROFILE
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//                EXECUO PARALELA POR BANDAS
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+
+#define VC_MAX_THREADS 64
+
+// Nveis de SIMD para os kernels de linha (ver vc_set_simd_level)
+#define VC_SIMD_NONE 0
+#define VC_SIMD_SSE2 1
+#define VC_SIMD_SSSE3 2
+#define VC_SIMD_AVX2 3
+
+#ifdef _MSC_VER
+#define VC_THREAD_LOCAL __declspec(thread)
+#else
+#define VC_THREAD_LOCAL __thread
+#endif
+
+typedef struct {
+	int y0, y1;				// Linhas a processar [y0, y1)
+	int hy0, hy1;			// Linhas que podem ser lidas (banda + halo, recortadas  imagem)
+	int thread;				// ndice da thread [0, vc_get_num_threads())
+} VC_BAND;
+
+typedef void (*vc_rows_fn)(IVC *image, VC_BAND *band, void *ctx);
+
+// Tile de vc_parallel_tiles: retngulo da imagem com o seu halo (x0  sempre mltiplo de 64)
+typedef struct {
+	int x0, x1, y0, y1;		// Pixels a processar [x0, x1) x [y0, y1)
+	int hx0, hx1, hy0, hy1;	// Pixels que podem ser lidos (tile + halo, recortados  imagem)
+	int thread;				// ndice da thread [0, vc_get_num_threads())
+} VC_TILE;
+
+typedef void (*vc_tile_fn)(IVC *image, VC_TILE *tile, void *ctx);
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//                   IMAGENS INTEGRAIS
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+
+// Tabelas de (width + 1) x (height + 1) com a soma (e a soma dos quadrados) dos pixels
+// acima e  esquerda. S uma das verses de cada tabela existe: a de 32 bits enquanto
+// o total da imagem couber nela, a de 64 bits nas imagens maiores.
+typedef struct {
+	int width, height;
+	int stride;						// Elementos por linha das tabelas (width + 1)
+	unsigned int *sum;
+	unsigned long long *sum64;
+	unsigned int *sqsum;			// NULL (ambas) se no foram pedidas as somas dos quadrados
+	unsigned long long *sqsum64;
+} VC_INTEGRAL;
+
+
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//                   PIPELINE DE OPERADORES
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+
+#define VC_PIPELINE_MAX_STAGES 16
+
+// Tipos de etapa (as pontuais consecutivas so fundidas num nico kernel)
+#define VC_STAGE_RGB_TO_GRAY 0	// Pontual: RGB -> cinzentos
+#define VC_STAGE_LUT 1			// Pontual: cinzentos -> cinzentos, por tabela (threshold, inverso, ...)
+#define VC_STAGE_PALETTE 2		// Pontual: cinzentos -> RGB, por paleta (vc_gray_to_color_lut)
+#define VC_STAGE_MIDPOINT 3		// Vizinhana: vc_gray_midpoint_threshold
+#define VC_STAGE_BOX 4			// Vizinhana: vc_box_filter (1 ou 3 canais)
+#define VC_STAGE_GAUSSIAN 5		// Vizinhana: vc_gaussian_filter (1 ou 3 canais)
+
+typedef struct {
+	int type;
+	int kernel;				// Etapas de vizinhana
+	float sigma;			// VC_STAGE_GAUSSIAN
+	unsigned char lut[256 * 3];	// VC_STAGE_LUT (256 bytes) ou VC_STAGE_PALETTE (256 x RGB)
+} VC_STAGE;
+
+typedef struct {
+	VC_STAGE stages[VC_PIPELINE_MAX_STAGES];
+	int nstages;
+	int tilerows;			// Linhas por tile (0 = automtico, a partir do tamanho da cache)
+	// Estatsticas da ltima execuo de vc_pipeline_run()
+	int kernels;			// Kernels executados depois da fuso
+	int passes;				// Passagens pela imagem
+	int passes_saved;		// Passagens poupadas face a executar as etapas uma a uma
+	long long bytes_saved;	// Bytes de imagens intermdias que no foram escritos nem lidos
+} VC_PIPELINE;
+
 
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 //                    PROTTIPOS DE FUNES
@@ -32,17 +253,133 @@ typedef struct {
 
 // FUNES: ALOCAR E LIBERTAR UMA IMAGEM
 IVC *vc_image_new(int width, int height, int channels, int levels);
+IVC *vc_image_new_packed(int width, int height);
+IVC *vc_image_view(IVC *parent, int x, int y, int width, int height);
 IVC *vc_image_free(IVC *image);
+void vc_image_pool_release(void);
+void vc_image_pool_stats(long *hits, long *misses);
+
+// FUNES: EXECUO PARALELA
+int vc_set_num_threads(int nthreads);
+int vc_get_num_threads(void);
+int vc_parallel_rows(IVC *image, vc_rows_fn fn, void *ctx);
+int vc_parallel_rows_halo(IVC *image, int halo, vc_rows_fn fn, void *ctx);
+int vc_parallel_tiles(IVC *image, int halo, int bytesperpixel, vc_tile_fn fn, void *ctx);
+int vc_set_tile_size(int width, int height);
+int vc_get_simd_level(void);
+int vc_set_simd_level(int level);
+
+// FUNES: INSTRUMENTAO DOS OPERADORES
+void vc_profile_reset(void);
+int vc_profile_write_trace(char *filename);
+void vc_profile_print_summary(void);
 
 // FUNES: LEITURA E ESCRITA DE IMAGENS (PBM, PGM E PPM)
+// vc_read_image l os formatos binrios (P4, P5, P6) e ASCII (P1, P2, P3); a escrita  sempre binria
 IVC *vc_read_image(char *filename);
 int vc_write_image(char *filename, IVC *image);
+IVC *vc_image_map(char *filename, int readonly);
+
+// FUNES: LEITURA E ESCRITA POR FAIXAS DE LINHAS
+VC_STREAM *vc_stream_open_read(char *filename);
+VC_STREAM *vc_stream_open_write(char *filename, int width, int height, int channels, int levels);
+int vc_stream_read_rows(VC_STREAM *stream, IVC *strip, int y, int nrows);
+int vc_stream_write_rows(VC_STREAM *stream, IVC *strip, int y, int nrows);
+int vc_stream_close(VC_STREAM *stream);
+int vc_stream_process(char *infile, char *outfile, int striprows, int halo, int outchannels, int outlevels, vc_stream_op op, void *ctx);
+int vc_stream_midpoint_threshold(char *infile, char *outfile, int kernel, int striprows);
+
+// FUNES: HISTOGRAMA
+int vc_gray_histogram(IVC *src, unsigned int *hist);
+int vc_histogram_otsu_threshold(unsigned int *hist);
+int vc_histogram_percentile_threshold(unsigned int *hist, float percentile);
+int vc_histogram_mean_threshold(unsigned int *hist);
+
+// FUNES: IMAGENS INTEGRAIS
+VC_INTEGRAL *vc_integral_new(IVC *src, int squares);
+VC_INTEGRAL *vc_integral_free(VC_INTEGRAL *ii);
+unsigned long long vc_integral_sum(VC_INTEGRAL *ii, int x0, int y0, int x1, int y1);
+unsigned long long vc_integral_sqsum(VC_INTEGRAL *ii, int x0, int y0, int x1, int y1);
+
+// FUNES: PIPELINE DE OPERADORES
+VC_PIPELINE *vc_pipeline_new(void);
+VC_PIPELINE *vc_pipeline_free(VC_PIPELINE *p);
+int vc_pipeline_add_rgb_to_gray(VC_PIPELINE *p);
+int vc_pipeline_add_lut(VC_PIPELINE *p, unsigned char *lut);
+int vc_pipeline_add_threshold(VC_PIPELINE *p, int threshold);
+int vc_pipeline_add_invert(VC_PIPELINE *p);
+int vc_pipeline_add_palette(VC_PIPELINE *p);
+int vc_pipeline_add_colormap(VC_PIPELINE *p, int colormap);
+int vc_pipeline_add_color_lut(VC_PIPELINE *p, unsigned char *lut);
+int vc_pipeline_add_midpoint_threshold(VC_PIPELINE *p, int kernel);
+int vc_pipeline_add_box_filter(VC_PIPELINE *p, int kernel);
+int vc_pipeline_add_gaussian_filter(VC_PIPELINE *p, int kernel, float sigma);
+int vc_pipeline_run(VC_PIPELINE *p, IVC *src, IVC *dst);
+
+// FUNES: PROCESSAMENTO EM LOTE DE SEQUNCIAS DE IMAGENS
+int vc_batch_process(char *input, char *outdir, VC_PIPELINE *pipeline, int nworkers);
+
+// FUNES: LEITURA E ESCRITA ASSNCRONAS DE IMAGENS
+VC_AIO *vc_aio_new(int depth, int backend);
+VC_AIO *vc_aio_free(VC_AIO *aio);
+int vc_aio_backend(VC_AIO *aio);
+int vc_aio_read(VC_AIO *aio, char *filename);
+IVC *vc_aio_wait_read(VC_AIO *aio);
+int vc_aio_write(VC_AIO *aio, char *filename, IVC *image);
+int vc_aio_flush(VC_AIO *aio);
+IVC *vc_aio_image(VC_AIO *aio, int width, int height, int channels, int levels);
+void vc_aio_release(VC_AIO *aio, IVC *image);
 
 //Funes adicionadas
 int vc_rgb_to_gray(IVC *src, IVC *dst);
 int vc_rgb_to_hsv(IVC *src, IVC *dst);
+int vc_rgb_to_hsv_segmentation(IVC *src, IVC *dst, int hmin, int hmax, int smin, int smax, int vmin, int vmax);
 int vc_scale_gray_to_color_palette(IVC *src, IVC *dst);
+int vc_colormap(int colormap, unsigned char *lut);
+int vc_gray_to_colormap(IVC *src, IVC *dst, int colormap);
+int vc_gray_to_color_lut(IVC *src, IVC *dst, unsigned char *lut);
 int vc_gray_to_binary(IVC *src, IVC *dst, int threshold);
 int vc_gray_to_binary_mean_threshold(IVC *src, IVC *dst);
+int vc_gray_to_binary_otsu_threshold(IVC *src, IVC *dst);
+int vc_gray_to_binary_percentile_threshold(IVC *src, IVC *dst, float percentile);
 int vc_gray_midpoint_threshold(IVC *src, IVC *dst, int kernel);
+int vc_gray_bradley_threshold(IVC *src, IVC *dst, int kernel, float t);
+int vc_gray_niblack_threshold(IVC *src, IVC *dst, int kernel, float k);
+int vc_gray_sauvola_threshold(IVC *src, IVC *dst, int kernel, float k);
+int vc_gray_window_minmax(IVC *src, IVC *dstmin, IVC *dstmax, int kernel);
+int vc_binary_pack(IVC *src, IVC *dst);
+int vc_binary_unpack(IVC *src, IVC *dst);
+OVC *vc_binary_blob_labelling(IVC *src, IVC *dst, int *nlabels, int connectivity);
+VC_BLOB_FEATURES *vc_blob_features_new(int nlabels);
+VC_BLOB_FEATURES *vc_blob_features_free(VC_BLOB_FEATURES *f);
+int vc_blob_features_accumulate(VC_BLOB_FEATURES *f, IVC *labels, int y0);
+int vc_blob_features_finish(VC_BLOB_FEATURES *f);
+VC_BLOB_FEATURES *vc_blob_features(IVC *labels, int nlabels);
+int vc_blob_features_filter(VC_BLOB_FEATURES *f, int minarea, int maxarea, float mincircularity, int *keep);
+int vc_binary_erode(IVC *src, IVC *dst, int kwidth, int kheight, int shape);
+int vc_binary_dilate(IVC *src, IVC *dst, int kwidth, int kheight, int shape);
+int vc_binary_open(IVC *src, IVC *dst, int kwidth, int kheight, int shape);
+int vc_binary_close(IVC *src, IVC *dst, int kwidth, int kheight, int shape);
+int vc_gray_erode(IVC *src, IVC *dst, int kwidth, int kheight, int shape);
+int vc_gray_dilate(IVC *src, IVC *dst, int kwidth, int kheight, int shape);
+int vc_gray_open(IVC *src, IVC *dst, int kwidth, int kheight, int shape);
+int vc_gray_close(IVC *src, IVC *dst, int kwidth, int kheight, int shape);
+
+// FUNES: FILTROS DE SUAVIZAO SEPARVEIS
+int vc_box_filter(IVC *src, IVC *dst, int kernel);
+int vc_gaussian_filter(IVC *src, IVC *dst, int kernel, float sigma);
+
+// FUNES: GRADIENTES E DETEO DE ARESTAS
+int vc_gray_gradient(IVC *src, IVC *dst, int op, int norm, int nms);
+
+// FUNES: MSCARAS BINRIAS CODIFICADAS POR SEGMENTOS (RLE)
+VC_RLE *vc_rle_new(int width, int height);
+VC_RLE *vc_rle_free(VC_RLE *rle);
+VC_RLE *vc_rle_encode(IVC *src);
+int vc_rle_decode(VC_RLE *rle, IVC *dst);
+int vc_rle_write(char *filename, VC_RLE *rle);
+VC_RLE *vc_rle_read(char *filename);
+int vc_rle_erode(VC_RLE *src, VC_RLE *dst, int kwidth, int kheight, int shape);
+int vc_rle_dilate(VC_RLE *src, VC_RLE *dst, int kwidth, int kheight, int shape);
+OVC *vc_rle_blob_labelling(VC_RLE *src, IVC *dst, int *nlabels, int connectivity);
 